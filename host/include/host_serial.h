@@ -0,0 +1,12 @@
+// Host only helpers for the stubbed generic serial ports.
+#pragma once
+#include <stdint.h>
+
+/// @brief Wire two stubbed smart ports together so that bytes transmitted on
+/// one can be received on the other (like a cable between two brains).
+/// @param a smart port index (vex::PORT1 = 0)
+/// @param b smart port index
+void hostSerialConnect(uint32_t a, uint32_t b);
+
+/// @brief Number of bytes sent on a port that had no partner to receive them
+uint64_t hostSerialDropped(uint32_t index);
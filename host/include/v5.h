@@ -0,0 +1,28 @@
+// Host stand-in for the V5 SDK C API (v5.h).
+// Only the handful of symbols this project actually uses are declared here.
+// They are implemented in host/src/vex_stub.cpp on top of the C++ standard
+// library so that the protocol code can be built and measured on Linux.
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void vexDelay(uint32_t timems);
+uint32_t vexSystemTimeGet(void);
+uint64_t vexSystemHighResTimeGet(void);
+
+void vexGenericSerialEnable(uint32_t index, int32_t options);
+void vexGenericSerialBaudrate(uint32_t index, int32_t baudrate);
+int32_t vexGenericSerialReceiveAvail(uint32_t index);
+int32_t vexGenericSerialReceive(uint32_t index, uint8_t *buffer,
+                                int32_t length);
+int32_t vexGenericSerialWriteFree(uint32_t index);
+int32_t vexGenericSerialTransmit(uint32_t index, uint8_t *buffer,
+                                 int32_t length);
+void vexGenericSerialFlush(uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,109 @@
+// Host stand-in for the V5 SDK C++ API (v5_vcs.h).
+// Mirrors the small subset of the vex:: namespace used by this project.
+#pragma once
+#include "v5.h"
+#include <cstdint>
+#include <mutex>
+
+namespace vex {
+
+enum {
+  PORT1 = 0,
+  PORT2,
+  PORT3,
+  PORT4,
+  PORT5,
+  PORT6,
+  PORT7,
+  PORT8,
+  PORT9,
+  PORT10,
+  PORT11,
+  PORT12,
+  PORT13,
+  PORT14,
+  PORT15,
+  PORT16,
+  PORT17,
+  PORT18,
+  PORT19,
+  PORT20,
+  PORT21,
+  PORT22,
+};
+
+enum class rotationUnits { deg, rev, raw };
+enum class velocityUnits { pct, rpm, dps };
+enum class temperatureUnits { celsius, fahrenheit };
+enum class voltageUnits { volt, mV };
+enum class percentUnits { pct };
+enum class directionType { fwd, rev };
+enum class timeUnits { sec, msec };
+
+static constexpr directionType fwd = directionType::fwd;
+static constexpr directionType reverse = directionType::rev;
+static constexpr voltageUnits volt = voltageUnits::volt;
+static constexpr timeUnits seconds = timeUnits::sec;
+static constexpr timeUnits msec = timeUnits::msec;
+
+class mutex {
+public:
+  void lock() { m.lock(); }
+  bool try_lock() { return m.try_lock(); }
+  void unlock() { m.unlock(); }
+
+private:
+  std::mutex m;
+};
+
+class thread {
+public:
+  static constexpr int32_t threadPriorityLow = 1;
+  static constexpr int32_t threadPriorityNormal = 7;
+  static constexpr int32_t threadPriorityHigh = 15;
+};
+
+/// Tasks run on detached std::threads. Priorities are ignored on the host.
+class task {
+public:
+  task() = default;
+  task(int (*callback)(void *), void *arg, int32_t priority);
+  task(int (*callback)(void *), void *arg);
+};
+
+namespace this_thread {
+void yield();
+void sleep_for(uint32_t time_ms);
+/// Distinct for every thread, like the task id on the brain
+int32_t get_id();
+} // namespace this_thread
+
+/// Motor whose readings are whatever was last written to `readings`.
+class motor {
+public:
+  struct Readings {
+    double position_deg = 0;
+    double velocity_dps = 0;
+    double temperature_c = 0;
+    double voltage_v = 0;
+    double current_pct = 0;
+  };
+
+  explicit motor(int32_t index) : index(index) {}
+
+  double position(rotationUnits) const { return readings.position_deg; }
+  double velocity(velocityUnits) const { return readings.velocity_dps; }
+  double temperature(temperatureUnits) const { return readings.temperature_c; }
+  double voltage(voltageUnits) const { return readings.voltage_v; }
+  double current(percentUnits) const { return readings.current_pct; }
+
+  void spin(directionType, double volts, voltageUnits) {
+    readings.voltage_v = volts;
+  }
+  void stop() { readings.voltage_v = 0; }
+
+  int32_t index;
+  Readings readings;
+};
+
+} // namespace vex
@@ -0,0 +1,2 @@
+#pragma once
+#include "v5_vcs.h"
@@ -0,0 +1,325 @@
+// Host microbenchmarks for the VDP/COBS hot paths.
+//
+// Every stage is run on the same realistic channel
+// (VDP::Timestamped(VDP::Motor)) and reports time per packet, throughput in
+// packet bytes per second and heap allocations per packet. Stages on the
+// steady state send path must not allocate at all, the run fails if they do.
+//
+// The receive path is also run end to end by replaying a capture through a
+// listener as fast as it goes, either one recorded from the motor channel or
+// the file given.
+//
+// usage: vdb_bench [iterations] [capture file]
+#include "alloc_counter.hpp"
+#include "cobs_device.hpp"
+#include "vdb/capture.hpp"
+#include "host_serial.h"
+#include "serial_reactor.hpp"
+#include "vdb/builtins.hpp"
+#include "vdb/crc32.hpp"
+#include "vdb/layout.hpp"
+#include "vdb/protocol.hpp"
+#include "vdb/registry.hpp"
+#include "vdb/replay.hpp"
+#include "vdb/static_record.hpp"
+#include "vdb/types.hpp"
+#include "wrapper_device.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+class SilentDevice : public VDP::AbstractDevice {
+public:
+  bool send_packet(const VDP::Packet &) override { return true; }
+  void
+  register_receive_callback(std::function<void(const VDP::Packet &)>) override {
+  }
+};
+
+// Devices are rate limited to their baud rate. The host ports are only
+// memory, so pretend they are fast enough that the stages measure CPU time
+constexpr int32_t HOST_LINK_BAUD = 100000000;
+
+// Keeps the optimizer from throwing away work whose result is unused
+volatile uint32_t sink;
+
+// Stages that were required not to allocate but did
+int allocating_stages = 0;
+
+// The motor's readings as a plain struct, for the static record stage
+struct MotorSample {
+  uint32_t timestamp;
+  float position;
+  float velocity;
+  float voltage;
+  float current;
+  uint8_t temperature;
+};
+using MotorRecord = VDP::StaticRecord<
+    MotorSample, VDP_STATIC_NAME("motor"),
+    VDP_STATIC_FIELD(MotorSample, timestamp),
+    VDP_STATIC_FIELD(MotorSample, position),
+    VDP_STATIC_FIELD(MotorSample, velocity),
+    VDP_STATIC_FIELD(MotorSample, voltage),
+    VDP_STATIC_FIELD(MotorSample, current),
+    VDP_STATIC_FIELD(MotorSample, temperature)>;
+
+template <typename Fn>
+uint64_t run_stage(const char *name, size_t iterations, size_t bytes_per_iter,
+                   Fn fn) {
+  // Warm up so that one time allocations (vector growth etc.) are not counted
+  for (size_t i = 0; i < 16; i++) {
+    fn();
+  }
+  const AllocCounter::Scope counter;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    fn();
+  }
+  const auto end = std::chrono::steady_clock::now();
+  const uint64_t allocs = counter.allocations();
+
+  const double ns =
+      (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+  const double ns_per = ns / (double)iterations;
+  const double mb_per_s =
+      ((double)bytes_per_iter * (double)iterations) / (ns / 1e9) / 1e6;
+  printf("%-28s %10.1f ns/pkt %10.2f MB/s %8.2f allocs/pkt\n", name, ns_per,
+         mb_per_s, (double)allocs / (double)iterations);
+  return allocs;
+}
+
+template <typename Fn>
+void run_zero_alloc_stage(const char *name, size_t iterations,
+                          size_t bytes_per_iter, Fn fn) {
+  if (run_stage(name, iterations, bytes_per_iter, fn) > 0) {
+    printf("FAIL: %s allocated after warming up\n", name);
+    allocating_stages++;
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t iterations = 200000;
+  if (argc > 1) {
+    iterations = (size_t)std::strtoul(argv[1], nullptr, 10);
+  }
+
+  vex::motor mot{vex::PORT1};
+  mot.readings.position_deg = 1234.5;
+  mot.readings.velocity_dps = -87.25;
+  mot.readings.temperature_c = 41;
+  mot.readings.voltage_v = 11.9;
+  mot.readings.current_pct = 37.5;
+
+  auto motor_data = std::shared_ptr<VDP::Timestamped>(
+      new VDP::Timestamped("motor", new VDP::Motor("motor", mot)));
+  motor_data->fetch();
+
+  // Packets for the decode side stages
+  const VDP::Channel chan{motor_data};
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(chan);
+  VDP::Packet ack;
+  VDP::PacketWriter{ack}.write_channel_acknowledge(chan);
+  VDP::Packet data;
+  VDP::PacketWriter{data}.write_data_message(chan);
+
+  COBSSerialDevice::WirePacket wire;
+  COBSSerialDevice::cobs_encode(data, wire);
+
+  printf("Channel: Timestamped(Motor), data packet %d bytes, wire packet %d "
+         "bytes, %d iterations\n",
+         (int)data.size(), (int)wire.size(), (int)iterations);
+
+  VDP::Packet scratch;
+  run_zero_alloc_stage("PacketWriter::write_data", iterations, data.size(), [&]() {
+    VDP::PacketWriter writer{scratch};
+    writer.write_data_message(chan);
+    sink = (uint32_t)writer.size();
+  });
+
+  {
+    // Scoped so the registry below can bind the motor's fields to its own plan
+    const VDP::LayoutPlan plan{motor_data};
+    run_zero_alloc_stage("LayoutPlan::write", iterations, data.size(), [&]() {
+      VDP::PacketWriter writer{scratch};
+      writer.clear();
+      plan.write(writer);
+      sink = (uint32_t)writer.size();
+    });
+  }
+
+  run_zero_alloc_stage("CRC32::update", iterations, data.size(), [&]() {
+    sink = CRC32::calculate(data.data(), data.size());
+  });
+
+  COBSSerialDevice::WirePacket encoded;
+  run_zero_alloc_stage("COBS encode", iterations, data.size(), [&]() {
+    COBSSerialDevice::cobs_encode(data, encoded);
+    sink = (uint32_t)encoded.size();
+  });
+
+  // cobs_decode takes packets as the serial task splits them up: without
+  // their delimeters
+  const COBSSerialDevice::WirePacket undelimited(wire.begin() + 1,
+                                                 wire.end() - 1);
+  VDP::Packet decoded;
+  run_stage("COBS decode", iterations, data.size(), [&]() {
+    COBSSerialDevice::cobs_decode(undelimited, decoded);
+    sink = (uint32_t)decoded.size();
+  });
+
+  COBSStreamDecoder stream_decoder{COBSSerialDevice::MAX_PACKET_SIZE};
+  run_zero_alloc_stage("COBS stream decode", iterations, data.size(), [&]() {
+    for (const uint8_t b : wire) {
+      if (stream_decoder.feed(b)) {
+        sink = (uint32_t)stream_decoder.frame().size();
+      }
+    }
+  });
+
+  const VDP::PartPtr listener_schema = VDP::decode_broadcast(broadcast).second;
+  run_zero_alloc_stage("PacketReader::get_number", iterations, data.size(), [&]() {
+    VDP::PacketReader reader{data, 2};
+    listener_schema->read_data_from_message(reader);
+  });
+
+  SilentDevice dev;
+  VDP::Registry listener{&dev, VDP::Registry::Side::Listener};
+  listener.install_broadcast_callback([](const VDP::Channel &) {});
+  size_t received = 0;
+  listener.install_data_callback(
+      [&](const VDP::Channel &) { received = received + 1; });
+  listener.take_packet(broadcast);
+  const VDP::LayoutPlan listener_plan{listener_schema};
+  run_zero_alloc_stage("LayoutPlan::read", iterations, data.size(), [&]() {
+    VDP::PacketReader reader{data, 2};
+    sink = listener_plan.read(reader);
+  });
+
+  run_zero_alloc_stage("Registry::take_packet", iterations, data.size(),
+            [&]() { listener.take_packet(data); });
+
+  VDP::Registry controller{&dev, VDP::Registry::Side::Controller};
+  const VDP::ChannelID id = controller.open_channel(motor_data);
+  controller.take_packet(ack);
+  run_zero_alloc_stage("Registry::send_data", iterations, data.size(),
+            [&]() { sink = controller.send_data(id, motor_data); });
+
+  VDP::Registry::BatchConfig batching;
+  batching.max_bytes = 256;
+  controller.configure_batching(batching);
+  run_zero_alloc_stage("Registry::send_data batched", iterations, data.size(),
+            [&]() { sink = controller.send_data(id, motor_data); });
+  controller.configure_batching(VDP::Registry::BatchConfig{});
+
+  // The motor readings don't move, so this is mostly the cost of deciding
+  // there is nothing to send
+  controller.enable_delta(id);
+  run_zero_alloc_stage("Registry::send_data delta", iterations, data.size(),
+            [&]() { sink = controller.send_data(id, motor_data); });
+
+  // A struct copied into the channel and sent, compared with fetching parts
+  auto motor_record = std::make_shared<MotorRecord>();
+  VDP::Registry static_controller{&dev, VDP::Registry::Side::Controller};
+  const VDP::ChannelID static_id = static_controller.open_channel(motor_record);
+  static_controller.take_packet(ack);
+  MotorSample sample{0, 1234.5f, -87.25f, 11.9f, 37.5f, 41};
+  run_zero_alloc_stage("StaticRecord set + send_data", iterations,
+                       MotorRecord::wire_size + 6, [&]() {
+                         sample.timestamp++;
+                         motor_record->set(sample);
+                         sink = static_controller.send_data(static_id,
+                                                         motor_record);
+                       });
+
+  // Recording frames, the file writes are batched. Nothing here yields to
+  // the writer task, so the buffer has to hold everything it hasn't taken
+  VDP::CaptureWriter::Config burst;
+  burst.max_buffer_bytes = SIZE_MAX;
+  VDP::CaptureWriter capture{burst};
+  capture.open("/dev/null");
+  uint64_t capture_time = 0;
+  run_stage("CaptureWriter::append", iterations, data.size(), [&]() {
+    capture.append(VDP::CaptureDirection::Received, capture_time += 100, data);
+  });
+  capture.close();
+
+  // The whole receive path fed from a capture, schema first
+  const char *replay_path = argc > 2 ? argv[2] : "/tmp/vdb_bench_replay.vdc";
+  if (argc <= 2) {
+    VDP::CaptureWriter recording{burst};
+    recording.open(replay_path);
+    recording.append(VDP::CaptureDirection::Received, 0, broadcast);
+    for (size_t i = 1; i <= iterations; i++) {
+      recording.append(VDP::CaptureDirection::Received, i * 1000, data);
+    }
+    recording.close();
+  }
+  VDP::CaptureReader replay_capture;
+  if (!replay_capture.open(replay_path)) {
+    printf("Couldn't read capture %s\n", replay_path);
+    return 1;
+  }
+  VDP::ReplayDevice::Config fastest;
+  fastest.speed = 0;
+  VDP::ReplayDevice replay{replay_capture, fastest};
+  {
+    VDP::Registry replay_listener{&replay, VDP::Registry::Side::Listener};
+    replay_listener.install_broadcast_callback([](const VDP::Channel &) {});
+    replay_listener.install_data_callback(
+        [&](const VDP::Channel &) { received = received + 1; });
+    replay.run().print();
+  }
+  replay_capture.close();
+  if (argc <= 2) {
+    std::remove(replay_path);
+  }
+
+  // Sustained rate through the outbound queue with the serial task draining
+  // it. PORT2 has no partner so transmitted bytes are discarded
+  VDB::Device serial_dev{vex::PORT2, HOST_LINK_BAUD};
+  run_zero_alloc_stage("VDB::Device::send_packet", iterations, data.size(), [&]() {
+    while (!serial_dev.send_packet(data)) {
+      std::this_thread::yield();
+    }
+  });
+
+  // Send on one port and wait for the packet to come out of the receive
+  // callback on the port it is wired to
+  hostSerialConnect(vex::PORT3, vex::PORT4);
+  VDB::Device link_a{vex::PORT3, HOST_LINK_BAUD};
+  VDB::Device link_b{vex::PORT4, HOST_LINK_BAUD};
+  std::atomic<uint32_t> link_received{0};
+  link_b.register_receive_callback(
+      [&](const VDP::Packet &) { link_received++; });
+  run_stage("Device loopback round trip", iterations / 100, data.size(),
+            [&]() {
+              const uint32_t before = link_received;
+              while (!link_a.send_packet(data)) {
+                std::this_thread::yield();
+              }
+              while (link_received == before) {
+                std::this_thread::yield();
+              }
+            });
+  const SerialReactor::Stats reactor = SerialReactor::instance().stats();
+  printf("SerialReactor: %d passes (%d busy), poll %d ms, service latency "
+         "last/mean/max %d/%d/%d us\n",
+         (int)reactor.passes, (int)reactor.busy_passes, (int)reactor.poll_ms,
+         (int)reactor.last_service_latency_us,
+         (int)reactor.mean_service_latency_us,
+         (int)reactor.max_service_latency_us);
+
+  if (received == 0) {
+    printf("Listener never decoded a data packet\n");
+    return 1;
+  }
+  return allocating_stages > 0 ? 1 : 0;
+}
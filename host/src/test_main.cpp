@@ -0,0 +1,9 @@
+// Runs the on-robot self tests (VDP::test_all) on the host.
+#include "vdb/tests.hpp"
+#include <cstdio>
+
+int main() {
+  const bool passed = VDP::test_all();
+  printf("%s\n", passed ? "All tests passed" : "Some tests FAILED");
+  return passed ? 0 : 1;
+}
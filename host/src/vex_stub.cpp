@@ -0,0 +1,151 @@
+// Host implementation of the V5 SDK subset declared in host/include.
+#include "host_serial.h"
+#include "v5.h"
+#include "v5_vcs.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+constexpr uint32_t NUM_PORTS = 22;
+// Roughly the size of the V5 smart port transmit FIFO
+constexpr int32_t TX_FIFO_SIZE = 1024;
+
+struct Port {
+  std::mutex lock;
+  std::deque<uint8_t> rx;
+  int32_t partner = -1;
+  uint64_t dropped = 0;
+};
+
+Port ports[NUM_PORTS];
+
+const std::chrono::steady_clock::time_point start_time =
+    std::chrono::steady_clock::now();
+
+bool valid_port(uint32_t index) { return index < NUM_PORTS; }
+} // namespace
+
+extern "C" {
+
+void vexDelay(uint32_t timems) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(timems));
+}
+
+uint32_t vexSystemTimeGet(void) {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start_time)
+      .count();
+}
+
+uint64_t vexSystemHighResTimeGet(void) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start_time)
+      .count();
+}
+
+void vexGenericSerialEnable(uint32_t, int32_t) {}
+void vexGenericSerialBaudrate(uint32_t, int32_t) {}
+
+int32_t vexGenericSerialReceiveAvail(uint32_t index) {
+  if (!valid_port(index)) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> guard(ports[index].lock);
+  return (int32_t)ports[index].rx.size();
+}
+
+int32_t vexGenericSerialReceive(uint32_t index, uint8_t *buffer,
+                                int32_t length) {
+  if (!valid_port(index) || length < 0) {
+    return -1;
+  }
+  Port &port = ports[index];
+  std::lock_guard<std::mutex> guard(port.lock);
+  int32_t n = 0;
+  while (n < length && !port.rx.empty()) {
+    buffer[n] = port.rx.front();
+    port.rx.pop_front();
+    n++;
+  }
+  return n;
+}
+
+int32_t vexGenericSerialWriteFree(uint32_t index) {
+  if (!valid_port(index)) {
+    return -1;
+  }
+  return TX_FIFO_SIZE;
+}
+
+int32_t vexGenericSerialTransmit(uint32_t index, uint8_t *buffer,
+                                 int32_t length) {
+  if (!valid_port(index) || length < 0) {
+    return -1;
+  }
+  int32_t partner = -1;
+  {
+    std::lock_guard<std::mutex> guard(ports[index].lock);
+    partner = ports[index].partner;
+    if (partner < 0) {
+      ports[index].dropped += (uint64_t)length;
+      return length;
+    }
+  }
+  Port &dest = ports[partner];
+  std::lock_guard<std::mutex> guard(dest.lock);
+  dest.rx.insert(dest.rx.end(), buffer, buffer + length);
+  return length;
+}
+
+void vexGenericSerialFlush(uint32_t index) {
+  if (!valid_port(index)) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(ports[index].lock);
+  ports[index].rx.clear();
+}
+}
+
+void hostSerialConnect(uint32_t a, uint32_t b) {
+  if (!valid_port(a) || !valid_port(b)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(ports[a].lock);
+    ports[a].partner = (int32_t)b;
+  }
+  std::lock_guard<std::mutex> guard(ports[b].lock);
+  ports[b].partner = (int32_t)a;
+}
+
+uint64_t hostSerialDropped(uint32_t index) {
+  if (!valid_port(index)) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> guard(ports[index].lock);
+  return ports[index].dropped;
+}
+
+namespace vex {
+task::task(int (*callback)(void *), void *arg, int32_t)
+    : task(callback, arg) {}
+
+task::task(int (*callback)(void *), void *arg) {
+  std::thread(callback, arg).detach();
+}
+
+namespace this_thread {
+void yield() { std::this_thread::yield(); }
+void sleep_for(uint32_t time_ms) { vexDelay(time_ms); }
+int32_t get_id() {
+  static std::atomic<int32_t> next_id{1};
+  thread_local int32_t id = next_id++;
+  return id;
+}
+} // namespace this_thread
+} // namespace vex
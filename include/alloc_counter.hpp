@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+/// @brief Counts heap allocations made through operator new.
+///
+/// Only builds that define VDB_COUNT_ALLOCATIONS replace operator new to do
+/// the counting (the host build does). Everywhere else count() stays at 0 and
+/// enabled() is false, so code checking for allocations should skip the check.
+namespace AllocCounter {
+bool enabled();
+/// @brief Allocations since the program started
+uint64_t count();
+
+/// @brief Allocations made since construction
+class Scope {
+public:
+  Scope() : start(count()) {}
+  uint64_t allocations() const { return count() - start; }
+
+private:
+  uint64_t start;
+};
+} // namespace AllocCounter
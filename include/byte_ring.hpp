@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// @brief Queues of variable length byte records stored back to back in one
+/// preallocated buffer.
+///
+/// Producers reserve contiguous space, write their record straight into the
+/// buffer and commit it. The consumer reads the record in place and releases
+/// it. Nothing is allocated or copied after construction. Capacity is in
+/// bytes and is rounded up to a power of two. Every record also uses a small
+/// header and is padded to 8 bytes.
+namespace ByteRing {
+/// Bytes of bookkeeping in front of every record
+static constexpr uint32_t HEADER_SIZE = 8;
+
+/// @brief Space for one record that a producer is allowed to write into
+struct Reservation {
+  uint8_t *data = nullptr;
+  uint32_t max_len = 0;
+  uint32_t position = 0; // where the record header lives
+  uint32_t size = 0;     // bytes taken from the ring including the header
+
+  bool valid() const { return data != nullptr; }
+};
+
+/// @brief A record that the consumer can read
+struct Record {
+  uint8_t *data = nullptr;
+  uint32_t len = 0;
+  uint32_t size = 0; // bytes to give back to the ring when released
+
+  bool valid() const { return data != nullptr; }
+};
+} // namespace ByteRing
+
+/// @brief Lock free multiple producer, single consumer ring. Producers claim
+/// space with a compare and swap on the reserve index and publish each record
+/// by setting a ready bit in its header, so records can be committed in any
+/// order. The consumer stops at the first record that is not ready yet.
+class MPSCByteRing {
+public:
+  explicit MPSCByteRing(uint32_t capacity);
+
+  // Producer side, safe to call from any number of tasks
+  ByteRing::Reservation reserve(uint32_t max_len);
+  void commit(const ByteRing::Reservation &res, uint32_t len);
+
+  // Consumer side
+  ByteRing::Record peek();
+  void release(const ByteRing::Record &rec);
+
+  /// @brief Bytes currently in use, including headers and padding
+  uint32_t used() const;
+  uint32_t capacity() const { return cap; }
+
+private:
+  std::atomic<uint32_t> &header_at(uint32_t position);
+
+  uint32_t cap;
+  std::unique_ptr<uint32_t[]> storage;
+  uint8_t *buf;
+
+  std::atomic<uint32_t> reserve_head{0};
+  std::atomic<uint32_t> tail{0};
+};
@@ -1,55 +1,219 @@
 #pragma once
+#include "byte_ring.hpp"
+#include "serial_reactor.hpp"
+#include <atomic>
 #include <cstdint>
-#include <deque>
 #include <functional>
 #include <vector>
 #include <vex.h>
 
+/// @brief Incremental COBS decoder. Bytes are fed straight from the wire
+/// and decoded into a buffer owned by the decoder. Frames come out as soon
+/// as their trailing delimeter arrives.
+class COBSStreamDecoder {
+public:
+  using Packet = std::vector<uint8_t>;
+
+  explicit COBSStreamDecoder(size_t max_packet_size);
+
+  /// @brief Decode one byte from the wire
+  /// @return true if b finished a frame. It can be read from frame() until
+  /// the next call to feed
+  bool feed(uint8_t b) {
+    if (complete) {
+      reset();
+    }
+    if (b == 0x00) {
+      return finish_frame();
+    }
+    if (dropping) {
+      return false;
+    }
+    if (left_in_block == 0) {
+      // Code byte. Every block but the first and those following a maximum
+      // length block stands in for a zero
+      if (started && code != 0xff) {
+        push(0);
+      }
+      started = true;
+      code = b;
+      left_in_block = (uint8_t)(b - 1);
+    } else {
+      push(b);
+      left_in_block--;
+    }
+    return false;
+  }
+
+  const Packet &frame() const { return decoded; }
+
+  /// @brief Frames thrown away because they were too long or cut off
+  uint32_t num_dropped() const { return dropped; }
+
+private:
+  void push(uint8_t b) {
+    if (decoded.size() >= max_size) {
+      dropping = true;
+      return;
+    }
+    decoded.push_back(b);
+  }
+  bool finish_frame();
+  void reset();
+
+  size_t max_size;
+  Packet decoded;
+  uint8_t code = 0xff;
+  uint8_t left_in_block = 0;
+  bool started = false;
+  bool dropping = false;
+  bool complete = false;
+  uint32_t dropped = 0;
+};
+
+/// @brief Sends and receives packets on a V5 serial port using COBS framing.
+///
+/// Outbound packets wait in one of three queues by priority. The serial task
+/// always sends from the most important non empty queue, and only as fast as
+/// the link can carry: the configured baud rate is modeled as a token bucket
+/// of bytes (10 bits per byte on the wire), and bytes are never handed to
+/// the port faster than the bucket refills or than its FIFO has room for.
+/// Packets are written in pieces when needed, so nothing is ever flushed or
+/// cut short. Packets that find their queue full are dropped and counted.
 class COBSSerialDevice {
+  friend class SerialReactor;
+
 public:
   using WirePacket = std::vector<uint8_t>; // 0x00 delimeted, cobs encoded
   using Packet = std::vector<uint8_t>;
 
-  static constexpr int32_t NO_ACTIVITY_DELAY = 2; // ms
-  static constexpr std::size_t MAX_OUT_QUEUE_SIZE = 50;
-  static constexpr std::size_t MAX_IN_QUEUE_SIZE = 50;
+  enum class Priority : uint8_t {
+    // Acknowledgements and other small protocol replies
+    Control = 0,
+    // Schemas and offers, needed before data means anything
+    Broadcast = 1,
+    Data = 2,
+  };
+  static constexpr size_t NUM_PRIORITIES = 3;
+
+  struct TransmitStats {
+    /// Packets accepted into each queue
+    uint32_t queued[NUM_PRIORITIES];
+    /// Packets dropped because their queue was full or they were too big
+    uint32_t dropped[NUM_PRIORITIES];
+    uint32_t sent_bytes;
+    /// Times the serial task had bytes waiting but the link had no room
+    uint32_t deferrals;
+    /// Bytes sent over the last measurement window as a share of what the
+    /// link can carry, in tenths of a percent
+    uint32_t utilization_permille;
+  };
+
+  /// Largest decoded packet that will be sent or received
+  static constexpr uint32_t MAX_PACKET_SIZE = 2048;
+  /// Queue sizes in bytes. Must be powers of two
+  static constexpr uint32_t CONTROL_QUEUE_BYTES = 1024;
+  static constexpr uint32_t BROADCAST_QUEUE_BYTES = 8192;
+  static constexpr uint32_t OUTBOUND_QUEUE_BYTES = 16384;
+  /// Bytes taken from the serial port per read
+  static constexpr size_t RECEIVE_CHUNK = 1024;
+  /// Most bytes that can be sent at once after the link has been idle
+  static constexpr uint32_t TOKEN_BUCKET_BYTES = 512;
+  /// How often utilization_permille is recalculated. Microseconds
+  static constexpr uint32_t UTILIZATION_WINDOW_US = 250000;
 
   COBSSerialDevice(int32_t port, int32_t baud_rate);
-  virtual ~COBSSerialDevice() {}
+  virtual ~COBSSerialDevice();
+
+  /// @brief Most bytes cobs_encode can produce for a packet of this size,
+  /// including both delimeters
+  static constexpr size_t max_encoded_size(size_t size) {
+    return size + (size / 254) + 1 + 2;
+  }
+  /// @brief Encode a packet into out, which must have room for
+  /// max_encoded_size(size) bytes
+  /// @return the number of bytes written
+  static size_t cobs_encode(const uint8_t *in, size_t size, uint8_t *out);
+  /// @brief Decode an undelimited COBS packet into out, which must have room
+  /// for size bytes
+  /// @return the number of bytes written
+  static size_t cobs_decode(const uint8_t *in, size_t size, uint8_t *out);
+
+  static void cobs_encode(const Packet &in, WirePacket &out);
+  static void cobs_decode(const WirePacket &in, Packet &out);
+
+  TransmitStats transmit_stats() const;
+  /// @brief Bytes per second the configured baud rate can carry
+  uint32_t link_bytes_per_second() const;
+
+  /// @brief Source of microseconds for pacing the link
+  using ClockFn = uint64_t (*)();
+  /// @brief Pace the link by another clock than vexSystemHighResTimeGet.
+  /// Tests use it to step time instead of waiting on it
+  void set_clock(ClockFn new_clock) { clock = new_clock; }
 
 protected:
-  bool send_cobs_packet(const Packet &pac);
+  /// @brief Have the SerialReactor start calling service, and through it
+  /// cobs_packet_callback. The most derived class calls this once it is
+  /// fully built
+  void start_servicing();
+  /// @brief Stop the SerialReactor touching this device. The most derived
+  /// class calls this first thing in its destructor, before anything the
+  /// callback uses goes away
+  void stop_servicing();
+
+  /// @return false if the packet was dropped
+  bool send_cobs_packet(const Packet &pac, Priority prio = Priority::Data);
   virtual void cobs_packet_callback(const Packet &pac) = 0;
 
+  /// @brief Called by the SerialReactor task to deal with the low level
+  /// writing and reading bytes from the wire. Packets are decoded and handed
+  /// to cobs_packet_callback on that task. A device that was never started
+  /// can be serviced by hand instead
+  /// @return true if there was anything to do or anything is waiting to be
+  /// sent that the link has room for
+  bool service();
+
 private:
   int32_t port;
   int32_t baud_rate;
+  bool port_enabled = false;
 
   /// @brief Packets that have been encoded and are waiting for their turn
-  /// to be sent out on the wire
-  std::deque<WirePacket> outbound_packets{};
-  vex::mutex outbound_mutex;
-
-  /// @brief Packets that have been read from the wire and split up but that are
-  /// still COBS encoded
-  std::deque<WirePacket> inbound_packets;
-  vex::mutex inbound_mutex;
-  /// @brief Working buffer that the reading thread uses to assemble packets
-  /// until it finds a full COBS packet
-  WirePacket inbound_buffer;
+  /// to be sent out on the wire. Any task may add to them
+  MPSCByteRing control_packets{CONTROL_QUEUE_BYTES};
+  MPSCByteRing broadcast_packets{BROADCAST_QUEUE_BYTES};
+  MPSCByteRing outbound_packets{OUTBOUND_QUEUE_BYTES};
+  /// @brief The queues by Priority
+  MPSCByteRing *const queues[NUM_PRIORITIES] = {
+      &control_packets, &broadcast_packets, &outbound_packets};
+  /// @brief Packet partly written to the port, and which queue it is from
+  ByteRing::Record sending;
+  size_t sending_queue = 0;
+  uint32_t sending_offset = 0;
 
-  static void cobs_encode(const Packet &in, WirePacket &out);
-  static void cobs_decode(const WirePacket &in, Packet &out);
-  void handle_inbound_byte(uint8_t b);
-  bool write_packet_if_avail();
+  /// @brief Token bucket, in bytes. Refilled from elapsed time
+  uint32_t tokens = TOKEN_BUCKET_BYTES;
+  uint64_t last_refill_us = 0;
+  void refill_tokens(uint64_t now_us);
 
-  // Task that deals with the low level writing and reading bytes from the wire
-  vex::task serial_task;
-  static int serial_thread(void *self);
+  std::atomic<uint32_t> queued[NUM_PRIORITIES] = {};
+  std::atomic<uint32_t> dropped[NUM_PRIORITIES] = {};
+  std::atomic<uint32_t> sent_bytes{0};
+  std::atomic<uint32_t> deferrals{0};
+  std::atomic<uint32_t> utilization_permille{0};
+  uint64_t window_start_us = 0;
+  uint32_t window_bytes = 0;
+
+  /// @brief Raw bytes from the last read of the serial port
+  uint8_t receive_buffer[RECEIVE_CHUNK] = {0};
+  /// @brief Decodes inbound bytes as they arrive. Complete packets go
+  /// straight to the user callback
+  COBSStreamDecoder decoder{MAX_PACKET_SIZE};
+
+  bool read_packets_if_avail();
+  bool write_packet_if_avail();
+  bool anything_queued() const;
 
-  // Once the serial_task has read in an entire packet, it must be decoded
-  // this thread decodes it back into its original binary form and calls the
-  // user callback
-  vex::task decode_task;
-  static int decode_thread(void *self);
+  ClockFn clock = vexSystemHighResTimeGet;
 };
@@ -0,0 +1,154 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Counters and timings for the whole link, from the serial port up
+/// to the registries.
+///
+/// There is one set per program, shared by every device and registry, and
+/// anything may be updated from any task. Updates are single relaxed atomic
+/// operations so they are cheap enough for the per packet paths. Reading
+/// gives a snapshot that can be slightly torn across counters, which is fine
+/// for watching trends. VDP::LinkMetrics publishes all of it as a channel.
+class Metrics {
+public:
+  /// Per channel counters are kept for every possible channel id
+  static constexpr size_t MAX_CHANNELS = 256;
+  /// Bucket 0 is under 1us, bucket i under 2^i us and the last one is
+  /// everything longer
+  static constexpr size_t HISTOGRAM_BUCKETS = 16;
+  /// Timer only measures one in this many runs of a stage. Reading the clock
+  /// costs about as much as the shorter stages themselves
+  static constexpr uint32_t TIMER_SAMPLE_EVERY = 16;
+
+  enum class Direction : uint8_t {
+    Sent = 0,
+    Received = 1,
+  };
+  static constexpr size_t NUM_DIRECTIONS = 2;
+
+  enum class Timing : uint8_t {
+    // Writing a data message into its packet, checksum included
+    Serialize = 0,
+    // Checking the checksum of an incoming packet
+    CRC,
+    COBSEncode,
+    // Running a frame's bytes through the stream decoder
+    COBSDecode,
+    // Time from the serial task going to sleep to servicing what it found on
+    // waking
+    SerialLoop,
+  };
+  static constexpr size_t NUM_TIMINGS = 5;
+
+  enum class Queue : uint8_t {
+    // Bytes waiting in the serial port's receive FIFO
+    Inbound = 0,
+    // Encoded bytes waiting in the transmit queues
+    Outbound,
+  };
+  static constexpr size_t NUM_QUEUES = 2;
+
+  enum class Drop : uint8_t {
+    // A transmit queue had no room
+    QueueFull = 0,
+    // Bigger than a packet is allowed to be
+    TooLarge,
+    // A COBS frame that was cut off or too long to decode
+    Framing,
+    TooSmall,
+    BadChecksum,
+    // Data for a channel whose schema we don't have
+    UnknownChannel,
+    // Data that didn't match its channel's schema
+    BadData,
+    // A delta that had no keyframe to apply to
+    NoKeyframe,
+    // A sequenced message that was already delivered
+    Duplicate,
+    // Data sent before its channel was acked
+    NotNegotiated,
+  };
+  static constexpr size_t NUM_DROP_REASONS = 10;
+
+  struct ChannelCounters {
+    uint32_t packets;
+    /// Data messages' bytes without their checksum, the same either way
+    uint32_t bytes;
+  };
+  struct Histogram {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    /// Sum of every sample, for the mean. Wraps after about an hour of
+    /// continuous time
+    uint32_t total_us;
+  };
+
+  /// @brief The program's one set. It is a plain static object rather than a
+  /// function local one: the brain is built without thread safe statics and
+  /// the first use can come from several tasks at once. Being all atomics it
+  /// is filled in before any code runs, so it is usable from other static
+  /// objects' constructors too
+  static Metrics &instance();
+
+  void count_channel(Direction dir, uint8_t channel, size_t bytes) {
+    Counters &c = channels[(size_t)dir][channel];
+    c.packets.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add((uint32_t)bytes, std::memory_order_relaxed);
+  }
+  void count_drop(Drop reason, uint32_t n = 1) {
+    drops[(size_t)reason].fetch_add(n, std::memory_order_relaxed);
+  }
+  void record_time(Timing which, uint32_t us);
+  /// @brief Whether to time this run of a stage, one in TIMER_SAMPLE_EVERY.
+  /// Timer decides with it, stages that don't fit a scope call it directly
+  bool should_sample(Timing which);
+  /// @brief Report how full a queue currently is. Only the highest is kept
+  void record_queue_depth(Queue which, uint32_t bytes);
+
+  ChannelCounters channel(Direction dir, uint8_t channel) const;
+  uint32_t dropped(Drop reason) const;
+  Histogram histogram(Timing which) const;
+  uint32_t queue_high_watermark(Queue which) const;
+  /// @brief Start every counter over from 0
+  void reset();
+
+  /// @brief Measures from construction to destruction into a histogram,
+  /// one in TIMER_SAMPLE_EVERY times
+  class Timer {
+  public:
+    explicit Timer(Timing which);
+    ~Timer();
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+  private:
+    Timing which;
+    bool sampled;
+    uint64_t start_us = 0;
+  };
+
+private:
+  constexpr Metrics() = default;
+  static Metrics shared;
+
+  struct Counters {
+    std::atomic<uint32_t> packets{0};
+    std::atomic<uint32_t> bytes{0};
+  };
+  struct AtomicHistogram {
+    std::atomic<uint32_t> buckets[HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> max_us{0};
+    std::atomic<uint32_t> total_us{0};
+    // Runs seen by Timer, to pick which to sample
+    std::atomic<uint32_t> runs{0};
+  };
+
+  Counters channels[NUM_DIRECTIONS][MAX_CHANNELS];
+  AtomicHistogram timings[NUM_TIMINGS];
+  std::atomic<uint32_t> queue_highs[NUM_QUEUES] = {};
+  std::atomic<uint32_t> drops[NUM_DROP_REASONS] = {};
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vex.h>
+
+class COBSSerialDevice;
+
+/// @brief A single task that services every COBSSerialDevice.
+///
+/// Each pass writes and reads every registered port. When a pass finds
+/// nothing to do the reactor sleeps, doubling the sleep each idle pass up to
+/// max_poll_ms. As soon as bytes arrive or anything is waiting to go out it
+/// drops back to min_poll_ms (0 only yields to other tasks). The bounds trade
+/// CPU time against how long a byte can sit in a FIFO before it is serviced.
+class SerialReactor {
+public:
+  static constexpr size_t MAX_DEVICES = 22;
+
+  struct Config {
+    uint32_t min_poll_ms = 0;
+    uint32_t max_poll_ms = 4;
+  };
+
+  struct Stats {
+    /// Sleep the reactor will use after the next idle pass
+    uint32_t poll_ms;
+    /// Passes over the devices, and how many of them found work
+    uint32_t passes;
+    uint32_t busy_passes;
+    /// Time from going to sleep to servicing work found on waking. This is
+    /// the longest a byte could have waited to be handled. Microseconds
+    uint32_t last_service_latency_us;
+    uint32_t max_service_latency_us;
+    uint32_t mean_service_latency_us;
+    /// How much longer than asked for the most recent sleep took, a measure
+    /// of how contended the CPU is. Microseconds
+    uint32_t last_oversleep_us;
+  };
+
+  /// @brief The one reactor, built by whichever task uses it first
+  static SerialReactor &instance();
+
+  /// @brief Start servicing a device. Starts the reactor task on first use
+  bool add(COBSSerialDevice *dev);
+  /// @brief Stop servicing a device. Returns once the reactor is no longer
+  /// touching it
+  void remove(COBSSerialDevice *dev);
+
+  void configure(Config cfg);
+  Stats stats() const;
+
+private:
+  SerialReactor() = default;
+
+  /// @returns true if any device did work
+  bool service_all();
+  static int reactor_thread(void *self);
+
+  std::atomic<COBSSerialDevice *> devices[MAX_DEVICES] = {};
+  std::atomic<COBSSerialDevice *> servicing{nullptr};
+  std::atomic<bool> started{false};
+  vex::task reactor_task;
+
+  std::atomic<uint32_t> min_poll_ms{Config{}.min_poll_ms};
+  std::atomic<uint32_t> max_poll_ms{Config{}.max_poll_ms};
+
+  std::atomic<uint32_t> poll_ms{0};
+  std::atomic<uint32_t> passes{0};
+  std::atomic<uint32_t> busy_passes{0};
+  std::atomic<uint32_t> last_latency_us{0};
+  std::atomic<uint32_t> max_latency_us{0};
+  std::atomic<uint32_t> mean_latency_us{0};
+  std::atomic<uint32_t> last_oversleep_us{0};
+};
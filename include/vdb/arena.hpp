@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace VDP {
+
+/// @brief Bump allocator that holds every node of a schema tree decoded on
+/// the listener side.
+///
+/// Nodes are placed one after the other in the order they are decoded, which
+/// is the order their data arrives, so walking a record's fields walks
+/// memory forwards instead of visiting one heap block per field. Nothing is
+/// freed until the arena is destroyed, which runs the objects' destructors
+/// newest first and frees the chunks. Memory comes in chunks, each twice the
+/// size of the last, so a tree of any size costs a handful of allocations.
+class SchemaArena {
+public:
+  struct Stats {
+    uint32_t chunks = 0;
+    uint32_t objects = 0;
+    /// Bytes handed out, including per object bookkeeping
+    uint32_t bytes_used = 0;
+    /// Bytes of every chunk together
+    uint32_t bytes_reserved = 0;
+  };
+
+  explicit SchemaArena(size_t first_chunk = 512);
+  ~SchemaArena();
+  SchemaArena(const SchemaArena &) = delete;
+  SchemaArena &operator=(const SchemaArena &) = delete;
+
+  /// @brief Construct a T in the arena. It lives as long as the arena
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    void *mem = allocate(sizeof(Cleanup) + sizeof(T), alignof(T));
+    Cleanup *cleanup = (Cleanup *)mem;
+    T *object = new ((uint8_t *)mem + sizeof(Cleanup)) T(
+        std::forward<Args>(args)...);
+    cleanup->destroy = [](void *p) { ((T *)p)->~T(); };
+    cleanup->object = object;
+    cleanup->next = cleanups;
+    cleanups = cleanup;
+    stat.objects++;
+    return object;
+  }
+
+  const Stats &stats() const { return stat; }
+
+private:
+  struct Chunk {
+    Chunk *next;
+    size_t size;
+  };
+  // Put in front of every object so the arena can destroy it
+  struct Cleanup {
+    void (*destroy)(void *);
+    void *object;
+    Cleanup *next;
+  };
+  // size bytes, with the object after the Cleanup aligned to align
+  void *allocate(size_t size, size_t align);
+
+  Chunk *chunks = nullptr;
+  uint8_t *head = nullptr;
+  uint8_t *end = nullptr;
+  size_t next_chunk;
+  Cleanup *cleanups = nullptr;
+  Stats stat;
+};
+
+/// @brief Hand out a node of a tree being decoded. With an arena the node
+/// is placed in it and the pointer doesn't own it: it is only valid while
+/// the tree's root, which owns the arena, is alive. Without one the node is
+/// on the heap as usual
+template <typename T, typename... Args>
+std::shared_ptr<T> make_node(SchemaArena *arena, Args &&...args) {
+  if (arena == nullptr) {
+    return std::make_shared<T>(std::forward<Args>(args)...);
+  }
+  return std::shared_ptr<T>(std::shared_ptr<T>(),
+                            arena->make<T>(std::forward<Args>(args)...));
+}
+
+} // namespace VDP
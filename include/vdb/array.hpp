@@ -0,0 +1,271 @@
+#pragma once
+#include "vdb/quantize.hpp"
+#include "vdb/types.hpp"
+
+#include <cmath>
+
+namespace VDP {
+
+enum class ArrayLength : uint8_t {
+  // Always max_size elements, nothing but the elements on the wire
+  Fixed = 0,
+  // Up to max_size elements, the count goes first as a uint16
+  Bounded = 1,
+};
+
+/// Largest array the schema decoder accepts, in bytes of elements. Far more
+/// than fits in a packet
+constexpr size_t MAX_ARRAY_BYTES = 65535;
+
+/// @brief How each element type of an Array is stored and sent. Elem is the
+/// part type a single element would be: Float, Uint16, Half, Fixed16...
+/// Elements are kept in their wire form so sending is one copy. Codec turns
+/// values into that form and back, in bulk, and carries any settings the
+/// schema needs
+template <typename Elem> struct ArrayTraits;
+
+template <typename NumT, Type schemaType>
+struct ArrayTraits<Number<NumT, schemaType>> {
+  using ValueType = NumT;
+  using WireType = NumT;
+  static constexpr Type ElementType = schemaType;
+
+  struct Codec {
+    void encode(const ValueType *in, WireType *out, size_t count) const {
+      std::memcpy(out, in, count * sizeof(WireType));
+    }
+    void decode(const WireType *in, ValueType *out, size_t count) const {
+      std::memcpy(out, in, count * sizeof(WireType));
+    }
+    void write_schema(PacketWriter &) const {}
+    bool read_schema(PacketReader &) { return true; }
+    void pprint(std::stringstream &) const {}
+  };
+};
+
+template <> struct ArrayTraits<Half> {
+  using ValueType = float;
+  using WireType = uint16_t;
+  static constexpr Type ElementType = Type::Half;
+
+  struct Codec {
+    void encode(const float *in, uint16_t *out, size_t count) const {
+      floats_to_halves(in, out, count);
+    }
+    void decode(const uint16_t *in, float *out, size_t count) const {
+      halves_to_floats(in, out, count);
+    }
+    void write_schema(PacketWriter &) const {}
+    bool read_schema(PacketReader &) { return true; }
+    void pprint(std::stringstream &) const {}
+  };
+};
+
+template <> struct ArrayTraits<Fixed16> {
+  using ValueType = float;
+  using WireType = int16_t;
+  static constexpr Type ElementType = Type::Fixed16;
+
+  /// Every element shares one scale and offset, see Fixed16
+  struct Codec {
+    Codec(float scale = 1.0f, float offset = 0.0f)
+        : scale(scale), offset(offset) {}
+    void encode(const float *in, int16_t *out, size_t count) const {
+      quantize_fixed16(in, out, count, scale, offset);
+    }
+    void decode(const int16_t *in, float *out, size_t count) const {
+      dequantize_fixed16(in, out, count, scale, offset);
+    }
+    void write_schema(PacketWriter &sofar) const {
+      sofar.write_number<float>(scale);
+      sofar.write_number<float>(offset);
+    }
+    bool read_schema(PacketReader &reader) {
+      scale = reader.get_number<float>();
+      offset = reader.get_number<float>();
+      return reader.ok() && std::isfinite(scale) && scale != 0.0f &&
+             std::isfinite(offset);
+    }
+    void pprint(std::stringstream &ss) const {
+      ss << "(x" << scale << "+" << offset << ")";
+    }
+
+    float scale;
+    float offset;
+  };
+};
+
+/// @brief Many values of one type under one name, stored next to each other.
+///
+/// A drivetrain's motor currents or a buffer of samples become one part with
+/// one name in the schema instead of a record of one part per element. The
+/// elements are held the way they are sent, so a message is a single copy of
+/// the whole array. Quantized element types (Half, Fixed16) are converted in
+/// bulk when the values are set. A Fixed length array compiles into a
+/// LayoutPlan's block like any other fixed size field.
+template <typename Elem> class Array : public Part {
+  friend PacketReader;
+  friend PacketWriter;
+
+public:
+  using Traits = ArrayTraits<Elem>;
+  using ValueType = typename Traits::ValueType;
+  using WireType = typename Traits::WireType;
+  using Codec = typename Traits::Codec;
+  /// @brief Fill out with up to max values
+  /// @return how many were written
+  using FetchFunc = std::function<size_t(ValueType *out, size_t max)>;
+
+  /// @param max_size at most 65535
+  Array(std::string name, size_t max_size,
+        ArrayLength length = ArrayLength::Fixed, Codec codec = Codec(),
+        FetchFunc fetcher = nullptr)
+      : Part(std::move(name)), fetcher(std::move(fetcher)), codec(codec),
+        length(length), max_elements(max_size > 0xffff ? 0xffff : max_size),
+        count(length == ArrayLength::Fixed ? max_elements : 0),
+        storage(new WireType[max_elements > 0 ? max_elements : 1]()),
+        slot{(uint8_t *)storage.get(), (uint8_t *)storage.get(), nullptr} {}
+  // The slot points into this object
+  Array(const Array &) = delete;
+  Array &operator=(const Array &) = delete;
+
+  void fetch() override {
+    if (!fetcher) {
+      return;
+    }
+    scratch.resize(max_elements);
+    setValues(scratch.data(), fetcher(scratch.data(), max_elements));
+  }
+
+  /// @brief Replace the contents. A fixed array keeps its size and only
+  /// the first count elements change, a bounded one now holds count
+  /// elements. Anything past max_size is ignored
+  void setValues(const ValueType *values, size_t new_count) {
+    if (new_count > max_elements) {
+      new_count = max_elements;
+    }
+    if (length == ArrayLength::Bounded) {
+      count = new_count;
+    }
+    store(0, values, new_count);
+  }
+  void setValue(size_t i, ValueType value) {
+    if (i < count) {
+      store(i, &value, 1);
+    }
+  }
+  /// @brief Copy out up to max values
+  /// @return how many were copied
+  size_t getValues(ValueType *out, size_t max) const {
+    const size_t n = max < count ? max : count;
+    load(0, out, n);
+    return n;
+  }
+  ValueType getValue(size_t i) const {
+    ValueType value = 0;
+    if (i < count) {
+      load(i, &value, 1);
+    }
+    return value;
+  }
+  size_t size() const { return count; }
+  size_t max_size() const { return max_elements; }
+  const Codec &codec_settings() const { return codec; }
+
+  void read_data_from_message(PacketReader &reader) override {
+    size_t n = count;
+    if (length == ArrayLength::Bounded) {
+      n = reader.get_number<uint16_t>();
+      if (n > max_elements) {
+        // Doesn't fit what the schema promised
+        reader.fail(ReadStatus::BadSchema);
+        return;
+      }
+    }
+    if (reader.get_bytes(slot.data, n * sizeof(WireType))) {
+      count = n;
+    }
+  }
+
+  void pprint(std::stringstream &ss, size_t indent) const override {
+    add_indents(ss, indent);
+    ss << name << ":\t" << to_string(Type::Array) << "<"
+       << to_string(Traits::ElementType);
+    codec.pprint(ss);
+    ss << ">[" << (length == ArrayLength::Bounded ? "<=" : "") << max_elements
+       << "]";
+  }
+  void pprint_data(std::stringstream &ss, size_t indent) const override {
+    add_indents(ss, indent);
+    ss << name << ":\t[";
+    for (size_t i = 0; i < count; i++) {
+      const ValueType value = getValue(i);
+      ss << (i == 0 ? "" : ", ");
+      if (sizeof(ValueType) == 1) {
+        ss << (int)value; // Not a char
+      } else {
+        ss << value;
+      }
+    }
+    ss << "]";
+  }
+
+protected:
+  void write_schema(PacketWriter &sofar) const override {
+    sofar.write_type(Type::Array);              // Type
+    sofar.write_string(name);                   // Name
+    sofar.write_type(Traits::ElementType);      // Element type
+    codec.write_schema(sofar);                  // Its settings
+    sofar.write_number<uint16_t>(max_elements); // Most elements
+    sofar.write_number<uint8_t>((uint8_t)length);
+  }
+  void write_message(PacketWriter &sofar) const override {
+    if (length == ArrayLength::Bounded) {
+      sofar.write_number<uint16_t>((uint16_t)count);
+    }
+    sofar.write_bytes(slot.data, count * sizeof(WireType));
+  }
+  void plan_layout(LayoutPlan &plan) override {
+    if (length == ArrayLength::Fixed) {
+      plan.add_fixed(slot, max_elements * sizeof(WireType));
+    } else {
+      plan.add_part(*this);
+    }
+  }
+
+private:
+  // The codecs work on aligned elements in storage. While a LayoutPlan has
+  // the elements in its packed block storage is only a staging area and
+  // they are copied across, see FieldSlot
+  void store(size_t first, const ValueType *values, size_t n) {
+    codec.encode(values, storage.get() + first, n);
+    if (slot.data != slot.home) {
+      std::memcpy(slot.data + first * sizeof(WireType), storage.get() + first,
+                  n * sizeof(WireType));
+    }
+  }
+  void load(size_t first, ValueType *out, size_t n) const {
+    if (slot.data != slot.home) {
+      std::memcpy(storage.get() + first, slot.data + first * sizeof(WireType),
+                  n * sizeof(WireType));
+    }
+    codec.decode(storage.get() + first, out, n);
+  }
+
+  FetchFunc fetcher;
+  Codec codec;
+  ArrayLength length;
+  size_t max_elements;
+  size_t count;
+  std::unique_ptr<WireType[]> storage;
+  FieldSlot slot;
+  // Somewhere for fetch to put values before they are converted
+  std::vector<ValueType> scratch;
+};
+
+/// @brief Decode an array's schema, after its type and name
+/// @param arena where to put the array, see make_node
+PartPtr make_array_decoder(std::string name, PacketReader &reader,
+                           SchemaArena *arena = nullptr);
+
+} // namespace VDP
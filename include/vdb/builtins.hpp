@@ -17,6 +17,10 @@ private:
   PartPtr data;
 };
 
+/// @brief A V5 motor's readings. Position keeps full float precision since
+/// it grows without bound. The rest are quantized to what the motor can
+/// actually measure: velocity to 1/8 dps and voltage to 1mV in 2 bytes each,
+/// current as a half. 11 bytes a message instead of 17
 class Motor : public Record {
 public:
   Motor(std::string name, vex::motor &mot);
@@ -26,9 +30,18 @@ private:
   vex::motor &mot;
 
   std::shared_ptr<Float> pos;
-  std::shared_ptr<Float> vel;
+  std::shared_ptr<Fixed16> vel;
   std::shared_ptr<Uint8> temp;
-  std::shared_ptr<Float> voltage;
-  std::shared_ptr<Float> current;
+  std::shared_ptr<Fixed16> voltage;
+  std::shared_ptr<Half> current;
+};
+
+/// @brief Everything Metrics knows about the link, as a channel. Open it
+/// like any other and send it every so often to watch the link from the
+/// listener. Per channel counters are included for the first num_channels
+/// channel ids. Each fetch reads the current totals
+class LinkMetrics : public Record {
+public:
+  explicit LinkMetrics(std::string name, uint8_t num_channels = 4);
 };
 } // namespace VDP
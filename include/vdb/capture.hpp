@@ -0,0 +1,271 @@
+#pragma once
+#include "vdb/protocol.hpp"
+#include "vex.h"
+
+#include <atomic>
+#include <cstdio>
+
+namespace VDP {
+
+/// @brief Capture files hold every frame a device sent or received, with
+/// the time it happened, so a session can be looked at or replayed later.
+///
+/// The file is a 8 byte header ("VDPCAP" and a uint16 version) and then
+/// records, each an 8 byte header and its payload:
+///
+///   [kind u8][direction u8][payload size u16][time u32][payload]
+///
+/// time is microseconds since the record before, so it is only meaningful
+/// reading forward from a Sync record, which holds the absolute time. A Sync
+/// is written first, then every sync_bytes or whenever the gap between two
+/// records doesn't fit 32 bits. It is followed by a SchemaCopy of every
+/// broadcast seen so far, so reading can start at any Sync without missing
+/// channels. Closing the file appends the seek index: a uint64 time and file
+/// offset for every Sync, then a 16 byte trailer of the index's offset,
+/// entry count and "VIDX". A file that wasn't closed has no index, readers
+/// find the Syncs by walking the records instead. All numbers are little
+/// endian
+enum class CaptureKind : uint8_t {
+  // A frame as the device sent or received it
+  Frame = 0,
+  // A channel broadcast, in place of the Frame
+  Schema = 1,
+  // Absolute time as a uint64 of microseconds, see above
+  Sync = 2,
+  // A broadcast seen before the Sync it follows, repeated for readers that
+  // start there
+  SchemaCopy = 3,
+};
+enum class CaptureDirection : uint8_t {
+  Received = 0,
+  Sent = 1,
+};
+
+constexpr size_t CAPTURE_HEADER_SIZE = 8;
+constexpr size_t CAPTURE_RECORD_HEADER_SIZE = 8;
+constexpr size_t CAPTURE_TRAILER_SIZE = 16;
+constexpr uint16_t CAPTURE_VERSION = 1;
+
+/// @brief Appends records to a capture file. Safe to call from several
+/// tasks.
+///
+/// Records are collected in a buffer, and every buffer_bytes the full buffer
+/// is handed to a writer task while appending carries on in a second one, so
+/// a frame costs a copy and the task appending never waits on the file. If
+/// the writer falls behind the buffer keeps growing, up to max_buffer_bytes.
+/// A failed write ends the capture: later frames are ignored and close
+/// leaves the file without an index. Call flush to push out what is
+/// buffered, close to finish the file with its index.
+class CaptureWriter {
+public:
+  struct Config {
+    /// Bytes collected before they are handed to the writer task
+    size_t buffer_bytes = 16 * 1024;
+    /// Bytes collected while the writer task is still busy with the last
+    /// buffer before frames are dropped
+    size_t max_buffer_bytes = 1024 * 1024;
+    /// Bytes of records between two Syncs, which is how far a reader has to
+    /// walk at most after seeking
+    size_t sync_bytes = 64 * 1024;
+    /// Priority of the writer task
+    int32_t priority = vex::thread::threadPriorityLow;
+  };
+  struct Stats {
+    uint32_t frames = 0;
+    uint32_t syncs = 0;
+    /// Frames too big for a record, or that came with max_buffer_bytes
+    /// waiting to be written
+    uint32_t dropped = 0;
+    /// Writes to the file that failed. The first ends the capture
+    uint32_t write_errors = 0;
+    /// Bytes written to the file
+    uint64_t bytes = 0;
+  };
+
+  CaptureWriter();
+  explicit CaptureWriter(Config cfg);
+  ~CaptureWriter();
+  CaptureWriter(const CaptureWriter &) = delete;
+  CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+  /// @brief Start a new file, replacing any file at path
+  /// @return false if it couldn't be created
+  bool open(const char *path);
+  bool is_open() const;
+  /// @brief Write everything buffered, the seek index and close the file.
+  /// The index is left out if a write failed
+  void close();
+  /// @brief Write everything buffered now. Waits for the writer task
+  void flush();
+
+  /// @brief Record a frame, seen at time_us. Broadcasts are recorded as
+  /// schemas. A time before the last record's is recorded as that time
+  void append(CaptureDirection dir, uint64_t time_us, const Packet &frame);
+
+  Stats stats();
+
+private:
+  struct IndexEntry {
+    uint64_t time_us;
+    uint64_t offset;
+  };
+  struct KnownSchema {
+    CaptureDirection direction;
+    ChannelID id;
+    Packet frame;
+  };
+
+  // With the mutex held
+  void write_record(CaptureKind kind, CaptureDirection dir, uint64_t time_us,
+                    const uint8_t *data, size_t size);
+  void write_sync(uint64_t time_us);
+  void remember_schema(CaptureDirection dir, const Packet &frame);
+  // Gives buffer to the writer task, which must be done with the last one
+  void hand_off();
+
+  // Writes data to the file, by the writer task, or by close once it has
+  // stopped. Nothing is written after a failure
+  bool write_file(const Packet &data);
+  // With the mutex held, after write_file
+  void count_write(size_t size, bool wrote);
+  static int writer_thread(void *self);
+
+  Config config;
+  vex::mutex mut;
+  FILE *file = nullptr;
+  // Appended to with mut held
+  Packet buffer;
+  // Belongs to the writer task while pending_ready is set, and to whoever
+  // holds mut otherwise
+  Packet pending;
+  std::atomic<bool> pending_ready{false};
+  // Set by the first write that fails
+  std::atomic<bool> failed{false};
+  // Held while using file outside of mut
+  vex::mutex file_mut;
+  vex::task writer_task;
+  std::atomic<bool> running{false};
+  std::atomic<bool> task_alive{false};
+  // File offset of the start of buffer
+  uint64_t buffered_from = 0;
+  uint64_t last_time_us = 0;
+  uint64_t last_sync_offset = 0;
+  bool synced = false;
+  std::vector<IndexEntry> index;
+  std::vector<KnownSchema> schemas;
+  Stats stat;
+};
+
+/// @brief Records everything that goes through another device. Use it in
+/// the device's place:
+///
+///   CaptureWriter capture;
+///   capture.open("/usd/match.vdc");
+///   CaptureDevice tap{&dev, capture};
+///   Registry reg{&tap, Registry::Side::Listener};
+///
+/// Sent frames are timed once the device has taken them. A listener that
+/// answers an offer from its SchemaCache never receives that channel's
+/// broadcast, so capture from a fresh cache to have every schema in the file
+class CaptureDevice : public AbstractDevice {
+public:
+  CaptureDevice(AbstractDevice *device, CaptureWriter &writer);
+
+  bool send_packet(const Packet &packet) override;
+  void register_receive_callback(
+      std::function<void(const Packet &packet)> callback) override;
+
+private:
+  AbstractDevice *device;
+  CaptureWriter &writer;
+  std::function<void(const Packet &packet)> callback;
+};
+
+#ifndef VexV5
+/// @brief One record read back from a capture
+struct CaptureFrame {
+  CaptureKind kind;
+  CaptureDirection direction;
+  uint64_t time_us;
+  /// Points into the mapped file, valid as long as the reader is open
+  const uint8_t *data;
+  size_t size;
+};
+
+/// @brief Reads a capture file in place through a memory mapping.
+///
+/// The seek index lets reading start at any time without going through the
+/// file before it: seek finds the last Sync before that time and walks
+/// forward from there, which is at most sync_bytes of records.
+class CaptureReader {
+public:
+  /// @brief Walks the records of a capture, see begin and seek
+  class Cursor {
+  public:
+    /// @brief The next Frame, Schema or SchemaCopy
+    /// @return false at the end of the capture or if it is damaged past here
+    bool next(CaptureFrame &out);
+    size_t offset() const { return pos; }
+
+  private:
+    friend class CaptureReader;
+    Cursor(const uint8_t *data, size_t pos, size_t end, uint64_t from_us,
+           bool copies);
+
+    const uint8_t *data;
+    size_t pos;
+    size_t end;
+    uint64_t time_us = 0;
+    // Frames before this are skipped, schemas are always given
+    uint64_t from_us;
+    // Give SchemaCopys until the first other record. Only a cursor that
+    // started at a Sync needs them
+    bool copies;
+    bool started = false;
+  };
+
+  CaptureReader() = default;
+  ~CaptureReader();
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader &operator=(const CaptureReader &) = delete;
+
+  /// @return false if the file can't be mapped or isn't a capture
+  bool open(const char *path);
+  void close();
+  bool is_open() const { return data != nullptr; }
+
+  /// @brief Every record from the start
+  Cursor begin() const;
+  /// @brief Records from the Sync at or before time_us. Schemas seen before
+  /// that are given first, then Frames and Schemas from time_us on
+  Cursor seek(uint64_t time_us) const;
+
+  /// @brief Whether the file was closed properly and had its index. The
+  /// index of one that wasn't is rebuilt when it's opened
+  bool had_index() const { return indexed; }
+  size_t num_syncs() const { return syncs.size(); }
+  /// @brief Time of the first Sync and of the last record
+  uint64_t start_time_us() const;
+  uint64_t end_time_us() const { return last_time_us; }
+
+private:
+  struct Sync {
+    uint64_t time_us;
+    uint64_t offset;
+  };
+  bool read_index();
+  // Walks every record, for files without an index and to find the end time
+  // of the ones with one
+  void scan(size_t from, uint64_t time_us);
+
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  // End of the records, where the index starts if there is one
+  size_t records_end = 0;
+  bool indexed = false;
+  std::vector<Sync> syncs;
+  uint64_t last_time_us = 0;
+};
+#endif
+
+} // namespace VDP
@@ -0,0 +1,144 @@
+#pragma once
+#include "vdb/protocol.hpp"
+
+namespace VDP {
+
+class Series;
+
+/// @brief A view of the rows of a column that wrapped around its ring: the
+/// older rows are first[0..first_size), then second[0..second_size)
+template <typename T> struct ColumnSpans {
+  const T *first = nullptr;
+  size_t first_size = 0;
+  const T *second = nullptr;
+  size_t second_size = 0;
+
+  size_t size() const { return first_size + second_size; }
+  const T &operator[](size_t i) const {
+    return i < first_size ? first[i] : second[i - first_size];
+  }
+};
+
+/// @brief The history of one channel's data, one typed array per field.
+///
+/// Every numeric leaf of the channel's schema gets a column holding its
+/// values as a plain array of the field's type. Half and Fixed16 fields are
+/// kept as the floats they decode to. Strings and Arrays aren't columns.
+/// All columns share the row index and one column of receive times, so row i
+/// of every column came from the same message. Rows go in a ring of fixed
+/// capacity, the oldest is overwritten once it is full.
+class ChannelColumns {
+public:
+  struct Column {
+    std::string name;
+    /// Type of the values stored, Float for Half and Fixed16 fields
+    Type type;
+    size_t value_size;
+    std::unique_ptr<uint8_t[]> values;
+    // Copies the field's current value into a row
+    void (*extract)(const Part *leaf, uint8_t *out);
+    const Part *leaf;
+  };
+
+  /// @param schema the channel's data. For a Series, the columns are those
+  /// of its sample
+  ChannelColumns(PartPtr schema, size_t capacity);
+
+  size_t rows() const { return count; }
+  size_t capacity() const { return max_rows; }
+  /// @brief Rows lost because the ring was full
+  uint64_t overwritten() const { return num_overwritten; }
+
+  size_t num_columns() const { return columns.size(); }
+  const Column &column(size_t i) const { return columns[i]; }
+  /// @brief Index of the first column with this name
+  /// @return num_columns() if there isn't one
+  size_t find(const std::string &name) const;
+
+  /// @brief When each row was received, or sampled for a Series channel.
+  /// Microseconds
+  ColumnSpans<uint64_t> times() const { return spans(times_us.get()); }
+  /// @brief A column's values. T has to be the column's type: float for
+  /// Float columns, int16_t for Int16 ones...
+  /// @return empty spans if it isn't
+  template <typename T> ColumnSpans<T> values(size_t column) const {
+    if (column >= columns.size() ||
+        !holds<T>(columns[column].type, columns[column].value_size)) {
+      return ColumnSpans<T>{};
+    }
+    return spans((const T *)columns[column].values.get());
+  }
+  /// @brief Any value as a double, for code that doesn't care about types
+  double value(size_t column, size_t row) const;
+
+  /// @brief Append a row of the schema's current values, or a row per
+  /// sample if it is a Series
+  void append(uint64_t time_us);
+  void clear();
+
+  const PartPtr &schema() const { return source; }
+
+private:
+  void append_row(uint64_t time_us);
+
+  template <typename T> static bool holds(Type type, size_t size) {
+    return sizeof(T) == size &&
+           (std::is_floating_point<T>::value ==
+            (type == Type::Float || type == Type::Double)) &&
+           (std::is_signed<T>::value ==
+            ((type >= Type::Int8 && type <= Type::Int64) ||
+             type == Type::Float || type == Type::Double));
+  }
+  template <typename T> ColumnSpans<T> spans(const T *data) const {
+    ColumnSpans<T> s;
+    s.first = data + first_row;
+    s.first_size = first_row + count <= max_rows ? count : max_rows - first_row;
+    s.second = data;
+    s.second_size = count - s.first_size;
+    return s;
+  }
+
+  PartPtr source;
+  // Set if source is a Series, whose samples are the rows
+  Series *series = nullptr;
+  std::vector<Column> columns;
+  std::unique_ptr<uint64_t[]> times_us;
+  size_t max_rows;
+  size_t first_row = 0;
+  size_t count = 0;
+  uint64_t num_overwritten = 0;
+};
+
+/// @brief Keeps the history of every channel a listener receives as
+/// columns, see ChannelColumns.
+///
+/// Call append from the registry's data callback:
+///
+///   ColumnSink sink{4096};
+///   registry.install_data_callback(
+///       [&](const Channel &chan) { sink.append(chan); });
+///
+/// A channel whose schema is a Series adds one row per sample, at the time
+/// it was sampled, with the columns of the sample's fields. Columns are set
+/// up the first time a channel's data arrives and again if its schema
+/// changes, which clears its history.
+class ColumnSink {
+public:
+  /// @param capacity rows kept per channel
+  explicit ColumnSink(size_t capacity);
+
+  /// @brief Append the channel's current data, received now
+  void append(const Channel &chan);
+  /// @brief Append the channel's current data, received at time_us
+  void append(const Channel &chan, uint64_t time_us);
+
+  /// @return nullptr if nothing has been received on the channel
+  const ChannelColumns *channel(ChannelID id) const;
+  void clear();
+
+private:
+  size_t capacity;
+  std::vector<std::unique_ptr<ChannelColumns>> channels;
+};
+
+} // namespace VDP
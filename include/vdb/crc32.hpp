@@ -1,7 +1,10 @@
+#pragma once
+#include <cstddef>
 #include <cstdint>
 
 /// \brief A class for calculating the CRC32 checksum from arbitrary data.
-/// \sa http://forum.arduino.cc/index.php?topic=91179.0
+/// Blocks are processed 8 bytes at a time (slicing-by-8), or with the CRC32
+/// instructions on ARM cores that have them.
 class CRC32 {
 public:
   /// \brief Initialize an empty CRC32 checksum.
@@ -14,6 +17,11 @@ public:
   /// \param data The data to add to the checksum.
   void update(const uint8_t &data);
 
+  /// \brief Update the current checksum caclulation with a block of bytes.
+  /// \param data The bytes to add to the checksum.
+  /// \param size Number of bytes to add.
+  void update(const uint8_t *data, std::size_t size);
+
   /// \brief Update the current checksum caclulation with the given data.
   /// \tparam Type The data type to read.
   /// \param data The data to add to the checksum.
@@ -24,12 +32,7 @@ public:
   /// \param data The array to add to the checksum.
   /// \param size Size of the array to add.
   template <typename Type> void update(const Type *data, std::size_t size) {
-    std::size_t nBytes = size * sizeof(Type);
-    const uint8_t *pData = (const uint8_t *)data;
-
-    for (std::size_t i = 0; i < nBytes; i++) {
-      update(pData[i]);
-    }
+    update((const uint8_t *)data, size * sizeof(Type));
   }
 
   /// \returns the caclulated checksum.
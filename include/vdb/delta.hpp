@@ -0,0 +1,75 @@
+#pragma once
+#include "vdb/protocol.hpp"
+
+namespace VDP {
+
+/// @brief Sends only the fields of a channel that changed since the last
+/// message.
+///
+/// A delta message is a data packet with PacketFlags::Delta set. After the
+/// channel id (and sequence number if the channel has one), leaf fields (see
+/// Part::collect_leaves) go in groups of 8: a
+/// byte with one bit per field in the group, then the encoded value of each
+/// field whose bit is set. The receiver leaves the other fields as they were.
+/// Every keyframe_interval messages a full data message is sent instead so a
+/// listener that missed something can resync. A message where nothing changed
+/// is skipped entirely unless a keyframe is due.
+class DeltaEncoder {
+public:
+  struct Stats {
+    uint32_t keyframes = 0;
+    uint32_t deltas = 0;
+    uint32_t skipped = 0;
+    /// Bytes that sending full messages every time would have used
+    uint32_t full_bytes = 0;
+    /// Bytes actually handed to the device
+    uint32_t sent_bytes = 0;
+  };
+  enum class Result {
+    Keyframe,
+    Delta,
+    // Nothing changed and no keyframe was due. Nothing was written
+    Unchanged,
+  };
+
+  explicit DeltaEncoder(uint16_t keyframe_interval);
+
+  /// @brief Write the next message for the channel
+  Result write_message(PacketWriter &writer, const Channel &chan);
+  /// @brief Make the next message a keyframe. Use when a message may not
+  /// have reached the other side
+  void force_keyframe();
+  /// @brief The channel's tree changed shape, find its fields again and
+  /// send a keyframe
+  void tree_changed();
+  /// @brief Count bytes of a message that made it to the device
+  void count_sent(size_t bytes);
+
+  const Stats &stats() const;
+
+private:
+  void encode_fields(const Channel &chan);
+
+  uint16_t keyframe_interval;
+  uint16_t since_keyframe = 0;
+  bool need_keyframe = true;
+
+  const Part *leaves_of = nullptr;
+  std::vector<Part *> leaves;
+
+  // Every leaf's encoding, back to back, plus where each one starts. Kept for
+  // the last message sent and the one being built
+  Packet previous;
+  std::vector<uint32_t> previous_offsets;
+  Packet current;
+  std::vector<uint32_t> current_offsets;
+  Packet bitmap;
+
+  Stats stat;
+};
+
+/// @brief Apply a delta message's fields to the listener's copy of a channel
+/// @param reader positioned just after the channel id
+void apply_delta(PacketReader &reader, const std::vector<Part *> &leaves);
+
+} // namespace VDP
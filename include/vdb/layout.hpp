@@ -0,0 +1,102 @@
+#pragma once
+#include "vdb/protocol.hpp"
+
+#include <atomic>
+
+namespace VDP {
+
+class LayoutPlan;
+
+/// @brief Where a fixed size field keeps its value. Normally data is home,
+/// the field's own storage. While a LayoutPlan has the field bound it points
+/// into the plan's block instead, so accessing it has to go through memcpy:
+/// the block is packed like the wire and the value may not be aligned
+struct FieldSlot {
+  uint8_t *data;
+  uint8_t *home;
+  const LayoutPlan *bound_to;
+};
+
+/// @brief A schema tree flattened into a list of copies.
+///
+/// Compiling walks the tree once. Fixed size fields are moved into one block
+/// laid out exactly as they appear in a message, so encoding a run of them is
+/// a single memcpy and a record made only of numbers is one copy of the whole
+/// block. Strings and Part types the plan doesn't know about get their own
+/// step. A field can only live in one plan's block at a time. If it is
+/// already bound elsewhere this plan copies through the other plan's storage
+/// instead. The plan keeps every part of the tree alive and puts every value
+/// back into its field when it is destroyed. If a record's fields are
+/// replaced the plan no longer matches the tree, see is_current.
+class LayoutPlan {
+public:
+  explicit LayoutPlan(PartPtr root);
+  ~LayoutPlan();
+  LayoutPlan(const LayoutPlan &) = delete;
+  LayoutPlan &operator=(const LayoutPlan &) = delete;
+
+  /// @brief Write the data held by the tree, same bytes as
+  /// Part::write_message
+  void write(PacketWriter &writer) const;
+  /// @brief Read data written by write or Part::write_message into the tree
+  /// @return false if the message ended early
+  bool read(PacketReader &reader) const;
+
+  const Part *root() const { return root_part.get(); }
+  /// @brief true if every message is the same size, which is then the size
+  /// of the block
+  bool is_fixed() const { return fixed; }
+  size_t num_steps() const { return steps.size(); }
+  /// @brief false once any record's fields have been replaced since this
+  /// plan was compiled. Its steps still point at the old fields, which it
+  /// keeps alive, so it is safe to use but should be compiled again
+  bool is_current() const { return epoch == shape_epoch.load(); }
+  /// @brief Marks every plan made until now as not current. Called when a
+  /// tree that may have been planned changes shape
+  static void shape_changed();
+
+  // Called by Part::plan_layout implementations while compiling
+  /// @brief Keep a part alive for as long as the plan, for parts whose
+  /// fields the plan binds
+  void hold(PartPtr part);
+  void add_fixed(FieldSlot &slot, size_t size);
+  void add_string(std::string &value);
+  void add_part(Part &part);
+
+private:
+  enum class StepKind : uint8_t {
+    // size bytes at offset in the block
+    Block,
+    // size bytes wherever the slot currently points
+    Slot,
+    String,
+    // A Part the plan can't look inside. Uses its virtual functions
+    Part,
+  };
+  struct Step {
+    StepKind kind;
+    uint32_t offset;
+    uint32_t size;
+    void *target;
+  };
+  struct Binding {
+    FieldSlot *slot;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  static std::atomic<uint32_t> shape_epoch;
+
+  PartPtr root_part;
+  // Everything below root that has fields bound. Released after the values
+  // are put back
+  std::vector<PartPtr> held;
+  uint32_t epoch;
+  std::vector<Step> steps;
+  std::vector<Binding> bindings;
+  std::unique_ptr<uint8_t[]> block;
+  uint32_t block_size = 0;
+  bool fixed = true;
+};
+
+} // namespace VDP
@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstring>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -40,6 +41,11 @@ namespace VDP {
 constexpr size_t MAX_CHANNELS = 256;
 
 class Part;
+class SchemaArena;
+class DeltaEncoder;
+class LayoutPlan;
+class SequenceSender;
+class SequenceReceiver;
 using PartPtr = std::shared_ptr<Part>;
 using Packet = std::vector<uint8_t>;
 
@@ -47,10 +53,15 @@ using ChannelID = uint8_t;
 class Channel {
 public:
   friend class Registry;
+  friend class PacketWriter;
   explicit Channel(PartPtr schema_data) : data(schema_data) {}
   PartPtr data;
 
   ChannelID getID() const;
+  /// @brief Whether the data being delivered is an older message of a
+  /// reliable channel that was recovered after newer ones. It only holds
+  /// those values for the data callback, see Registry::install_data_callback
+  bool is_late() const { return late; }
 
 private:
   Channel(PartPtr schema_data, ChannelID channel_id)
@@ -59,10 +70,32 @@ private:
   ChannelID id = 0;
   Packet packet_scratch_space;
   bool acked = false;
-  // std::vector
+  // Negotiation progress on the sending side
+  uint32_t fingerprint = 0;
+  uint8_t broadcasts_sent = 0;
+  uint32_t last_broadcast_ms = 0;
+
+  // Sending side of delta encoding, null when the channel sends full messages
+  std::shared_ptr<DeltaEncoder> delta;
+  // Flattened encoder for data, null if it hasn't been compiled
+  std::shared_ptr<LayoutPlan> layout;
+
+  // Receiving side of delta encoding. Deltas are applied to the fields in
+  // leaves, which only hold a known state after a full message arrived
+  std::vector<Part *> leaves;
+  bool have_keyframe = false;
+  bool late = false;
+
+  // Sequence numbering, null for best effort channels. The sender is set up
+  // by Registry::enable_sequencing, the receiver on the first sequenced
+  // message
+  std::shared_ptr<SequenceSender> seq_tx;
+  std::shared_ptr<SequenceReceiver> seq_rx;
 };
 
 void dump_packet(const Packet &pac);
+/// @brief Decode a channel's schema from its broadcast. The tree is built in
+/// a SchemaArena of its own that the returned root keeps alive
 std::pair<ChannelID, PartPtr> decode_broadcast(const Packet &packet);
 
 enum class PacketValidity : uint8_t {
@@ -74,6 +107,12 @@ enum class PacketValidity : uint8_t {
 enum class PacketType : uint8_t {
   Broadcast = 0,
   Data = 1,
+  // Several channels' data messages in one frame
+  Batch = 2,
+  // A channel's schema fingerprint, sent instead of the whole schema when the
+  // listener may have it cached. Acknowledged with a request for the full
+  // broadcast if it doesn't
+  Offer = 3,
 };
 enum class PacketFunction : uint8_t {
   Send = 0,
@@ -82,7 +121,17 @@ enum class PacketFunction : uint8_t {
 struct PacketHeader {
   PacketType type;
   PacketFunction func;
+  // Combination of PacketFlags. Only used by data packets
+  uint8_t flags;
 };
+namespace PacketFlags {
+// The message only holds the fields that changed since the previous one
+static constexpr uint8_t Delta = 1 << 0;
+// A 16 bit sequence number follows the channel id. See SequenceSender
+static constexpr uint8_t Sequenced = 1 << 1;
+// The sender keeps recent messages and resends the ones that are NACKed
+static constexpr uint8_t Reliable = 1 << 2;
+} // namespace PacketFlags
 
 uint8_t make_header_byte(PacketHeader head);
 PacketHeader decode_header_byte(uint8_t hb);
@@ -105,7 +154,49 @@ enum class Type : uint8_t {
   Int32 = 11,
   Int64 = 12,
 
+  // A float sent as an IEEE 754 half
+  Half = 13,
+  // A float sent as an int16 multiple of a scale plus an offset. Both go in
+  // the schema as floats after the name
+  Fixed16 = 14,
+  // Many elements of one type, see Array
+  Array = 15,
+  // Timestamped samples of another part, see Series
+  Series = 16,
 };
+/// @brief Set in a schema's type byte when the part is sent compactly.
+/// Integers go out as LEB128 varints, zig-zag encoded first if they are
+/// signed, and a record's field count is a varint as well
+constexpr uint8_t TYPE_COMPACT_BIT = 0x80;
+
+/// @brief Zig-zag maps signed values to unsigned ones so that numbers close
+/// to 0 either side stay small: 0, -1, 1, -2... become 0, 1, 2, 3...
+template <typename Int>
+typename std::enable_if<std::is_signed<Int>::value, uint64_t>::type
+to_varint_value(Int v) {
+  const int64_t wide = v;
+  return ((uint64_t)wide << 1) ^ (uint64_t)(wide >> 63);
+}
+template <typename Int>
+typename std::enable_if<std::is_unsigned<Int>::value, uint64_t>::type
+to_varint_value(Int v) {
+  return v;
+}
+/// @return false if raw is outside what Int can hold
+template <typename Int>
+typename std::enable_if<std::is_signed<Int>::value, bool>::type
+from_varint_value(uint64_t raw, Int &out) {
+  const int64_t wide = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+  out = (Int)wide;
+  return wide >= std::numeric_limits<Int>::min() &&
+         wide <= std::numeric_limits<Int>::max();
+}
+template <typename Int>
+typename std::enable_if<std::is_unsigned<Int>::value, bool>::type
+from_varint_value(uint64_t raw, Int &out) {
+  out = (Int)raw;
+  return raw <= std::numeric_limits<Int>::max();
+}
 
 std::string to_string(Type t);
 void add_indents(std::stringstream &ss, size_t indent);
@@ -113,12 +204,23 @@ void add_indents(std::stringstream &ss, size_t indent);
 class PacketReader;
 class PacketWriter;
 
-PartPtr make_decoder(PacketReader &pac);
+/// @brief Decode a schema into a tree of parts.
+/// @param arena where to put the nodes, see make_node. nullptr puts each on
+/// the heap
+PartPtr make_decoder(PacketReader &pac, SchemaArena *arena = nullptr);
+/// @brief Decode an encoded schema into a tree in a SchemaArena of its own,
+/// which the returned root keeps alive
+/// @return nullptr if the schema is bad
+PartPtr decode_schema(PacketReader &reader);
 
 class Part {
   friend class PacketReader;
   friend class PacketWriter;
   friend class Record;
+  friend class DeltaEncoder;
+  friend class LayoutPlan;
+  friend class Series;
+  friend class ChannelColumns;
 
 public:
   Part(std::string name);
@@ -129,10 +231,25 @@ public:
   virtual void fetch() = 0;
   virtual void read_data_from_message(PacketReader &reader) = 0;
 
+  /// @brief Appends the fields that actually hold data (everything but
+  /// records) in the order they are written to a message
+  virtual void collect_leaves(std::vector<Part *> &out);
+  /// @brief Send integers in this part as varints, see TYPE_COMPACT_BIT.
+  /// Records pass it on to all their fields so this can be set for a whole
+  /// channel at once. Changes the schema, so it has to be done before the
+  /// part is given to open_channel. Parts without integers ignore it
+  virtual void use_compact_integers(bool compact);
+  /// @brief Whether a DeltaEncoder on the sending side sees the same leaves
+  /// the listener decodes. Records answer for all their fields
+  virtual bool supports_delta() const;
+
 protected:
   // These are needed to decode correctly but you shouldn't call them directly
   virtual void write_schema(PacketWriter &sofar) const = 0;
   virtual void write_message(PacketWriter &sofar) const = 0;
+  // Describe this part to a plan being compiled. The default has the plan
+  // call write_message and read_data_from_message
+  virtual void plan_layout(LayoutPlan &plan);
 
   virtual void pprint(std::stringstream &ss, size_t indent) const = 0;
   virtual void pprint_data(std::stringstream &ss, size_t indent) const = 0;
@@ -140,35 +257,107 @@ protected:
   std::string name;
 };
 
+enum class ReadStatus : uint8_t {
+  Ok,
+  // A read asked for more bytes than were left
+  PastEnd,
+  // A string ran to the end without its terminator
+  Unterminated,
+  // The bytes were there but don't describe a valid schema
+  BadSchema,
+  // A varint ran on too long or held a value too big for its field
+  BadVarint,
+};
+
+/// @brief Reads a packet in place. The reader only views the bytes, they
+/// must stay alive and unchanged for as long as it is used.
+///
+/// Every read is bounds checked. The first one that fails sets status() and
+/// from then on every read fails, returning 0 or an empty value, so a decoder
+/// can read a whole message and check status() once at the end.
 class PacketReader {
 public:
-  PacketReader(Packet pac);
-  PacketReader(Packet pac, size_t start);
+  PacketReader(const uint8_t *data, size_t size, size_t start = 0);
+  explicit PacketReader(const Packet &pac, size_t start = 0);
+  // Would view a temporary
+  PacketReader(Packet &&pac, size_t start = 0) = delete;
+
   uint8_t get_byte();
   Type get_type();
   std::string get_string();
+  /// @brief Read a string into out, reusing its storage
+  bool get_string(std::string &out);
+  /// @brief Copy the next len bytes to out
+  /// @return false, copying nothing, if fewer than len bytes are left
+  bool get_bytes(uint8_t *out, size_t len);
+  /// @brief Take the next len bytes without copying them
+  /// @return where they start in the packet or nullptr if there aren't len
+  const uint8_t *get_view(size_t len);
 
   template <typename Number> Number get_number() {
     static_assert(std::is_floating_point<Number>::value ||
                       std::is_integral<Number>::value,
                   "This function should only be used on numbers");
-
-    if (read_head + sizeof(Number) > pac.size()) {
-      printf("%s:%d: Reading a number[%d] at position %d would read past "
-             "buffer of "
-             "size %d\n",
-             __FILE__, __LINE__, sizeof(Number), read_head, pac.size());
+    Number value = 0;
+    if (take(sizeof(Number))) {
+      std::memcpy(&value, data + read_head - sizeof(Number), sizeof(Number));
+    }
+    return value;
+  }
+  /// @brief Read an LEB128 varint, at most 10 bytes
+  uint64_t get_varint() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (!take(1)) {
+        return 0;
+      }
+      const uint8_t b = data[read_head - 1];
+      value |= (uint64_t)(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return value;
+      }
+    }
+    fail(ReadStatus::BadVarint);
+    return 0;
+  }
+  /// @brief Read an integer written by PacketWriter::write_compact
+  template <typename Int> Int get_compact() {
+    static_assert(std::is_integral<Int>::value,
+                  "Only integers have a compact encoding");
+    Int value = 0;
+    const uint64_t raw = get_varint();
+    if (!from_varint_value(raw, value)) {
+      fail(ReadStatus::BadVarint);
       return 0;
     }
-    Number value = 0;
-    std::memcpy(&value, &pac[read_head], sizeof(Number));
-    read_head += sizeof(Number);
     return value;
   }
 
+  /// @brief Mark the packet as bad. Used by decoders for errors the reader
+  /// can't see itself
+  void fail(ReadStatus why);
+  ReadStatus status() const { return stat; }
+  bool ok() const { return stat == ReadStatus::Ok; }
+  size_t position() const { return read_head; }
+  /// @brief The whole packet being read, position() is an index into it
+  const uint8_t *bytes() const { return data; }
+  size_t remaining() const { return read_head < size ? size - read_head : 0; }
+
 private:
-  Packet pac;
+  // Moves past len bytes if they are all there
+  bool take(size_t len) {
+    if (stat != ReadStatus::Ok || len > size - read_head) {
+      fail(ReadStatus::PastEnd);
+      return false;
+    }
+    read_head += len;
+    return true;
+  }
+
+  const uint8_t *data;
+  size_t size;
   size_t read_head;
+  ReadStatus stat;
 };
 
 class PacketWriter {
@@ -177,13 +366,32 @@ public:
   void clear();
   size_t size();
   void write_byte(uint8_t b);
+  void write_bytes(const uint8_t *data, size_t len);
 
-  void write_type(Type t);
+  void write_type(Type t, bool compact = false);
   void write_string(const std::string &str);
 
   void write_channel_acknowledge(const Channel &chan);
   void write_channel_broadcast(const Channel &chan);
+  void write_schema_offer(const Channel &chan, uint32_t fingerprint);
+  void write_schema_request(const Channel &chan);
   void write_data_message(const Channel &part);
+  /// @brief Start a data message: header, channel id and, if the channel is
+  /// sequenced, its next sequence number
+  void write_data_header(const Channel &chan, uint8_t flags);
+  /// @brief Ask for sequence numbers of a channel to be sent again
+  void write_nack(const Channel &chan, const uint16_t *seqs, uint8_t count);
+
+  // Batches hold up to 255 data messages, each without its own checksum,
+  // behind a single header and checksum
+  void start_batch();
+  /// @param message a complete data message, as made by write_data_message
+  /// @param max_size the largest the finished batch may get, checksum included
+  /// @returns false, leaving the batch untouched, if the entry would make the
+  /// batch bigger than max_size or it already holds the most entries it can
+  bool append_batch_entry(const Packet &message, size_t max_size);
+  uint8_t batch_entries() const;
+  void finish_batch();
 
   const Packet &get_packet() const;
 
@@ -194,6 +402,21 @@ public:
       write_byte(b);
     }
   }
+  /// @brief LEB128: 7 bits per byte, low bits first, the top bit set on
+  /// every byte but the last
+  void write_varint(uint64_t value) {
+    while (value >= 0x80) {
+      write_byte((uint8_t)(value | 0x80));
+      value >>= 7;
+    }
+    write_byte((uint8_t)value);
+  }
+  /// @brief Write an integer as a varint, zig-zag encoded if it is signed
+  template <typename Int> void write_compact(Int value) {
+    static_assert(std::is_integral<Int>::value,
+                  "Only integers have a compact encoding");
+    write_varint(to_varint_value(value));
+  }
 
 private:
   Packet &sofar;
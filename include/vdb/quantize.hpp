@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace VDP {
+
+// Conversions between floats and the smaller forms the Half and Fixed16
+// types send. They are integer arithmetic on the bit patterns with at most
+// one float operation, so there are no library calls or divides per value
+// and the bulk versions are simple loops the compiler can unroll
+
+/// @brief Round a float to the nearest IEEE 754 half, ties to even.
+/// Anything too big becomes infinity, NaN stays NaN
+inline uint16_t float_to_half(float value) {
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  const uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+  x &= 0x7fffffff;
+
+  uint16_t half;
+  if (x >= 0x47800000) {
+    // 65536 or more, infinity or NaN
+    half = x > 0x7f800000 ? 0x7e00 : 0x7c00;
+  } else if (x < 0x38800000) {
+    // Below the smallest normal half. Adding 0.5 lines the mantissa up so
+    // the float unit does the rounding
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    f += 0.5f;
+    std::memcpy(&x, &f, sizeof(x));
+    half = (uint16_t)(x - 0x3f000000);
+  } else {
+    // Rebias the exponent and round the 13 bits that are dropped
+    const uint32_t mantissa_odd = (x >> 13) & 1;
+    x += ((uint32_t)(15 - 127) << 23) + 0xfff + mantissa_odd;
+    half = (uint16_t)(x >> 13);
+  }
+  return half | sign;
+}
+
+/// @brief Exact, every half has a float
+inline float half_to_float(uint16_t half) {
+  constexpr uint32_t shifted_exponent = 0x7c00 << 13;
+  uint32_t x = (uint32_t)(half & 0x7fff) << 13;
+  const uint32_t exponent = x & shifted_exponent;
+  x += (uint32_t)(127 - 15) << 23;
+  if (exponent == shifted_exponent) {
+    // Infinity or NaN
+    x += (uint32_t)(128 - 16) << 23;
+  } else if (exponent == 0) {
+    // Subnormal, let the float unit normalize it
+    constexpr uint32_t magic_bits = 113 << 23;
+    float f;
+    float magic;
+    x += 1 << 23;
+    std::memcpy(&f, &x, sizeof(f));
+    std::memcpy(&magic, &magic_bits, sizeof(magic));
+    f -= magic;
+    std::memcpy(&x, &f, sizeof(x));
+  }
+  x |= (uint32_t)(half & 0x8000) << 16;
+  float out;
+  std::memcpy(&out, &x, sizeof(out));
+  return out;
+}
+
+/// @brief round((value - offset) / scale), saturated to the int16 range.
+/// Takes 1 / scale so there is no divide per value. NaN becomes 0
+inline int16_t quantize_fixed16(float value, float inv_scale, float offset) {
+  const float q = (value - offset) * inv_scale;
+  if (q >= 32767.0f) {
+    return 32767;
+  }
+  if (q <= -32768.0f) {
+    return -32768;
+  }
+  if (q != q) {
+    return 0;
+  }
+  return (int16_t)(q < 0 ? q - 0.5f : q + 0.5f);
+}
+inline float dequantize_fixed16(int16_t raw, float scale, float offset) {
+  return (float)raw * scale + offset;
+}
+
+void floats_to_halves(const float *in, uint16_t *out, size_t count);
+void halves_to_floats(const uint16_t *in, float *out, size_t count);
+void quantize_fixed16(const float *in, int16_t *out, size_t count, float scale,
+                      float offset);
+void dequantize_fixed16(const int16_t *in, float *out, size_t count,
+                        float scale, float offset);
+
+} // namespace VDP
@@ -1,6 +1,60 @@
+#pragma once
+#include "vdb/delta.hpp"
 #include "vdb/protocol.hpp"
+#include "vdb/schema_cache.hpp"
+#include "vdb/sequence.hpp"
+#include "vex.h"
+
+#include <atomic>
 
 namespace VDP {
+/// @brief A mutex the task holding it can take again.
+///
+/// Devices that hand packets straight to the other side from send_packet,
+/// like the loopback ones in the tests, can bring a reply back into the
+/// registry that sent it while it still holds its lock
+class TaskMutex {
+public:
+  void lock() {
+    const int32_t me = vex::this_thread::get_id();
+    if (owner.load() == me) {
+      depth++;
+      return;
+    }
+    mut.lock();
+    owner = me;
+    depth = 1;
+  }
+  void unlock() {
+    if (--depth == 0) {
+      owner = NO_OWNER;
+      mut.unlock();
+    }
+  }
+
+  /// @brief Holds the mutex until it goes out of scope
+  class Scope {
+  public:
+    explicit Scope(TaskMutex &m) : m(m) { m.lock(); }
+    ~Scope() { m.unlock(); }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    TaskMutex &m;
+  };
+
+private:
+  static constexpr int32_t NO_OWNER = -1;
+  vex::mutex mut;
+  std::atomic<int32_t> owner{NO_OWNER};
+  // Only touched by the owner
+  uint32_t depth = 0;
+};
+
+/// @brief Both ends of the protocol. Every call may be made from any task:
+/// typically the serial task delivers packets to take_packet while another
+/// sends data and polls, and they take turns on the registry's state
 class Registry {
 public:
   int num_bad = 0;
@@ -10,6 +64,24 @@ public:
     Listener,
   };
   using CallbackFn = std::function<void(const VDP::Channel &)>;
+
+  /// @brief Settings for packing several channels' data into one frame
+  struct BatchConfig {
+    /// Largest frame to build. 0 sends every message on its own
+    size_t max_bytes = 0;
+    /// Longest a message may wait in a partly filled batch
+    uint32_t max_delay_ms = 10;
+  };
+  /// @brief How hard to try to get each channel acked
+  struct NegotiationConfig {
+    /// How long to wait for an ack before broadcasting again
+    uint32_t ack_ms = 500;
+    /// Broadcasts a channel gets before negotiation gives up on it
+    uint8_t broadcast_tries = 3;
+    /// Make the first broadcast of each channel an offer of its schema's
+    /// fingerprint, see SchemaCache
+    bool offer_fingerprints = true;
+  };
   Registry(AbstractDevice *device, Side reg_type);
   const char *identifier();
 
@@ -20,7 +92,16 @@ public:
 
   PartPtr get_remote_schema(ChannelID id);
 
+  /// @brief Use a cache of schemas that outlives this registry, so a
+  /// listener that is recreated still knows what it has already received
+  void share_schema_cache(std::shared_ptr<SchemaCache> cache);
+  std::shared_ptr<SchemaCache> get_schema_cache();
+
   void install_broadcast_callback(CallbackFn on_broadcast);
+  /// @brief Called with every data message received. A reliable channel's
+  /// message recovered after newer ones were delivered is handed over too,
+  /// with Channel::is_late set. Its values are only in the channel's data
+  /// during that call, afterwards it holds the newest message's again
   void install_data_callback(CallbackFn on_data);
 
   // creates a new channel for the given VDP object, broadcasts it to the device
@@ -32,9 +113,80 @@ public:
 
   bool send_data(ChannelID id, PartPtr data);
 
+  /// @brief Only send the fields of this channel that changed, with a full
+  /// message every keyframe_interval sends. See DeltaEncoder
+  /// @return false if the channel's data can't be sent as deltas, see
+  /// Part::supports_delta
+  bool enable_delta(ChannelID id, uint16_t keyframe_interval = 50);
+  /// @brief How much delta encoding is saving on a channel
+  /// @return false if the channel doesn't use delta encoding
+  bool delta_stats(ChannelID id, DeltaEncoder::Stats &stats) const;
+
+  /// @brief Number this channel's data messages so the listener can count
+  /// losses. Reliable channels also resend messages the listener NACKs, as
+  /// long as they are still in the sender's window. See SequenceSender
+  bool enable_sequencing(ChannelID id, bool reliable = false);
+  /// @brief Sending side stats for one of our sequenced channels
+  bool sequence_stats(ChannelID id, SequenceSender::Stats &stats) const;
+  /// @brief Loss stats for a sequenced channel from the other side
+  /// @return false if the channel hasn't received sequenced data
+  bool loss_stats(ChannelID id, SequenceReceiver::Stats &stats) const;
+
+  // With batching on, send_data queues messages into a shared frame that goes
+  // out once it is full or max_delay_ms after its first message. Channels sent
+  // between two flushes land in the same frame as long as they fit, which
+  // gives the listener a consistent snapshot of them
+  void configure_batching(BatchConfig cfg);
+  /// @brief Send the current batch now
+  bool flush();
+  /// @brief Call periodically to send batches whose deadline has passed and
+  /// to keep negotiation going. Listeners call it too, it repeats NACKs for
+  /// reliable channels whose losses haven't been made up
+  void poll();
+
+  enum class NegotiationState {
+    // start_negotiation hasn't been called
+    Idle,
+    InProgress,
+    // Every channel was acked
+    Done,
+    // Some channel wasn't acked after all its broadcasts
+    Failed,
+  };
+
+  /// @brief Broadcast every channel that hasn't been acked, all at once.
+  /// Each channel can send data as soon as its own ack comes back. Call poll()
+  /// periodically to resend broadcasts whose ack didn't arrive in time.
+  /// Channels opened after this are broadcast straight away
+  void start_negotiation();
+  NegotiationState negotiation_state() const;
+  void configure_negotiation(NegotiationConfig cfg);
+  bool is_acked(ChannelID id) const;
+
+  /// @brief start_negotiation and wait for it to finish
+  /// @return true if every channel was acked
   bool negotiate();
 
 private:
+  // message is one data message, without a checksum
+  void receive_data(const uint8_t *message, size_t len);
+  void receive_batch(const Packet &pac);
+  void receive_nack(const Packet &pac);
+  // A reliable channel's message that arrived after newer ones
+  void receive_late(Channel &chan, PacketHeader header, PacketReader &reader);
+  // Gap and duplicate detection. Sends NACKs for reliable channels
+  SequenceReceiver::Verdict check_sequence(Channel &chan, uint8_t flags,
+                                           uint16_t seq);
+  void send_due_nacks(Channel &chan);
+  // Whether message is queued or went out. Sent bytes are counted by flush
+  bool send_batched(const Packet &message);
+  // false if a batch was due and couldn't be sent
+  bool poll_batch();
+  void send_broadcast(Channel &chan);
+  void poll_negotiation();
+  // Set up a channel from the other side and acknowledge it
+  void install_remote_channel(ChannelID id, PartPtr schema);
+
   ChannelID new_channel_id() {
     ChannelID id = next_channel_id;
     next_channel_id++;
@@ -42,17 +194,33 @@ private:
   }
 
   Side reg_type;
-  bool needs_ack = false;
-  static constexpr size_t ack_ms = 500;
+  NegotiationState negotiation = NegotiationState::Idle;
+  NegotiationConfig negotiation_config;
 
   AbstractDevice *device;
   // Our channels (us -> them)
   std::vector<Channel> my_channels;
   ChannelID next_channel_id = 0;
 
-  // The channels we know about from the other side
+  // The channels we know about from the other side, indexed by id. Ids we
+  // haven't seen a broadcast for have no data
   // (them -> us)
   std::vector<Channel> remote_channels;
+  std::shared_ptr<SchemaCache> schema_cache;
+
+  mutable TaskMutex mut;
+  // Acks, NACKs and other answers to what take_packet received. Kept apart
+  // from the channels' buffers, which may be holding a message being sent
+  Packet reply_packet;
+  // A channel's values while a late message is delivered in their place
+  Packet late_restore;
+
+  BatchConfig batch_config;
+  Packet batch_packet;
+  // Delta encoded channels with an entry in batch_packet, which need a
+  // keyframe if it doesn't go out
+  std::vector<ChannelID> batch_deltas;
+  uint32_t batch_started_ms = 0;
 
   CallbackFn on_broadcast = [&](VDP::Channel chan) {
     std::string schema_str = chan.data->pretty_print();
@@ -0,0 +1,79 @@
+#pragma once
+#ifndef VexV5
+#include "vdb/capture.hpp"
+
+namespace VDP {
+
+/// @brief Plays a capture back into a Registry as if its frames were
+/// arriving from the link.
+///
+///   CaptureReader capture;
+///   capture.open("match.vdc");
+///   ReplayDevice replay{capture};
+///   Registry listener{&replay, Registry::Side::Listener};
+///   ReplayDevice::Stats stats = replay.run();
+///
+/// Frames go through take_packet exactly like live ones, schemas included,
+/// so everything the listener does with real traffic it does here. Replies
+/// the registry sends (acks, NACKs) are counted and dropped. With speed 0
+/// frames are fed back to back, which makes the replay a repeatable end to
+/// end benchmark of the receive path on real traffic.
+class ReplayDevice : public AbstractDevice {
+public:
+  struct Config {
+    /// How many times faster than it was recorded to play, 1 for real time.
+    /// 0 plays as fast as the registry takes the frames
+    double speed = 1.0;
+    /// Only frames from this time, see CaptureReader::seek
+    uint64_t from_us = 0;
+    /// Only frames up to this time
+    uint64_t to_us = UINT64_MAX;
+    /// Which side's frames to play. Received replays what the capturing
+    /// device was given
+    CaptureDirection direction = CaptureDirection::Received;
+  };
+  struct Stats {
+    /// Frames given to the registry, schemas included
+    uint32_t frames = 0;
+    uint32_t schemas = 0;
+    uint64_t bytes = 0;
+    /// Frames the registry dropped, see Metrics::Drop
+    uint32_t dropped = 0;
+    /// Packets the registry sent back
+    uint32_t replies = 0;
+    /// Time between the first and last frame played, as recorded
+    uint64_t capture_us = 0;
+    /// How long playing took, and where it went: reading frames out of the
+    /// capture, waiting for their time to come, and in take_packet
+    uint64_t wall_ns = 0;
+    uint64_t read_ns = 0;
+    uint64_t wait_ns = 0;
+    uint64_t decode_ns = 0;
+
+    double packets_per_second() const;
+    /// capture_us / wall_ns, how much faster than real time it played
+    double speedup() const;
+    void print() const;
+  };
+
+  explicit ReplayDevice(const CaptureReader &reader);
+  ReplayDevice(const CaptureReader &reader, Config cfg);
+
+  bool send_packet(const Packet &packet) override;
+  void register_receive_callback(
+      std::function<void(const Packet &packet)> callback) override;
+
+  /// @brief Play the capture through, returning once it's done
+  Stats run();
+
+private:
+  const CaptureReader &reader;
+  Config config;
+  std::function<void(const Packet &packet)> callback;
+  uint32_t replies = 0;
+  // Frames are copied here to be handed over, it keeps its capacity
+  Packet scratch;
+};
+
+} // namespace VDP
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+#include "vdb/registry.hpp"
+#include "vdb/series.hpp"
+#include "vex.h"
+#include <atomic>
+
+namespace VDP {
+
+/// @brief Samples and sends channels at their own rates on a dedicated task.
+///
+/// Each channel added gets a period, a priority and a phase offset. When a
+/// channel's deadline comes up the scheduler calls fetch() on its data and
+/// sends it. Channels are run earliest deadline first, with higher priority
+/// winning ties. A channel that falls a whole period or more behind skips the
+/// samples it missed rather than sending a burst to catch up, and each one
+/// skipped counts as a missed deadline. Jitter is how late a sample was taken
+/// relative to its deadline.
+///
+/// Once started, the scheduler task is what calls send_data and poll on the
+/// registry, so other tasks shouldn't send through it too.
+class Scheduler {
+public:
+  struct ChannelStats {
+    uint32_t runs = 0;
+    /// Deadlines skipped because the channel was a period or more late
+    uint32_t missed = 0;
+    /// Runs where send_data failed, e.g. the channel wasn't acked yet
+    uint32_t send_failures = 0;
+    /// Microseconds between the deadline and the sample being taken
+    uint32_t last_jitter_us = 0;
+    uint32_t max_jitter_us = 0;
+    uint32_t mean_jitter_us = 0;
+  };
+
+  /// Longest the task sleeps without polling the registry, so batches and
+  /// negotiation retries still go out when every period is long
+  static constexpr uint32_t MAX_SLEEP_MS = 10;
+
+  explicit Scheduler(Registry &registry);
+  ~Scheduler();
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /// @brief Sample and send a channel every period_ms
+  /// @param priority higher goes first when deadlines tie
+  /// @param phase_ms offset of the first deadline from when it was added, to
+  /// keep channels with the same period from all landing at once
+  /// @return false if the period is 0 or the channel is already scheduled
+  bool add(ChannelID id, PartPtr data, uint32_t period_ms,
+           uint8_t priority = 0, uint32_t phase_ms = 0);
+  /// @brief Take a sample of a series every sample_period_ms and send them
+  /// once it is full, so the channel is sent every capacity() samples.
+  /// Deadlines and stats are per sample
+  bool add_series(ChannelID id, std::shared_ptr<Series> series,
+                  uint32_t sample_period_ms, uint8_t priority = 0,
+                  uint32_t phase_ms = 0);
+  bool remove(ChannelID id);
+
+  /// @brief Start the scheduler task
+  void start(int32_t priority = vex::thread::threadPriorityNormal);
+  /// @brief Stop the task, returns once it is no longer running
+  void stop();
+
+  bool stats(ChannelID id, ChannelStats &out);
+
+  /// @brief Run every channel whose deadline is at or before now_us. This is
+  /// what the task calls; it is public for driving the scheduler by hand
+  /// @return microseconds until the next deadline
+  uint64_t run_due(uint64_t now_us);
+
+private:
+  struct Job {
+    ChannelID id;
+    PartPtr data;
+    uint64_t period_us;
+    uint64_t deadline_us;
+    uint8_t priority;
+    ChannelStats stat;
+    // Set for add_series jobs, data is the same series
+    std::shared_ptr<Series> series;
+  };
+  bool add_job(ChannelID id, PartPtr data, std::shared_ptr<Series> series,
+               uint32_t period_ms, uint8_t priority, uint32_t phase_ms);
+  // Samples and sends a job that is due, without jobs_mutex held. data keeps
+  // the series alive
+  bool run_job(ChannelID id, const PartPtr &data, Series *series);
+  static int scheduler_thread(void *self);
+  // Earliest deadline, then highest priority
+  Job *next_job();
+
+  Registry &registry;
+  vex::mutex jobs_mutex;
+  std::vector<Job> jobs;
+
+  vex::task task;
+  std::atomic<bool> running{false};
+  std::atomic<bool> task_alive{false};
+};
+
+} // namespace VDP
@@ -0,0 +1,63 @@
+#pragma once
+#include "vdb/protocol.hpp"
+#include "vex.h"
+
+namespace VDP {
+
+class Registry;
+
+/// @brief Fingerprint of a channel's schema: the CRC32 of its encoding as it
+/// appears in a broadcast
+uint32_t schema_fingerprint(const uint8_t *schema, size_t len);
+
+/// @brief Schemas a listener has already received, by fingerprint.
+///
+/// When a controller reconnects it offers each channel's fingerprint first
+/// and only broadcasts the full schema if the listener doesn't have it here.
+/// The cache outlives the link and can be shared between registries, from
+/// any task. It holds at most capacity schemas, dropping the oldest first.
+class SchemaCache {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 64;
+
+  struct Stats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+  };
+
+  explicit SchemaCache(size_t capacity = DEFAULT_CAPACITY);
+
+  /// @brief Remember a schema received in a broadcast
+  /// @param schema the encoded schema, as fingerprinted
+  /// @param decoded the tree decoded from it
+  /// @param owner the registry the tree belongs to
+  void insert(uint32_t fingerprint, const uint8_t *schema, size_t len,
+              PartPtr decoded, ChannelID channel, const Registry *owner);
+  /// @brief Find a tree for a fingerprint, to use for a channel of owner.
+  ///
+  /// The cached tree is handed out again if the same registry's channel was
+  /// the last to use it. Anyone else gets a fresh tree decoded from the
+  /// stored bytes, so that two channels never share values even across
+  /// registries.
+  /// @return nullptr if the schema isn't known
+  PartPtr lookup(uint32_t fingerprint, ChannelID channel,
+                 const Registry *owner);
+
+  size_t size() const;
+  Stats stats() const;
+
+private:
+  struct Entry {
+    uint32_t fingerprint;
+    Packet schema;
+    PartPtr decoded;
+    ChannelID channel;
+    const Registry *owner;
+  };
+  size_t capacity;
+  mutable vex::mutex mut;
+  std::vector<Entry> entries;
+  Stats stat;
+};
+
+} // namespace VDP
@@ -0,0 +1,106 @@
+#pragma once
+#include "vdb/protocol.hpp"
+
+namespace VDP {
+
+/// @brief Sending side of a sequenced channel.
+///
+/// Sequenced data messages have PacketFlags::Sequenced set and a 16 bit
+/// sequence number right after the channel id, which lets the listener count
+/// what went missing. In reliable mode (PacketFlags::Reliable) the last
+/// WINDOW messages are kept so the ones the listener NACKs can be sent again.
+/// Channels without sequencing don't pay for any of this.
+class SequenceSender {
+public:
+  static constexpr size_t WINDOW = 16;
+
+  struct Stats {
+    uint32_t sent = 0;
+    /// Sequence numbers the listener asked for again
+    uint32_t nacked = 0;
+    uint32_t retransmits = 0;
+    /// NACKed messages that had already left the window
+    uint32_t expired = 0;
+  };
+
+  explicit SequenceSender(bool reliable);
+
+  bool reliable() const { return is_reliable; }
+  /// @brief Take the sequence number for the message being written
+  uint16_t next();
+  /// @brief Keep a copy of a finished message for retransmission. Only does
+  /// anything in reliable mode
+  void remember(uint16_t seq, const Packet &message);
+  /// @return the kept message with this sequence number, or nullptr
+  const Packet *find(uint16_t seq) const;
+
+  Stats &stats() { return stat; }
+  const Stats &stats() const { return stat; }
+
+private:
+  struct Slot {
+    uint16_t seq;
+    bool valid;
+    Packet message;
+  };
+  bool is_reliable;
+  uint16_t next_seq = 0;
+  Slot slots[WINDOW];
+  Stats stat;
+};
+
+/// @brief Receiving side of a sequenced channel. Spots gaps, duplicates and
+/// late arrivals, and for reliable channels decides which sequence numbers
+/// to NACK and when.
+class SequenceReceiver {
+public:
+  /// Most missing sequence numbers tracked for NACKing at once
+  static constexpr size_t MAX_MISSING = SequenceSender::WINDOW;
+  /// Time between NACKs of the same sequence number, and how many are sent
+  /// before giving up on it
+  static constexpr uint32_t NACK_INTERVAL_MS = 50;
+  static constexpr uint8_t MAX_NACKS = 3;
+
+  struct Stats {
+    uint32_t received = 0;
+    /// Sequence numbers skipped over when a later one arrived
+    uint32_t missing = 0;
+    /// Missing ones that showed up afterwards, usually as retransmits
+    uint32_t recovered = 0;
+    uint32_t duplicates = 0;
+    uint32_t nacks_sent = 0;
+  };
+
+  enum class Verdict {
+    Deliver,
+    // One that was missing, arriving after newer ones were delivered
+    Late,
+    // Seen already, or too old to mean anything
+    Drop,
+  };
+
+  SequenceReceiver();
+
+  /// @param gap set if messages before this one went missing
+  Verdict accept(uint16_t seq, bool reliable, bool &gap);
+  /// @brief Fill out with sequence numbers to NACK now
+  /// @return how many were written, at most max
+  size_t due_nacks(uint32_t now_ms, uint16_t *out, size_t max);
+
+  const Stats &stats() const { return stat; }
+
+private:
+  struct Missing {
+    uint16_t seq;
+    uint8_t nacks;
+    uint32_t last_nack_ms;
+  };
+  void add_missing(uint16_t seq);
+
+  bool have_any = false;
+  uint16_t expected = 0;
+  std::vector<Missing> missing;
+  Stats stat;
+};
+
+} // namespace VDP
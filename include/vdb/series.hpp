@@ -0,0 +1,83 @@
+#pragma once
+#include "vdb/protocol.hpp"
+
+namespace VDP {
+
+/// @brief Many samples of a part sent together, for data sampled faster
+/// than it is worth sending a packet for.
+///
+/// On the sending side each call to sample() (or fetch()) fetches the
+/// wrapped part and keeps its encoded data with the time it was taken. Up to
+/// max_samples are kept, and once full the oldest is overwritten. A message
+/// holds every sample kept since the last clear(), so a sender samples at
+/// the high rate and sends and clears every max_samples samples; Scheduler's
+/// add_series does exactly that. Samples wait at most max_samples sample
+/// periods to be sent.
+///
+/// A message is a sample count, the first sample's time as a uint32 of
+/// microseconds, a varint of the microseconds between each sample and the
+/// one before it, then the samples' data. At a steady 1kHz every timestamp
+/// after the first costs 2 bytes.
+///
+/// On the receiving side the series holds the last message's samples in
+/// order. Times are extended back to 64 bits as the 32 bit ones wrap. load()
+/// decodes one sample into sample(), which otherwise holds the latest one.
+class Series : public Part {
+  friend PacketReader;
+  friend PacketWriter;
+
+public:
+  Series(std::string name, PartPtr sample, uint8_t max_samples);
+  /// @brief Decode the schema, after the type and name. The sample's parts
+  /// are put in arena, see make_node
+  Series(std::string name, PacketReader &reader, SchemaArena *arena = nullptr);
+
+  /// @brief Same as sample(time now)
+  void fetch() override;
+  /// @brief Fetch the wrapped part and keep its data, taken at time_us
+  void sample(uint64_t time_us);
+  /// @brief Forget every sample kept, call after sending them
+  void clear();
+
+  /// @brief Samples kept to send, or in the last message received
+  size_t size() const { return count; }
+  size_t capacity() const { return slots.size(); }
+  /// @brief Samples lost because the series was full
+  uint32_t overwritten() const { return num_overwritten; }
+
+  /// @brief Time of the i-th sample, oldest first. Microseconds
+  uint64_t time_us(size_t i) const;
+  /// @brief Decode the i-th sample, oldest first, into sample()
+  /// @return false if there's no such sample
+  bool load(size_t i);
+  const PartPtr &sample() const { return part; }
+
+  void read_data_from_message(PacketReader &reader) override;
+  void use_compact_integers(bool compact) override;
+
+  void pprint(std::stringstream &ss, size_t indent) const override;
+  void pprint_data(std::stringstream &ss, size_t indent) const override;
+
+protected:
+  void write_schema(PacketWriter &sofar) const override;
+  void write_message(PacketWriter &sofar) const override;
+
+private:
+  struct Slot {
+    uint64_t time_us;
+    // The sample's data as the part writes it. Keeps its capacity
+    Packet data;
+  };
+  const Slot &at(size_t i) const { return slots[(first + i) % slots.size()]; }
+
+  PartPtr part;
+  std::vector<Slot> slots;
+  size_t first = 0;
+  size_t count = 0;
+  uint32_t num_overwritten = 0;
+  // Receiving side: the high bits of the times, bumped when they wrap
+  uint64_t epoch = 0;
+  uint32_t last_base = 0;
+};
+
+} // namespace VDP
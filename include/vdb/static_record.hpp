@@ -0,0 +1,298 @@
+#pragma once
+#include "vdb/layout.hpp"
+#include "vdb/types.hpp"
+
+#include <cstddef>
+
+namespace VDP {
+
+/// @brief A Record whose fields are the members of a plain C++ struct,
+/// described entirely at compile time.
+///
+///   struct DriveSample {
+///     float left;
+///     float right;
+///     uint32_t time_ms;
+///   };
+///   using DriveRecord =
+///       VDP::StaticRecord<DriveSample, VDP_STATIC_NAME("drive"),
+///                         VDP_STATIC_FIELD(DriveSample, left),
+///                         VDP_STATIC_FIELD(DriveSample, right),
+///                         VDP_STATIC_FIELD(DriveSample, time_ms)>;
+///
+///   auto drive = std::make_shared<DriveRecord>();
+///   ChannelID id = registry.open_channel(drive);
+///   drive->set(sample);
+///   registry.send_data(id, drive);
+///
+/// The schema bytes are built by the compiler and are exactly what the same
+/// Record of Number fields would send, so the listener decodes it like any
+/// other record and needs nothing new. set() and get() copy each member at an
+/// offset known at compile time, a single memcpy when the struct has no
+/// padding, and the whole struct is one fixed field of the channel's
+/// LayoutPlan. There are no Parts per field, no std::function and no
+/// allocation after construction.
+///
+/// Members can be any of the types Number is instantiated with. Only whole
+/// messages are sent: the struct is a single leaf to a DeltaEncoder, which
+/// doesn't match the listener's record, so enable_delta refuses its channel
+template <typename Struct, typename Name, typename... Fields>
+class StaticRecord;
+
+namespace static_detail {
+
+/// Bytes known at compile time, as a type so they can be joined together
+template <uint8_t... Bs> struct Bytes {
+  static constexpr size_t size = sizeof...(Bs);
+  // One past the end so an empty list is still an array
+  static const uint8_t data[sizeof...(Bs) + 1];
+};
+template <uint8_t... Bs>
+const uint8_t Bytes<Bs...>::data[sizeof...(Bs) + 1] = {Bs..., 0};
+
+template <typename... Parts> struct Concat;
+template <> struct Concat<> {
+  using type = Bytes<>;
+};
+template <uint8_t... A> struct Concat<Bytes<A...>> {
+  using type = Bytes<A...>;
+};
+template <uint8_t... A, uint8_t... B, typename... Rest>
+struct Concat<Bytes<A...>, Bytes<B...>, Rest...> {
+  using type = typename Concat<Bytes<A..., B...>, Rest...>::type;
+};
+
+/// Longest name VDP_STATIC_NAME takes, not counting the terminator
+constexpr size_t MAX_NAME = 31;
+
+template <size_t N>
+constexpr char char_at(const char (&str)[N], size_t i) {
+  return i < N ? str[i] : '\0';
+}
+
+// The first N characters and a terminator
+template <size_t N, typename Sofar, char... Cs> struct Take;
+template <size_t N, uint8_t... A, char C, char... Cs>
+struct Take<N, Bytes<A...>, C, Cs...> {
+  using type = typename Take<N - 1, Bytes<A..., (uint8_t)C>, Cs...>::type;
+};
+template <uint8_t... A, char C, char... Cs>
+struct Take<0, Bytes<A...>, C, Cs...> {
+  using type = Bytes<A..., 0>;
+};
+
+template <size_t Length, char... Cs> struct Name {
+  static_assert(Length <= MAX_NAME, "Static record names are at most 31 "
+                                    "characters");
+  using type =
+      typename Take<(Length <= MAX_NAME ? Length : 0), Bytes<>, Cs...>::type;
+};
+
+template <uint32_t N> struct Uint32Bytes {
+  using type = Bytes<(uint8_t)N, (uint8_t)(N >> 8), (uint8_t)(N >> 16),
+                     (uint8_t)(N >> 24)>;
+};
+
+/// The schema type of each member type a static record can hold
+template <typename T> struct MemberType;
+#define VDP_STATIC_MEMBER_TYPE(T, PartT)                                       \
+  template <> struct MemberType<T> {                                          \
+    static constexpr Type value = PartT::SchemaType;                          \
+  }
+VDP_STATIC_MEMBER_TYPE(float, Float);
+VDP_STATIC_MEMBER_TYPE(double, Double);
+VDP_STATIC_MEMBER_TYPE(uint8_t, Uint8);
+VDP_STATIC_MEMBER_TYPE(uint16_t, Uint16);
+VDP_STATIC_MEMBER_TYPE(uint32_t, Uint32);
+VDP_STATIC_MEMBER_TYPE(uint64_t, Uint64);
+VDP_STATIC_MEMBER_TYPE(int8_t, Int8);
+VDP_STATIC_MEMBER_TYPE(int16_t, Int16);
+VDP_STATIC_MEMBER_TYPE(int32_t, Int32);
+VDP_STATIC_MEMBER_TYPE(int64_t, Int64);
+#undef VDP_STATIC_MEMBER_TYPE
+
+// Copies between the struct and its wire form, field by field. At is where
+// the first of Fields starts on the wire. Everything is known at compile time
+// so the compiler is left with a run of fixed size memcpys
+template <size_t At, typename... Fields> struct Copier;
+template <size_t At> struct Copier<At> {
+  static constexpr size_t wire_size = At;
+  // Whether the struct holds its fields back to back in wire order
+  static constexpr bool contiguous = true;
+  static void encode(const uint8_t *, uint8_t *) {}
+  static void decode(const uint8_t *, uint8_t *) {}
+  template <typename Struct>
+  static void pprint_data(const Struct &, std::stringstream &, size_t) {}
+};
+template <size_t At, typename Field, typename... Rest>
+struct Copier<At, Field, Rest...> {
+  using Next = Copier<At + Field::size, Rest...>;
+  static constexpr size_t wire_size = Next::wire_size;
+  static constexpr bool contiguous = Field::offset == At && Next::contiguous;
+
+  static void encode(const uint8_t *in, uint8_t *out) {
+    std::memcpy(out + At, in + Field::offset, Field::size);
+    Next::encode(in, out);
+  }
+  static void decode(const uint8_t *in, uint8_t *out) {
+    std::memcpy(out + Field::offset, in + At, Field::size);
+    Next::decode(in, out);
+  }
+  template <typename Struct>
+  static void pprint_data(const Struct &value, std::stringstream &ss,
+                          size_t indent) {
+    typename Field::ValueType member;
+    std::memcpy(&member, (const uint8_t *)&value + Field::offset, Field::size);
+    add_indents(ss, indent);
+    ss << (const char *)Field::NameBytes::data << ":\t";
+    if (sizeof(member) == 1) {
+      ss << (int)member; // Not a char
+    } else {
+      ss << member;
+    }
+    ss << '\n';
+    Next::pprint_data(value, ss, indent);
+  }
+};
+
+} // namespace static_detail
+
+/// @brief One member of a static record. Made by VDP_STATIC_FIELD
+template <typename T, size_t Offset, typename Name> struct StaticField {
+  using ValueType = T;
+  using NameBytes = Name;
+  static constexpr size_t offset = Offset;
+  static constexpr size_t size = sizeof(T);
+  static constexpr Type type = static_detail::MemberType<T>::value;
+  using Schema = typename static_detail::Concat<
+      static_detail::Bytes<(uint8_t)type>, Name>::type;
+};
+
+template <typename Struct, typename Name, typename... Fields>
+class StaticRecord : public Part {
+  friend PacketReader;
+  friend PacketWriter;
+  using Copier = static_detail::Copier<0, Fields...>;
+
+public:
+  static_assert(sizeof...(Fields) > 0, "A static record needs a field");
+  static_assert(std::is_standard_layout<Struct>::value,
+                "Fields are found by offsetof, which needs a standard layout "
+                "struct");
+
+  /// Bytes of a message
+  static constexpr size_t wire_size = Copier::wire_size;
+  /// The schema as write_schema sends it
+  using Schema = typename static_detail::Concat<
+      static_detail::Bytes<(uint8_t)Type::Record>, Name,
+      typename static_detail::Uint32Bytes<sizeof...(Fields)>::type,
+      typename Fields::Schema...>::type;
+
+  /// @brief Fill in the struct when fetched. A plain function, it may only
+  /// change the members it cares about
+  using FetchFunc = void (*)(Struct &value);
+
+  explicit StaticRecord(FetchFunc fetcher = nullptr)
+      : Part((const char *)Name::data), fetcher(fetcher) {}
+  // The slot points into this object
+  StaticRecord(const StaticRecord &) = delete;
+  StaticRecord &operator=(const StaticRecord &) = delete;
+
+  void fetch() override {
+    if (fetcher != nullptr) {
+      Struct value = get();
+      fetcher(value);
+      set(value);
+    }
+  }
+  void set(const Struct &value) {
+    if (Copier::contiguous && wire_size == sizeof(Struct)) {
+      std::memcpy(slot.data, &value, wire_size);
+    } else {
+      Copier::encode((const uint8_t *)&value, slot.data);
+    }
+  }
+  Struct get() const {
+    Struct value{};
+    if (Copier::contiguous && wire_size == sizeof(Struct)) {
+      std::memcpy(&value, slot.data, wire_size);
+    } else {
+      Copier::decode(slot.data, (uint8_t *)&value);
+    }
+    return value;
+  }
+
+  void read_data_from_message(PacketReader &reader) override {
+    reader.get_bytes(slot.data, wire_size);
+  }
+  // One leaf here is a leaf per field on the listener
+  bool supports_delta() const override { return false; }
+
+  void pprint(std::stringstream &ss, size_t indent) const override {
+    add_indents(ss, indent);
+    ss << name << ": record[" << sizeof...(Fields) << "]{\n";
+    // Skip the record's own type, name and field count
+    const uint8_t *field = Schema::data + 1 + name.size() + 1 + 4;
+    for (size_t i = 0; i < sizeof...(Fields); i++) {
+      const char *field_name = (const char *)field + 1;
+      add_indents(ss, indent + 1);
+      ss << field_name << ":\t" << to_string((Type)field[0]) << '\n';
+      field += 1 + std::strlen(field_name) + 1;
+    }
+    add_indents(ss, indent);
+    ss << "}\n";
+  }
+  void pprint_data(std::stringstream &ss, size_t indent) const override {
+    add_indents(ss, indent);
+    ss << name << ": record[" << sizeof...(Fields) << "]{\n";
+    Copier::pprint_data(get(), ss, indent + 1);
+    add_indents(ss, indent);
+    ss << "}\n";
+  }
+
+protected:
+  void write_schema(PacketWriter &sofar) const override {
+    sofar.write_bytes(Schema::data, Schema::size);
+  }
+  void write_message(PacketWriter &sofar) const override {
+    sofar.write_bytes(slot.data, wire_size);
+  }
+  void plan_layout(LayoutPlan &plan) override {
+    plan.add_fixed(slot, wire_size);
+  }
+
+private:
+  FetchFunc fetcher;
+  // The struct in wire form, unless a LayoutPlan has moved it into its block
+  uint8_t wire[wire_size] = {};
+  FieldSlot slot{wire, wire, nullptr};
+};
+
+} // namespace VDP
+
+// Expands a string literal into its characters, padded with '\0' to
+// MAX_NAME + 1 of them, for VDP_STATIC_NAME
+#define VDP_STATIC_CHARS4(str, i)                                              \
+  ::VDP::static_detail::char_at(str, (i)),                                     \
+      ::VDP::static_detail::char_at(str, (i) + 1),                             \
+      ::VDP::static_detail::char_at(str, (i) + 2),                             \
+      ::VDP::static_detail::char_at(str, (i) + 3)
+#define VDP_STATIC_CHARS16(str, i)                                             \
+  VDP_STATIC_CHARS4(str, (i)), VDP_STATIC_CHARS4(str, (i) + 4),                \
+      VDP_STATIC_CHARS4(str, (i) + 8), VDP_STATIC_CHARS4(str, (i) + 12)
+
+/// @brief A name for a StaticRecord or StaticField, from a string literal of
+/// at most 31 characters
+#define VDP_STATIC_NAME(str)                                                   \
+  ::VDP::static_detail::Name<sizeof(str) - 1, VDP_STATIC_CHARS16(str, 0),      \
+                             VDP_STATIC_CHARS16(str, 16)>::type
+
+/// @brief A member of a struct as a field of a StaticRecord, named after the
+/// member
+#define VDP_STATIC_FIELD(Struct, member)                                       \
+  VDP_STATIC_FIELD_NAMED(Struct, member, #member)
+/// @brief A member of a struct as a field of a StaticRecord, with the name
+/// the listener will see
+#define VDP_STATIC_FIELD_NAMED(Struct, member, str)                            \
+  ::VDP::StaticField<decltype(Struct::member), offsetof(Struct, member),       \
+                     VDP_STATIC_NAME(str)>
@@ -1,4 +1,5 @@
 #pragma once
+#include "vdb/layout.hpp"
 #include "vdb/protocol.hpp"
 
 namespace VDP {
@@ -11,11 +12,20 @@ public:
   explicit Record(std::string name);
   Record(std::string name, const std::vector<Part *> &fields);
   Record(std::string name, std::vector<PartPtr> fields);
-  Record(std::string name, PacketReader &reader);
+  /// @brief Decode a record's schema. compact is whether its type byte had
+  /// TYPE_COMPACT_BIT set. Fields are put in arena, see make_node
+  Record(std::string name, PacketReader &reader, bool compact = false,
+         SchemaArena *arena = nullptr);
+  /// @brief Replace the fields. Channels already sending this record plan
+  /// it again on their next send, but the listener keeps the schema it was
+  /// sent, so the new fields have to match the old ones' types
   void setFields(std::vector<PartPtr> fields);
 
   void fetch() override;
   void read_data_from_message(PacketReader &reader) override;
+  void collect_leaves(std::vector<Part *> &out) override;
+  void use_compact_integers(bool compact) override;
+  bool supports_delta() const override;
 
 protected:
   // Encode the schema itself for transmission on the wire
@@ -23,12 +33,15 @@ protected:
   // Encode the data currently held according to schema for transmission on the
   // wire
   void write_message(PacketWriter &sofar) const override;
+  void plan_layout(LayoutPlan &plan) override;
 
 private:
   void pprint(std::stringstream &ss, size_t indent) const override;
   void pprint_data(std::stringstream &ss, size_t indent) const override;
 
   std::vector<PartPtr> fields;
+  // Field count in the schema is a varint
+  bool compact = false;
 };
 
 class String : public Part {
@@ -50,6 +63,7 @@ public:
 protected:
   void write_schema(PacketWriter &sofar) const override;
   void write_message(PacketWriter &sofar) const override;
+  void plan_layout(LayoutPlan &plan) override;
 
 private:
   FetchFunc fetcher;
@@ -77,40 +91,86 @@ public:
       std::string field_name,
       FetchFunc fetcher = []() { return (NumberType)0; })
       : Part(field_name), fetcher(fetcher) {}
+  // The slot points into this object
+  Number(const Number &) = delete;
+  Number &operator=(const Number &) = delete;
 
-  void fetch() override { value = fetcher(); }
-  void setValue(NumberType val) { this->value = val; }
+  void fetch() override { setValue(fetcher()); }
+  void setValue(NumberType val) {
+    std::memcpy(slot.data, &val, sizeof(NumberType));
+  }
+  NumberType getValue() const {
+    NumberType val;
+    std::memcpy(&val, slot.data, sizeof(NumberType));
+    return val;
+  }
 
   void pprint(std::stringstream &ss, size_t indent) const override {
     add_indents(ss, indent);
     ss << name << ":\t" << to_string(SchemaType);
+    if (compact) {
+      ss << " (varint)";
+    }
   }
   void pprint_data(std::stringstream &ss, size_t indent) const override {
     add_indents(ss, indent);
     ss << name << ":\t";
     if (sizeof(NumberType) == 1) {
-      ss << (int)value; // Otherwise, stringstream interprets uint8 as char and
-                        // prints a char
+      ss << (int)getValue(); // Otherwise, stringstream interprets uint8 as
+                             // char and prints a char
     } else {
-      ss << value;
+      ss << getValue();
     }
   }
   void read_data_from_message(PacketReader &reader) override {
-    value = reader.get_number<NumberType>();
+    if (compact) {
+      read_compact(reader, std::is_integral<NumberType>());
+    } else {
+      setValue(reader.get_number<NumberType>());
+    }
+  }
+  void use_compact_integers(bool on) override {
+    compact = on && std::is_integral<NumberType>::value;
   }
 
 protected:
   void write_schema(PacketWriter &sofar) const override {
-    sofar.write_type(SchemaType); // Type
-    sofar.write_string(name);     // Name
+    sofar.write_type(SchemaType, compact); // Type
+    sofar.write_string(name);              // Name
   }
   void write_message(PacketWriter &sofar) const override {
-    sofar.write_number<NumberType>(value);
+    if (compact) {
+      write_compact(sofar, std::is_integral<NumberType>());
+    } else {
+      sofar.write_bytes(slot.data, sizeof(NumberType));
+    }
+  }
+  void plan_layout(LayoutPlan &plan) override {
+    if (compact) {
+      // Size depends on the value, so it can't be part of the block
+      plan.add_part(*this);
+    } else {
+      plan.add_fixed(slot, sizeof(NumberType));
+    }
   }
 
 private:
+  // Only integers are ever compact, the floating point overloads are never
+  // called
+  void write_compact(PacketWriter &sofar, std::true_type) const {
+    sofar.write_compact(getValue());
+  }
+  void write_compact(PacketWriter &, std::false_type) const {}
+  void read_compact(PacketReader &reader, std::true_type) {
+    setValue(reader.get_compact<NumberType>());
+  }
+  void read_compact(PacketReader &, std::false_type) {}
+
   FetchFunc fetcher;
+  bool compact = false;
+  // Where the value lives unless a LayoutPlan has moved it into its block
   NumberType value = (NumberType)0;
+  FieldSlot slot{(uint8_t *)&value, (uint8_t *)&value, nullptr};
 };
 
 using Float = Number<float, Type::Float>;
@@ -126,4 +186,83 @@ using Int16 = Number<int16_t, Type::Int16>;
 using Int32 = Number<int32_t, Type::Int32>;
 using Int64 = Number<int64_t, Type::Int64>;
 
+/// @brief A float sent as an IEEE 754 half: 2 bytes, about 3 significant
+/// digits, and up to 65504. The value is rounded when it is set, so
+/// getValue returns what the listener will see
+class Half : public Part {
+  friend PacketReader;
+  friend PacketWriter;
+
+public:
+  using FetchFunc = std::function<float()>;
+  explicit Half(
+      std::string name, FetchFunc fetcher = []() { return 0.0f; });
+  // The slot points into this object
+  Half(const Half &) = delete;
+  Half &operator=(const Half &) = delete;
+
+  void fetch() override;
+  void setValue(float value);
+  float getValue() const;
+
+  void read_data_from_message(PacketReader &reader) override;
+
+  void pprint(std::stringstream &ss, size_t indent) const override;
+  void pprint_data(std::stringstream &ss, size_t indent) const override;
+
+protected:
+  void write_schema(PacketWriter &sofar) const override;
+  void write_message(PacketWriter &sofar) const override;
+  void plan_layout(LayoutPlan &plan) override;
+
+private:
+  FetchFunc fetcher;
+  uint16_t bits = 0;
+  FieldSlot slot{(uint8_t *)&bits, (uint8_t *)&bits, nullptr};
+};
+
+/// @brief A float sent as round((value - offset) / scale) in an int16, for
+/// readings with a known range and resolution. A scale of 0.001 with no
+/// offset covers +-32.767 in steps of 0.001. Values outside the range are
+/// clamped to its ends. Like Half the value is quantized when it is set
+class Fixed16 : public Part {
+  friend PacketReader;
+  friend PacketWriter;
+
+public:
+  using FetchFunc = std::function<float()>;
+  Fixed16(
+      std::string name, float scale, float offset = 0.0f,
+      FetchFunc fetcher = []() { return 0.0f; });
+  /// @brief Decode the schema, the scale and offset follow the name
+  Fixed16(std::string name, PacketReader &reader);
+  // The slot points into this object
+  Fixed16(const Fixed16 &) = delete;
+  Fixed16 &operator=(const Fixed16 &) = delete;
+
+  void fetch() override;
+  void setValue(float value);
+  float getValue() const;
+  float getScale() const { return scale; }
+  float getOffset() const { return offset; }
+
+  void read_data_from_message(PacketReader &reader) override;
+
+  void pprint(std::stringstream &ss, size_t indent) const override;
+  void pprint_data(std::stringstream &ss, size_t indent) const override;
+
+protected:
+  void write_schema(PacketWriter &sofar) const override;
+  void write_message(PacketWriter &sofar) const override;
+  void plan_layout(LayoutPlan &plan) override;
+
+private:
+  FetchFunc fetcher;
+  float scale;
+  float inv_scale;
+  float offset;
+  int16_t raw = 0;
+  FieldSlot slot{(uint8_t *)&raw, (uint8_t *)&raw, nullptr};
+};
+
 } // namespace VDP
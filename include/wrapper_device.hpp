@@ -6,7 +6,10 @@
 namespace VDB {
 class Device : public VDP::AbstractDevice, COBSSerialDevice {
 public:
+  /// @brief Starts being serviced once constructed, callbacks come from the
+  /// SerialReactor task
   explicit Device(int32_t port, int32_t baud_rate);
+  ~Device() override;
   bool
   send_packet(const VDP::Packet &packet) override; // From VDP::AbstractDevice
 
@@ -16,7 +19,18 @@ public:
 
   void cobs_packet_callback(const Packet &pac) override;
 
+  using COBSSerialDevice::link_bytes_per_second;
+  using COBSSerialDevice::Priority;
+  using COBSSerialDevice::transmit_stats;
+  using COBSSerialDevice::TransmitStats;
+
+  /// @brief Which queue a packet goes out on: acks before schemas before
+  /// data
+  static Priority priority_of(const VDP::Packet &packet);
+
 private:
+  // Set from the user's task, called from the reactor's
+  vex::mutex callback_mutex;
   std::function<void(const VDP::Packet &packet)> callback;
 };
 
@@ -0,0 +1,33 @@
+#include "alloc_counter.hpp"
+
+#ifdef VDB_COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> allocation_count{0};
+
+static void *counted_alloc(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    std::abort();
+  }
+  return p;
+}
+
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+bool AllocCounter::enabled() { return true; }
+uint64_t AllocCounter::count() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+#else
+bool AllocCounter::enabled() { return false; }
+uint64_t AllocCounter::count() { return 0; }
+#endif
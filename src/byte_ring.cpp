@@ -0,0 +1,124 @@
+#include "byte_ring.hpp"
+
+#include <cstring>
+
+using ByteRing::HEADER_SIZE;
+using ByteRing::Record;
+using ByteRing::Reservation;
+
+namespace {
+// Records start on 8 byte boundaries so a header always fits in the space
+// left before the end of the buffer
+constexpr uint32_t RECORD_ALIGN = 8;
+
+uint32_t record_size(uint32_t len) {
+  return (HEADER_SIZE + len + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+// The indices wrap with a mask, so the buffer has to be a power of two. At
+// least one record alignment so a header always fits
+uint32_t round_capacity(uint32_t v) {
+  uint32_t cap = RECORD_ALIGN;
+  while (cap < v && cap < (1UL << 31)) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+// Header: word 0 holds flags and the record size, word 1 the length
+constexpr uint32_t READY_BIT = 1UL << 31;
+constexpr uint32_t PAD_BIT = 1UL << 30;
+constexpr uint32_t SIZE_MASK = PAD_BIT - 1;
+} // namespace
+
+MPSCByteRing::MPSCByteRing(uint32_t capacity)
+    : cap(round_capacity(capacity)),
+      storage(new uint32_t[cap / sizeof(uint32_t)]()),
+      buf((uint8_t *)storage.get()) {}
+
+std::atomic<uint32_t> &MPSCByteRing::header_at(uint32_t position) {
+  return *reinterpret_cast<std::atomic<uint32_t> *>(buf +
+                                                    (position & (cap - 1)));
+}
+
+Reservation MPSCByteRing::reserve(uint32_t max_len) {
+  Reservation res;
+  const uint32_t need = record_size(max_len);
+  if (need > cap) {
+    return res;
+  }
+  uint32_t h = reserve_head.load(std::memory_order_relaxed);
+  uint32_t pad = 0;
+  while (true) {
+    const uint32_t t = tail.load(std::memory_order_acquire);
+    const uint32_t contiguous = cap - (h & (cap - 1));
+    pad = contiguous < need ? contiguous : 0;
+    if ((h - t) + pad + need > cap) {
+      return res;
+    }
+    if (reserve_head.compare_exchange_weak(h, h + pad + need,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  if (pad > 0) {
+    header_at(h).store(READY_BIT | PAD_BIT | pad, std::memory_order_release);
+  }
+  res.position = h + pad;
+  res.size = need;
+  res.max_len = max_len;
+  res.data = buf + (res.position & (cap - 1)) + HEADER_SIZE;
+  return res;
+}
+
+void MPSCByteRing::commit(const Reservation &res, uint32_t len) {
+  if (len > res.max_len) {
+    len = res.max_len;
+  }
+  std::memcpy(buf + (res.position & (cap - 1)) + sizeof(uint32_t), &len,
+              sizeof(len));
+  header_at(res.position).store(READY_BIT | res.size,
+                                std::memory_order_release);
+}
+
+Record MPSCByteRing::peek() {
+  Record rec;
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  while (true) {
+    std::atomic<uint32_t> &header = header_at(t);
+    const uint32_t state = header.load(std::memory_order_acquire);
+    if ((state & READY_BIT) == 0) {
+      // Empty, or the oldest reservation hasn't been committed yet
+      break;
+    }
+    if (state & PAD_BIT) {
+      header.store(0, std::memory_order_relaxed);
+      t += state & SIZE_MASK;
+      tail.store(t, std::memory_order_release);
+      continue;
+    }
+    const uint32_t pos = t & (cap - 1);
+    uint32_t len = 0;
+    std::memcpy(&len, buf + pos + sizeof(uint32_t), sizeof(len));
+    rec.data = buf + pos + HEADER_SIZE;
+    rec.len = len;
+    rec.size = state & SIZE_MASK;
+    break;
+  }
+  return rec;
+}
+
+void MPSCByteRing::release(const Record &rec) {
+  const uint32_t t = tail.load(std::memory_order_relaxed);
+  // peek() treats a non zero header as a committed record, so anything the
+  // next lap might read as a header has to go back to zero
+  std::memset(buf + (t & (cap - 1)) + sizeof(uint32_t), 0,
+              rec.size - sizeof(uint32_t));
+  header_at(t).store(0, std::memory_order_relaxed);
+  tail.store(t + rec.size, std::memory_order_release);
+}
+
+uint32_t MPSCByteRing::used() const {
+  return reserve_head.load(std::memory_order_acquire) -
+         tail.load(std::memory_order_acquire);
+}
@@ -1,161 +1,250 @@
 #include "cobs_device.hpp"
+#include "metrics.hpp"
 
-COBSSerialDevice::COBSSerialDevice(int32_t port, int32_t baud_rate)
-    : port(port), baud_rate(baud_rate), outbound_packets() {
-
-  serial_task = vex::task(COBSSerialDevice::serial_thread, (void *)this,
-                          vex::thread::threadPriorityHigh);
-  decode_task = vex::task(COBSSerialDevice::decode_thread, (void *)this,
-                          vex::thread::threadPriorityHigh);
+COBSStreamDecoder::COBSStreamDecoder(size_t max_packet_size)
+    : max_size(max_packet_size) {
+  decoded.reserve(max_packet_size);
 }
 
-void COBSSerialDevice::handle_inbound_byte(uint8_t b) {
+void COBSStreamDecoder::reset() {
+  decoded.clear();
+  code = 0xff;
+  left_in_block = 0;
+  started = false;
+  dropping = false;
+  complete = false;
+}
 
-  if (b == 0x00 && inbound_buffer.size() > 0) {
-    if (inbound_packets.size() < MAX_IN_QUEUE_SIZE) {
-      inbound_packets.push_front(inbound_buffer);
-    } else {
-      printf("COBSSerialDevice Port%d: Dropping inbound packet. inbound queue "
-             "full\n",
-             (int)(port + 1));
-    }
-    // Starting a new packet now
-    inbound_buffer.clear();
-  } else if (b != 0x00) {
-    inbound_buffer.push_back(b);
+bool COBSStreamDecoder::finish_frame() {
+  if (!started) {
+    // Back to back delimeters, nothing to deliver
+    return false;
+  }
+  if (dropping || left_in_block != 0) {
+    // Too long, or the delimeter arrived in the middle of a block
+    dropped++;
+    reset();
+    return false;
   }
+  complete = true;
+  return true;
 }
 
-int COBSSerialDevice::decode_thread(void *vself) {
+COBSSerialDevice::COBSSerialDevice(int32_t port, int32_t baud_rate)
+    : port(port), baud_rate(baud_rate) {}
 
-  COBSSerialDevice &self = *(COBSSerialDevice *)vself;
-  Packet decoded = {};
+COBSSerialDevice::~COBSSerialDevice() {
+  // Too late for the derived class, which should have stopped already. This
+  // only keeps the reactor from holding on to a dangling pointer
+  stop_servicing();
+}
 
-  while (true) {
+void COBSSerialDevice::start_servicing() {
+  SerialReactor::instance().add(this);
+}
 
-    WirePacket inbound = {};
-    {
-      self.inbound_mutex.lock();
+void COBSSerialDevice::stop_servicing() {
+  SerialReactor::instance().remove(this);
+}
 
-      if (self.inbound_packets.size() > 0) {
-        inbound = self.inbound_packets.back();
-        self.inbound_packets.pop_back();
+bool COBSSerialDevice::read_packets_if_avail() {
+  const int avail = vexGenericSerialReceiveAvail(port);
+  if (avail <= 0) {
+    return false;
+  }
+  Metrics &metrics = Metrics::instance();
+  metrics.record_queue_depth(Metrics::Queue::Inbound, (uint32_t)avail);
+  const uint32_t dropped_before = decoder.num_dropped();
+
+  const int read =
+      vexGenericSerialReceive(port, receive_buffer, (int32_t)RECEIVE_CHUNK);
+  // Decode time of a frame is counted from the start of the read or the end
+  // of the previous frame's callback, so the callbacks aren't included. Only
+  // sampled frames read the clock, like Metrics::Timer
+  const Metrics::Timing stage = Metrics::Timing::COBSDecode;
+  bool timing = metrics.should_sample(stage);
+  uint64_t decode_start = timing ? vexSystemHighResTimeGet() : 0;
+  for (int i = 0; i < read; i++) {
+    if (decoder.feed(receive_buffer[i])) {
+      if (timing) {
+        metrics.record_time(
+            stage, (uint32_t)(vexSystemHighResTimeGet() - decode_start));
       }
-      self.inbound_mutex.unlock();
-    }
-    // Theres no packet to decode
-    if (inbound.size() == 0) {
-      vexDelay(NO_ACTIVITY_DELAY);
-      continue;
+      cobs_packet_callback(decoder.frame());
+      timing = metrics.should_sample(stage);
+      decode_start = timing ? vexSystemHighResTimeGet() : 0;
     }
-
-    cobs_decode(inbound, decoded);
-
-    self.cobs_packet_callback(decoded);
   }
-  return 0;
+  if (decoder.num_dropped() != dropped_before) {
+    metrics.count_drop(Metrics::Drop::Framing,
+                       decoder.num_dropped() - dropped_before);
+  }
+  return true;
 }
 
-bool COBSSerialDevice::write_packet_if_avail() {
-  bool did_write = false;
-  WirePacket outbound_packet = {};
+uint32_t COBSSerialDevice::link_bytes_per_second() const {
+  // 8 data bits plus a start and stop bit
+  return (uint32_t)baud_rate / 10;
+}
 
-  outbound_mutex.lock();
-  if (outbound_packets.size() > 0) {
-    outbound_packet = outbound_packets.back();
-    outbound_packets.pop_back();
-  }
-  outbound_mutex.unlock();
-  if (outbound_packet.size() == 0) {
-    return did_write;
+void COBSSerialDevice::refill_tokens(uint64_t now_us) {
+  const uint32_t rate = link_bytes_per_second();
+  const uint64_t earned = (now_us - last_refill_us) * rate / 1000000;
+  if (tokens + earned >= TOKEN_BUCKET_BYTES) {
+    tokens = TOKEN_BUCKET_BYTES;
+    last_refill_us = now_us;
+    return;
   }
-  const int avail = vexGenericSerialWriteFree(port);
-  if (avail < (int)outbound_packet.size()) {
-    // avail can be -1 for unknown reasons.
-    // Signed comparison handles this correctly (as
-    // correctly as I can think to).
-    vexGenericSerialFlush(port);
+  tokens += (uint32_t)earned;
+  // Only move forward by the time the tokens were earned in so fractions of
+  // a byte carry over to the next refill. Rounded up, or the fractions of a
+  // microsecond left behind add up to bytes the link never had time for
+  last_refill_us += rate == 0 ? 0 : (earned * 1000000 + rate - 1) / rate;
+}
+
+bool COBSSerialDevice::anything_queued() const {
+  if (sending.valid()) {
+    return true;
   }
-  const int32_t wrote = vexGenericSerialTransmit(
-      port, outbound_packet.data(), (int32_t)outbound_packet.size());
-  if (wrote < (int32_t)outbound_packet.size()) {
-    printf("Unhandled state: Didn't write all that we wanted to, will "
-           "probably get packet corruption\n");
+  for (const MPSCByteRing *queue : queues) {
+    if (queue->used() > 0) {
+      return true;
+    }
   }
-  did_write = true;
-
-  return did_write;
+  return false;
 }
 
-int COBSSerialDevice::serial_thread(void *vself) {
-  COBSSerialDevice &self = *(COBSSerialDevice *)vself;
-
-  vexGenericSerialEnable(self.port, 0x0);
-  vexGenericSerialBaudrate(self.port, self.baud_rate);
-
-  static constexpr size_t buflen = 4096;
-  static uint8_t buf[buflen] = {0};
-
-  while (1) {
-    bool did_something = false;
-    // Lame replacement for blocking IO. We can't just wait and tell the
-    // scheduler to go work on something else while we wait for packets so
-    // instead, if we're getting nothing in and have nothing to send, block
-    // ourselves.
-
-    // Writing
-    if (self.write_packet_if_avail()) {
-      did_something = true;
-    }
+bool COBSSerialDevice::write_packet_if_avail() {
+  const uint64_t now = clock();
+  refill_tokens(now);
+
+  if (now - window_start_us >= UTILIZATION_WINDOW_US) {
+    const uint64_t capacity =
+        (uint64_t)link_bytes_per_second() * (now - window_start_us) / 1000000;
+    utilization_permille =
+        capacity == 0 ? 0 : (uint32_t)(window_bytes * 1000 / capacity);
+    window_start_us = now;
+    window_bytes = 0;
+  }
 
-    // Reading
-    const int avail = vexGenericSerialReceiveAvail(self.port);
-    if (avail > 0) {
-      const int read = vexGenericSerialReceive(self.port, buf, buflen);
-      if (read > 0 && read < (int)buflen) {
-
-        self.inbound_mutex.lock();
-        for (int i = 0; i < read; i++) {
-          self.handle_inbound_byte(buf[i]);
-        }
-        self.inbound_mutex.unlock();
+  bool wrote_any = false;
+  while (true) {
+    if (!sending.valid()) {
+      // Start on the most important packet waiting
+      for (size_t i = 0; i < NUM_PRIORITIES && !sending.valid(); i++) {
+        sending = queues[i]->peek();
+        sending_queue = i;
+      }
+      sending_offset = 0;
+      if (!sending.valid()) {
+        return wrote_any;
       }
-      did_something = true;
     }
 
-    if (!did_something) {
-      vexDelay(NO_ACTIVITY_DELAY);
+    // avail can be -1 for unknown reasons
+    const int avail = vexGenericSerialWriteFree(port);
+    uint32_t room = avail > 0 ? (uint32_t)avail : 0;
+    if (room > tokens) {
+      room = tokens;
+    }
+    const uint32_t left = sending.len - sending_offset;
+    const uint32_t len = left < room ? left : room;
+    if (len == 0) {
+      deferrals++;
+      return wrote_any;
+    }
+    const int32_t wrote = vexGenericSerialTransmit(
+        port, sending.data + sending_offset, (int32_t)len);
+    if (wrote <= 0) {
+      deferrals++;
+      return wrote_any;
     }
+    wrote_any = true;
+    tokens -= (uint32_t)wrote;
+    sending_offset += (uint32_t)wrote;
+    sent_bytes += (uint32_t)wrote;
+    window_bytes += (uint32_t)wrote;
+    if (sending_offset < sending.len) {
+      return true;
+    }
+    queues[sending_queue]->release(sending);
+    sending = ByteRing::Record{};
   }
-  return 0;
 }
 
-bool COBSSerialDevice::send_cobs_packet(const Packet &pac) {
-  outbound_mutex.lock();
-  size_t size = outbound_packets.size();
-  outbound_mutex.unlock();
-  if (size >= MAX_OUT_QUEUE_SIZE) {
-    // printf("Too many packets in out queue. dropping\n");
-    return false;
+bool COBSSerialDevice::service() {
+  if (!port_enabled) {
+    vexGenericSerialEnable(port, 0x0);
+    vexGenericSerialBaudrate(port, baud_rate);
+    port_enabled = true;
+    last_refill_us = clock();
+    window_start_us = last_refill_us;
   }
+  bool did_something = false;
 
-  std::vector<uint8_t> encoded;
-  cobs_encode(pac, encoded);
+  // Writing
+  if (write_packet_if_avail()) {
+    did_something = true;
+  }
+
+  // Reading
+  if (read_packets_if_avail()) {
+    did_something = true;
+  }
+
+  // Bytes held back by the token bucket don't count as busy, so the reactor
+  // can back off while the link drains
+  return did_something || (anything_queued() && tokens > 0);
+}
 
-  outbound_mutex.lock();
-  outbound_packets.push_front(encoded);
-  outbound_mutex.unlock();
+bool COBSSerialDevice::send_cobs_packet(const Packet &pac, Priority prio) {
+  const size_t queue = (size_t)prio;
+  Metrics &metrics = Metrics::instance();
+  if (pac.size() == 0 || pac.size() > MAX_PACKET_SIZE) {
+    dropped[queue]++;
+    metrics.count_drop(Metrics::Drop::TooLarge);
+    return false;
+  }
+  // Encode straight into the queue. This is the only copy the packet gets
+  // before it goes out on the wire
+  const ByteRing::Reservation res =
+      queues[queue]->reserve(max_encoded_size(pac.size()));
+  if (!res.valid()) {
+    dropped[queue]++;
+    metrics.count_drop(Metrics::Drop::QueueFull);
+    return false;
+  }
+  {
+    const Metrics::Timer timer{Metrics::Timing::COBSEncode};
+    queues[queue]->commit(res, cobs_encode(pac.data(), pac.size(), res.data));
+  }
+  queued[queue]++;
+
+  uint32_t depth = 0;
+  for (const MPSCByteRing *q : queues) {
+    depth += q->used();
+  }
+  metrics.record_queue_depth(Metrics::Queue::Outbound, depth);
   return true;
 }
 
-void COBSSerialDevice::cobs_encode(const Packet &in, WirePacket &out) {
-  out.clear();
-  if (in.size() == 0) {
-    return;
+COBSSerialDevice::TransmitStats COBSSerialDevice::transmit_stats() const {
+  TransmitStats s;
+  for (size_t i = 0; i < NUM_PRIORITIES; i++) {
+    s.queued[i] = queued[i];
+    s.dropped[i] = dropped[i];
+  }
+  s.sent_bytes = sent_bytes;
+  s.deferrals = deferrals;
+  s.utilization_permille = utilization_permille;
+  return s;
+}
+
+size_t COBSSerialDevice::cobs_encode(const uint8_t *in, size_t size,
+                                     uint8_t *out) {
+  if (size == 0) {
+    return 0;
   }
-  size_t output_size = in.size() + (in.size() / 254) + 1;
-  output_size += 2; // delimeter bytes
-  out.resize(output_size);
   out[0] = 0;
 
   size_t output_code_head = 1;
@@ -163,45 +252,43 @@ void COBSSerialDevice::cobs_encode(const Packet &in, WirePacket &out) {
 
   size_t input_head = 0;
   size_t output_head = 2;
-  size_t length = 0;
-  while (input_head < in.size()) {
-    if (in[input_head] == 0 || length == 255) {
+  while (input_head < size) {
+    if (code_value == 0xff) {
+      // Block is full. A maximum length block doesn't stand in for a zero so
+      // the input byte still needs to be handled
       out[output_code_head] = (uint8_t)code_value;
       code_value = 1;
       output_code_head = output_head;
-      length = 0;
       output_head++;
-      if (in[input_head] == 0) {
-        input_head++;
-      }
+    } else if (in[input_head] == 0) {
+      out[output_code_head] = (uint8_t)code_value;
+      code_value = 1;
+      output_code_head = output_head;
+      output_head++;
+      input_head++;
     } else {
       out[output_head] = in[input_head];
       code_value++;
       input_head++;
       output_head++;
     }
-    length++;
   }
-  out[output_code_head] = code_value;
+  out[output_code_head] = (uint8_t)code_value;
 
   // Trailing delimeter
   out[output_head] = 0;
   output_head++;
 
-  out.resize(output_head);
+  return output_head;
 }
 
-void COBSSerialDevice::cobs_decode(const WirePacket &in, Packet &out) {
-  out.clear();
-  if (in.size() == 0) {
-    return;
-  }
-
-  out.resize(in.size() + in.size() / 254);
+size_t COBSSerialDevice::cobs_decode(const uint8_t *in, size_t size,
+                                     uint8_t *out) {
   uint8_t code = 0xff;
   uint8_t left_in_block = 0;
   size_t write_head = 0;
-  for (const uint8_t byte : in) {
+  for (size_t i = 0; i < size; i++) {
+    const uint8_t byte = in[i];
     if (left_in_block) {
       out[write_head] = byte;
       write_head++;
@@ -219,7 +306,15 @@ void COBSSerialDevice::cobs_decode(const WirePacket &in, Packet &out) {
     }
     left_in_block--;
   }
-  out.resize(write_head);
+  return write_head;
+}
 
-  return;
+void COBSSerialDevice::cobs_encode(const Packet &in, WirePacket &out) {
+  out.resize(max_encoded_size(in.size()));
+  out.resize(cobs_encode(in.data(), in.size(), out.data()));
+}
+
+void COBSSerialDevice::cobs_decode(const WirePacket &in, Packet &out) {
+  out.resize(in.size());
+  out.resize(cobs_decode(in.data(), in.size(), out.data()));
 }
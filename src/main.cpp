@@ -9,6 +9,7 @@
 #include "vdb/builtins.hpp"
 #include "vdb/protocol.hpp"
 #include "vdb/registry.hpp"
+#include "vdb/scheduler.hpp"
 #include "vdb/tests.hpp"
 #include "vex.h"
 #include "wrapper_device.hpp"
@@ -29,27 +30,29 @@ int main() {
 
   vex::motor mot1{vex::PORT11};
   printf("opening channel\n");
-  auto motorData = (std::shared_ptr<VDP::Timestamped>)new VDP::Timestamped(
+  auto motorData = std::make_shared<VDP::Timestamped>(
       "motor", new VDP::Motor("motor", mot1));
 
   VDP::ChannelID chan1 = reg1.open_channel(motorData);
   // VDP::ChannelID chan2 = reg1.open_channel(distData);
-
-  bool ready = reg1.negotiate();
-  if (!ready) {
-    Brain.Screen.printAt(20, 20, "FAILED");
-    while (1) {
-      vexDelay(1000);
-    };
-    return 1;
-  }
+  auto linkData = std::make_shared<VDP::LinkMetrics>("link");
+  VDP::ChannelID link_chan = reg1.open_channel(linkData);
+
+  // Sampled and sent from the scheduler's task. Data starts flowing on each
+  // channel as soon as it is acked
+  VDP::Scheduler sched{reg1};
+  sched.add(chan1, motorData, 100);
+  sched.add(link_chan, linkData, 1000);
+  // sched.add(chan2, distData, 1000);
+  reg1.start_negotiation();
+  sched.start();
   mot1.spin(vex::fwd, 1, vex::volt);
 
   while (true) {
-    motorData->fetch();
-    // distData->fetch();
-    reg1.send_data(chan1, motorData);
-    // reg1.send_data(chan2, distData);
+    if (reg1.negotiation_state() ==
+        VDP::Registry::NegotiationState::Failed) {
+      Brain.Screen.printAt(20, 20, "FAILED");
+    }
     vexDelay(100);
   }
 
@@ -0,0 +1,111 @@
+#include "metrics.hpp"
+
+#include <vex.h>
+
+namespace {
+void raise_to(std::atomic<uint32_t> &high, uint32_t value) {
+  uint32_t current = high.load(std::memory_order_relaxed);
+  while (value > current &&
+         !high.compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+size_t bucket_of(uint32_t us) {
+  size_t bucket = 0;
+  while (us > 0 && bucket < Metrics::HISTOGRAM_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+} // namespace
+
+Metrics Metrics::shared;
+
+Metrics &Metrics::instance() { return shared; }
+
+void Metrics::record_time(Timing which, uint32_t us) {
+  AtomicHistogram &h = timings[(size_t)which];
+  h.buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+  h.count.fetch_add(1, std::memory_order_relaxed);
+  h.total_us.fetch_add(us, std::memory_order_relaxed);
+  raise_to(h.max_us, us);
+}
+
+void Metrics::record_queue_depth(Queue which, uint32_t bytes) {
+  raise_to(queue_highs[(size_t)which], bytes);
+}
+
+Metrics::ChannelCounters Metrics::channel(Direction dir,
+                                          uint8_t channel) const {
+  const Counters &c = channels[(size_t)dir][channel];
+  ChannelCounters out;
+  out.packets = c.packets.load(std::memory_order_relaxed);
+  out.bytes = c.bytes.load(std::memory_order_relaxed);
+  return out;
+}
+
+uint32_t Metrics::dropped(Drop reason) const {
+  return drops[(size_t)reason].load(std::memory_order_relaxed);
+}
+
+Metrics::Histogram Metrics::histogram(Timing which) const {
+  const AtomicHistogram &h = timings[(size_t)which];
+  Histogram out;
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    out.buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+  }
+  out.count = h.count.load(std::memory_order_relaxed);
+  out.max_us = h.max_us.load(std::memory_order_relaxed);
+  out.total_us = h.total_us.load(std::memory_order_relaxed);
+  return out;
+}
+
+uint32_t Metrics::queue_high_watermark(Queue which) const {
+  return queue_highs[(size_t)which].load(std::memory_order_relaxed);
+}
+
+void Metrics::reset() {
+  for (Counters(&dir)[MAX_CHANNELS] : channels) {
+    for (Counters &c : dir) {
+      c.packets = 0;
+      c.bytes = 0;
+    }
+  }
+  for (AtomicHistogram &h : timings) {
+    for (std::atomic<uint32_t> &b : h.buckets) {
+      b = 0;
+    }
+    h.count = 0;
+    h.max_us = 0;
+    h.total_us = 0;
+    h.runs = 0;
+  }
+  for (std::atomic<uint32_t> &q : queue_highs) {
+    q = 0;
+  }
+  for (std::atomic<uint32_t> &d : drops) {
+    d = 0;
+  }
+}
+
+bool Metrics::should_sample(Timing which) {
+  return timings[(size_t)which].runs.fetch_add(1, std::memory_order_relaxed) %
+             TIMER_SAMPLE_EVERY ==
+         0;
+}
+
+Metrics::Timer::Timer(Timing which)
+    : which(which), sampled(Metrics::instance().should_sample(which)) {
+  if (sampled) {
+    start_us = vexSystemHighResTimeGet();
+  }
+}
+
+Metrics::Timer::~Timer() {
+  if (sampled) {
+    Metrics::instance().record_time(
+        which, (uint32_t)(vexSystemHighResTimeGet() - start_us));
+  }
+}
@@ -0,0 +1,137 @@
+#include "serial_reactor.hpp"
+
+#include "cobs_device.hpp"
+#include "metrics.hpp"
+
+#include <new>
+
+namespace {
+// Built by hand rather than as a function local static, the brain is built
+// without thread safe statics and devices may be made from several tasks.
+// Never destroyed, the reactor task may outlive everything else
+alignas(SerialReactor) unsigned char reactor_storage[sizeof(SerialReactor)];
+enum : uint8_t { NOT_BUILT, BUILDING, BUILT };
+std::atomic<uint8_t> reactor_state{NOT_BUILT};
+} // namespace
+
+SerialReactor &SerialReactor::instance() {
+  uint8_t state = reactor_state.load();
+  if (state != BUILT) {
+    if (state == NOT_BUILT &&
+        reactor_state.compare_exchange_strong(state, BUILDING)) {
+      new (reactor_storage) SerialReactor();
+      reactor_state = BUILT;
+    }
+    while (reactor_state.load() != BUILT) {
+      vex::this_thread::yield();
+    }
+  }
+  return *reinterpret_cast<SerialReactor *>(reactor_storage);
+}
+
+bool SerialReactor::add(COBSSerialDevice *dev) {
+  for (std::atomic<COBSSerialDevice *> &slot : devices) {
+    COBSSerialDevice *expected = nullptr;
+    if (slot.compare_exchange_strong(expected, dev)) {
+      bool was_started = false;
+      if (started.compare_exchange_strong(was_started, true)) {
+        reactor_task = vex::task(SerialReactor::reactor_thread, (void *)this,
+                                 vex::thread::threadPriorityHigh);
+      }
+      return true;
+    }
+  }
+  printf("SerialReactor: Too many devices, not servicing another\n");
+  return false;
+}
+
+void SerialReactor::remove(COBSSerialDevice *dev) {
+  for (std::atomic<COBSSerialDevice *> &slot : devices) {
+    COBSSerialDevice *expected = dev;
+    slot.compare_exchange_strong(expected, nullptr);
+  }
+  // service_all double checks the slot after announcing what it is working
+  // on, so once this is clear the device won't be touched again
+  while (servicing.load() == dev) {
+    vexDelay(1);
+  }
+}
+
+void SerialReactor::configure(Config cfg) {
+  if (cfg.max_poll_ms < cfg.min_poll_ms) {
+    cfg.max_poll_ms = cfg.min_poll_ms;
+  }
+  min_poll_ms = cfg.min_poll_ms;
+  max_poll_ms = cfg.max_poll_ms;
+}
+
+SerialReactor::Stats SerialReactor::stats() const {
+  Stats s;
+  s.poll_ms = poll_ms;
+  s.passes = passes;
+  s.busy_passes = busy_passes;
+  s.last_service_latency_us = last_latency_us;
+  s.max_service_latency_us = max_latency_us;
+  s.mean_service_latency_us = mean_latency_us;
+  s.last_oversleep_us = last_oversleep_us;
+  return s;
+}
+
+bool SerialReactor::service_all() {
+  bool busy = false;
+  for (std::atomic<COBSSerialDevice *> &slot : devices) {
+    COBSSerialDevice *dev = slot.load();
+    if (dev == nullptr) {
+      continue;
+    }
+    servicing = dev;
+    if (slot.load() == dev && dev->service()) {
+      busy = true;
+    }
+    servicing = nullptr;
+  }
+  return busy;
+}
+
+int SerialReactor::reactor_thread(void *vself) {
+  SerialReactor &self = *(SerialReactor *)vself;
+
+  uint32_t interval = self.min_poll_ms;
+  uint64_t sleep_start = vexSystemHighResTimeGet();
+
+  while (true) {
+    const uint64_t pass_start = vexSystemHighResTimeGet();
+    const bool busy = self.service_all();
+    self.passes++;
+
+    if (busy) {
+      self.busy_passes++;
+      const uint32_t latency = (uint32_t)(pass_start - sleep_start);
+      self.last_latency_us = latency;
+      if (latency > self.max_latency_us) {
+        self.max_latency_us = latency;
+      }
+      const uint32_t mean = self.mean_latency_us;
+      self.mean_latency_us = mean - mean / 8 + latency / 8;
+      Metrics::instance().record_time(Metrics::Timing::SerialLoop, latency);
+      interval = self.min_poll_ms;
+    } else {
+      interval = interval == 0 ? 1 : interval * 2;
+      if (interval > self.max_poll_ms) {
+        interval = self.max_poll_ms;
+      }
+    }
+    self.poll_ms = interval;
+
+    sleep_start = vexSystemHighResTimeGet();
+    if (interval == 0) {
+      vex::this_thread::yield();
+    } else {
+      vexDelay(interval);
+      const uint64_t slept = vexSystemHighResTimeGet() - sleep_start;
+      const uint64_t asked = (uint64_t)interval * 1000;
+      self.last_oversleep_us = (uint32_t)(slept > asked ? slept - asked : 0);
+    }
+  }
+  return 0;
+}
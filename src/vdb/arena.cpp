@@ -0,0 +1,50 @@
+#include "vdb/arena.hpp"
+
+namespace VDP {
+
+SchemaArena::SchemaArena(size_t first_chunk)
+    : next_chunk(first_chunk > 0 ? first_chunk : 512) {}
+
+SchemaArena::~SchemaArena() {
+  // Newest first, so a record goes before the fields it was built from
+  for (Cleanup *c = cleanups; c != nullptr; c = c->next) {
+    c->destroy(c->object);
+  }
+  while (chunks != nullptr) {
+    Chunk *next = chunks->next;
+    ::operator delete(chunks);
+    chunks = next;
+  }
+}
+
+void *SchemaArena::allocate(size_t size, size_t align) {
+  if (align < alignof(Cleanup)) {
+    align = alignof(Cleanup);
+  }
+  uintptr_t object = ((uintptr_t)head + sizeof(Cleanup) + align - 1) &
+                     ~(uintptr_t)(align - 1);
+  if (head == nullptr || object - sizeof(Cleanup) + size > (uintptr_t)end) {
+    // Start a new chunk big enough for this even at its worst alignment
+    size_t chunk_size = next_chunk;
+    while (chunk_size < sizeof(Chunk) + size + align) {
+      chunk_size *= 2;
+    }
+    next_chunk = chunk_size * 2;
+    Chunk *chunk = (Chunk *)::operator new(chunk_size);
+    chunk->next = chunks;
+    chunk->size = chunk_size;
+    chunks = chunk;
+    head = (uint8_t *)chunk + sizeof(Chunk);
+    end = (uint8_t *)chunk + chunk_size;
+    stat.chunks++;
+    stat.bytes_reserved += chunk_size;
+    object = ((uintptr_t)head + sizeof(Cleanup) + align - 1) &
+             ~(uintptr_t)(align - 1);
+  }
+  uint8_t *start = (uint8_t *)(object - sizeof(Cleanup));
+  stat.bytes_used += (uint32_t)(start + size - head);
+  head = start + size;
+  return start;
+}
+
+} // namespace VDP
@@ -0,0 +1,75 @@
+#include "vdb/array.hpp"
+#include "vdb/arena.hpp"
+
+namespace VDP {
+
+template <typename Elem>
+static PartPtr decode_array(std::string name, PacketReader &reader,
+                            SchemaArena *arena) {
+  using Arr = Array<Elem>;
+  typename Arr::Codec codec;
+  if (!codec.read_schema(reader)) {
+    reader.fail(ReadStatus::BadSchema);
+    return nullptr;
+  }
+  const uint16_t max_size = reader.get_number<uint16_t>();
+  const uint8_t length = reader.get_number<uint8_t>();
+  if (!reader.ok()) {
+    return nullptr;
+  }
+  if (max_size == 0 ||
+      max_size * sizeof(typename Arr::WireType) > MAX_ARRAY_BYTES ||
+      length > (uint8_t)ArrayLength::Bounded) {
+    reader.fail(ReadStatus::BadSchema);
+    return nullptr;
+  }
+  return make_node<Arr>(arena, std::move(name), max_size, (ArrayLength)length,
+                        codec);
+}
+
+PartPtr make_array_decoder(std::string name, PacketReader &reader,
+                           SchemaArena *arena) {
+  const Type element = reader.get_type();
+  if (!reader.ok()) {
+    return nullptr;
+  }
+  switch (element) {
+  case Type::Float:
+    return decode_array<Float>(std::move(name), reader, arena);
+  case Type::Double:
+    return decode_array<Double>(std::move(name), reader, arena);
+  case Type::Half:
+    return decode_array<Half>(std::move(name), reader, arena);
+  case Type::Fixed16:
+    return decode_array<Fixed16>(std::move(name), reader, arena);
+
+  case Type::Uint8:
+    return decode_array<Uint8>(std::move(name), reader, arena);
+  case Type::Uint16:
+    return decode_array<Uint16>(std::move(name), reader, arena);
+  case Type::Uint32:
+    return decode_array<Uint32>(std::move(name), reader, arena);
+  case Type::Uint64:
+    return decode_array<Uint64>(std::move(name), reader, arena);
+
+  case Type::Int8:
+    return decode_array<Int8>(std::move(name), reader, arena);
+  case Type::Int16:
+    return decode_array<Int16>(std::move(name), reader, arena);
+  case Type::Int32:
+    return decode_array<Int32>(std::move(name), reader, arena);
+  case Type::Int64:
+    return decode_array<Int64>(std::move(name), reader, arena);
+
+  // Elements have to be fixed size
+  case Type::Record:
+  case Type::String:
+  case Type::Array:
+  case Type::Series:
+    break;
+  }
+  reader.fail(ReadStatus::BadSchema);
+  return nullptr;
+}
+
+} // namespace VDP
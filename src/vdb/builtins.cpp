@@ -3,6 +3,7 @@
 #include "vdb/protocol.hpp"
 #include "vdb/types.hpp"
 
+#include "metrics.hpp"
 #include "vex_motor.h"
 #include "vex_units.h"
 #include <cstdint>
@@ -14,7 +15,7 @@ Timestamped::Timestamped(std::string name, Part *data)
     : Record(name),
       timestamp(new Uint32("timestamp", []() { return vexSystemTimeGet(); })),
       data(data) {
-  Record::setFields({timestamp, (PartPtr)data});
+  Record::setFields({timestamp, this->data});
 }
 void Timestamped::fetch() {
   timestamp->fetch();
@@ -23,8 +24,12 @@ void Timestamped::fetch() {
 
 Motor::Motor(std::string name, vex::motor &motor)
     : Record(std::move(name)), mot(motor), pos(new Float("Position(deg)")),
-      vel(new Float("velocity(dps)")), temp(new Uint8("Temperature(C)")),
-      voltage(new Float("Voltage(V)")), current(new Float("Current(%)")) {
+      // +-4096 dps, the fastest cartridge tops out around 3600
+      vel(new Fixed16("velocity(dps)", 0.125f)),
+      temp(new Uint8("Temperature(C)")),
+      // +-32.767V
+      voltage(new Fixed16("Voltage(V)", 0.001f)),
+      current(new Half("Current(%)")) {
   Record::setFields({pos, vel, temp, voltage, current});
 }
 
@@ -36,4 +41,119 @@ void Motor::fetch() {
   current->setValue((float)mot.current(vex::percentUnits::pct));
 }
 
+namespace {
+PartPtr counter(std::string name, std::function<uint32_t()> read) {
+  return std::make_shared<Uint32>(std::move(name), std::move(read));
+}
+
+PartPtr channel_counters(uint8_t id) {
+  using Dir = Metrics::Direction;
+  return std::make_shared<Record>(
+      std::to_string(id),
+      std::vector<PartPtr>{
+          counter("sent packets",
+                  [id]() {
+                    return Metrics::instance().channel(Dir::Sent, id).packets;
+                  }),
+          counter("sent bytes",
+                  [id]() {
+                    return Metrics::instance().channel(Dir::Sent, id).bytes;
+                  }),
+          counter("received packets",
+                  [id]() {
+                    return Metrics::instance()
+                        .channel(Dir::Received, id)
+                        .packets;
+                  }),
+          counter("received bytes", [id]() {
+            return Metrics::instance().channel(Dir::Received, id).bytes;
+          })});
+}
+
+PartPtr timing(std::string name, Metrics::Timing which) {
+  std::vector<PartPtr> buckets;
+  for (size_t i = 0; i < Metrics::HISTOGRAM_BUCKETS; i++) {
+    // Upper bound of the bucket in microseconds, the last has none
+    std::string bound = i + 1 < Metrics::HISTOGRAM_BUCKETS
+                            ? "<" + std::to_string(1UL << i)
+                            : ">=" + std::to_string(1UL << (i - 1));
+    buckets.push_back(counter(std::move(bound), [which, i]() {
+      return Metrics::instance().histogram(which).buckets[i];
+    }));
+  }
+  return std::make_shared<Record>(
+      std::move(name),
+      std::vector<PartPtr>{
+          counter("count",
+                  [which]() {
+                    return Metrics::instance().histogram(which).count;
+                  }),
+          counter("mean(us)",
+                  [which]() {
+                    const Metrics::Histogram h =
+                        Metrics::instance().histogram(which);
+                    return h.count == 0 ? 0 : h.total_us / h.count;
+                  }),
+          counter("max(us)",
+                  [which]() {
+                    return Metrics::instance().histogram(which).max_us;
+                  }),
+          std::make_shared<Record>("histogram(us)", std::move(buckets))});
+}
+
+PartPtr drop_counter(std::string name, Metrics::Drop reason) {
+  return counter(std::move(name), [reason]() {
+    return Metrics::instance().dropped(reason);
+  });
+}
+} // namespace
+
+LinkMetrics::LinkMetrics(std::string name, uint8_t num_channels)
+    : Record(std::move(name)) {
+  using Drop = Metrics::Drop;
+  using Queue = Metrics::Queue;
+  using Timing = Metrics::Timing;
+
+  std::vector<PartPtr> channels;
+  for (uint8_t id = 0; id < num_channels; id++) {
+    channels.push_back(channel_counters(id));
+  }
+  Record::setFields(
+      {std::make_shared<Record>("channels", std::move(channels)),
+       std::make_shared<Record>(
+           "queue high watermarks(bytes)",
+           std::vector<PartPtr>{
+               counter("inbound",
+                       []() {
+                         return Metrics::instance().queue_high_watermark(
+                             Queue::Inbound);
+                       }),
+               counter("outbound",
+                       []() {
+                         return Metrics::instance().queue_high_watermark(
+                             Queue::Outbound);
+                       })}),
+       std::make_shared<Record>(
+           "drops",
+           std::vector<PartPtr>{
+               drop_counter("queue full", Drop::QueueFull),
+               drop_counter("too large", Drop::TooLarge),
+               drop_counter("framing", Drop::Framing),
+               drop_counter("too small", Drop::TooSmall),
+               drop_counter("bad checksum", Drop::BadChecksum),
+               drop_counter("unknown channel", Drop::UnknownChannel),
+               drop_counter("bad data", Drop::BadData),
+               drop_counter("no keyframe", Drop::NoKeyframe),
+               drop_counter("duplicate", Drop::Duplicate),
+               drop_counter("not negotiated", Drop::NotNegotiated)}),
+       std::make_shared<Record>(
+           "timing",
+           std::vector<PartPtr>{
+               timing("serialize", Timing::Serialize),
+               timing("crc", Timing::CRC),
+               timing("cobs encode", Timing::COBSEncode),
+               timing("cobs decode", Timing::COBSDecode),
+               timing("serial loop", Timing::SerialLoop)})});
+}
+
 } // namespace VDP
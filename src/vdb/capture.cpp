@@ -0,0 +1,483 @@
+#include "vdb/capture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#ifndef VexV5
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace VDP {
+
+namespace {
+const char capture_magic[6] = {'V', 'D', 'P', 'C', 'A', 'P'};
+const char index_magic[4] = {'V', 'I', 'D', 'X'};
+
+bool is_broadcast(const Packet &frame) {
+  if (frame.empty()) {
+    return false;
+  }
+  const PacketHeader header = decode_header_byte(frame[0]);
+  return header.type == PacketType::Broadcast &&
+         header.func == PacketFunction::Send && frame.size() > 1;
+}
+} // namespace
+
+CaptureWriter::CaptureWriter() : CaptureWriter(Config{}) {}
+CaptureWriter::CaptureWriter(Config cfg) : config(cfg) {
+  buffer.reserve(config.buffer_bytes);
+  pending.reserve(config.buffer_bytes);
+}
+CaptureWriter::~CaptureWriter() { close(); }
+
+bool CaptureWriter::open(const char *path) {
+  close();
+  mut.lock();
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    VDPWarnf("Capture: Couldn't create %s", path);
+    mut.unlock();
+    return false;
+  }
+  // Records are already written a buffer at a time
+  setvbuf(file, nullptr, _IONBF, 0);
+  buffer.clear();
+  pending.clear();
+  pending_ready = false;
+  failed = false;
+  buffered_from = 0;
+  synced = false;
+  index.clear();
+  PacketWriter writer{buffer};
+  writer.write_bytes((const uint8_t *)capture_magic, sizeof(capture_magic));
+  writer.write_number<uint16_t>(CAPTURE_VERSION);
+  running = true;
+  task_alive = true;
+  writer_task =
+      vex::task(CaptureWriter::writer_thread, (void *)this, config.priority);
+  mut.unlock();
+  return true;
+}
+
+bool CaptureWriter::is_open() const { return file != nullptr; }
+
+void CaptureWriter::close() {
+  // The writer task finishes what it was given before it stops
+  running = false;
+  while (task_alive.load()) {
+    vexDelay(1);
+  }
+  mut.lock();
+  if (file == nullptr) {
+    mut.unlock();
+    return;
+  }
+  // Handed off after the task had stopped
+  if (pending_ready) {
+    count_write(pending.size(), write_file(pending));
+    pending.clear();
+    pending_ready = false;
+  }
+  if (!failed) {
+    // The seek index, then the trailer that says where it is
+    const uint64_t index_offset = buffered_from + buffer.size();
+    PacketWriter writer{buffer};
+    for (const IndexEntry &entry : index) {
+      writer.write_number<uint64_t>(entry.time_us);
+      writer.write_number<uint64_t>(entry.offset);
+    }
+    writer.write_number<uint64_t>(index_offset);
+    writer.write_number<uint32_t>((uint32_t)index.size());
+    writer.write_bytes((const uint8_t *)index_magic, sizeof(index_magic));
+  }
+  count_write(buffer.size(), write_file(buffer));
+  buffer.clear();
+  file_mut.lock();
+  if (fclose(file) != 0 && !failed) {
+    failed = true;
+    stat.write_errors++;
+  }
+  file = nullptr;
+  file_mut.unlock();
+  mut.unlock();
+}
+
+void CaptureWriter::flush() {
+  // Wait for the writer to take the last buffer, then give it this one
+  while (true) {
+    mut.lock();
+    if (file == nullptr) {
+      mut.unlock();
+      return;
+    }
+    if (!pending_ready) {
+      hand_off();
+      mut.unlock();
+      break;
+    }
+    mut.unlock();
+    vexDelay(1);
+  }
+  while (pending_ready.load() && task_alive.load()) {
+    vexDelay(1);
+  }
+  file_mut.lock();
+  if (file != nullptr) {
+    fflush(file);
+  }
+  file_mut.unlock();
+}
+
+void CaptureWriter::append(CaptureDirection dir, uint64_t time_us,
+                           const Packet &frame) {
+  mut.lock();
+  if (file == nullptr || failed) {
+    mut.unlock();
+    return;
+  }
+  if (frame.size() > UINT16_MAX ||
+      buffer.size() + frame.size() > config.max_buffer_bytes) {
+    stat.dropped++;
+    mut.unlock();
+    return;
+  }
+  const bool schema = is_broadcast(frame);
+  if (schema) {
+    remember_schema(dir, frame);
+  }
+  // Tasks take their timestamps before getting here, so one can come in
+  // behind the record before it. Records stay in time order, which the
+  // index and seeking rely on
+  if (synced && time_us < last_time_us) {
+    time_us = last_time_us;
+  }
+  const uint64_t offset = buffered_from + buffer.size();
+  if (!synced || time_us - last_time_us > UINT32_MAX ||
+      offset - last_sync_offset >= config.sync_bytes) {
+    write_sync(time_us);
+  }
+  write_record(schema ? CaptureKind::Schema : CaptureKind::Frame, dir,
+               time_us, frame.data(), frame.size());
+  stat.frames++;
+  mut.unlock();
+}
+
+CaptureWriter::Stats CaptureWriter::stats() {
+  mut.lock();
+  const Stats copy = stat;
+  mut.unlock();
+  return copy;
+}
+
+void CaptureWriter::write_record(CaptureKind kind, CaptureDirection dir,
+                                 uint64_t time_us, const uint8_t *data,
+                                 size_t size) {
+  // While the writer is still busy this buffer grows instead
+  if (!buffer.empty() && !pending_ready &&
+      buffer.size() + CAPTURE_RECORD_HEADER_SIZE + size > config.buffer_bytes) {
+    hand_off();
+  }
+  PacketWriter writer{buffer};
+  writer.write_number<uint8_t>((uint8_t)kind);
+  writer.write_number<uint8_t>((uint8_t)dir);
+  writer.write_number<uint16_t>((uint16_t)size);
+  writer.write_number<uint32_t>((uint32_t)(time_us - last_time_us));
+  writer.write_bytes(data, size);
+  last_time_us = time_us;
+}
+
+void CaptureWriter::write_sync(uint64_t time_us) {
+  last_sync_offset = buffered_from + buffer.size();
+  index.push_back(IndexEntry{time_us, last_sync_offset});
+  uint8_t absolute[sizeof(uint64_t)];
+  std::memcpy(absolute, &time_us, sizeof(absolute));
+  last_time_us = time_us;
+  write_record(CaptureKind::Sync, CaptureDirection::Received, time_us,
+               absolute, sizeof(absolute));
+  for (const KnownSchema &known : schemas) {
+    write_record(CaptureKind::SchemaCopy, known.direction, time_us,
+                 known.frame.data(), known.frame.size());
+  }
+  synced = true;
+  stat.syncs++;
+}
+
+void CaptureWriter::remember_schema(CaptureDirection dir, const Packet &frame) {
+  const ChannelID id = frame[1];
+  for (KnownSchema &known : schemas) {
+    if (known.direction == dir && known.id == id) {
+      known.frame = frame;
+      return;
+    }
+  }
+  schemas.push_back(KnownSchema{dir, id, frame});
+}
+
+void CaptureWriter::hand_off() {
+  if (buffer.empty()) {
+    return;
+  }
+  // pending was cleared by the writer, so this keeps both capacities
+  std::swap(buffer, pending);
+  buffered_from += pending.size();
+  pending_ready = true;
+}
+
+bool CaptureWriter::write_file(const Packet &data) {
+  if (data.empty() || failed) {
+    return true;
+  }
+  file_mut.lock();
+  const bool wrote = fwrite(data.data(), 1, data.size(), file) == data.size();
+  file_mut.unlock();
+  return wrote;
+}
+
+void CaptureWriter::count_write(size_t size, bool wrote) {
+  if (failed) {
+    return;
+  }
+  if (wrote) {
+    stat.bytes += size;
+    return;
+  }
+  // What follows would be at the wrong offsets, so stop here
+  VDPWarnf("Capture: Writing %d bytes failed, stopping", (int)size);
+  failed = true;
+  stat.write_errors++;
+}
+
+int CaptureWriter::writer_thread(void *vself) {
+  CaptureWriter &self = *(CaptureWriter *)vself;
+  while (true) {
+    if (self.pending_ready.load()) {
+      const bool wrote = self.write_file(self.pending);
+      self.mut.lock();
+      self.count_write(self.pending.size(), wrote);
+      self.mut.unlock();
+      self.pending.clear();
+      self.pending_ready = false;
+    } else if (!self.running.load()) {
+      break;
+    } else {
+      vexDelay(1);
+    }
+  }
+  self.task_alive = false;
+  return 0;
+}
+
+CaptureDevice::CaptureDevice(AbstractDevice *device, CaptureWriter &writer)
+    : device(device), writer(writer) {}
+
+bool CaptureDevice::send_packet(const Packet &packet) {
+  if (!device->send_packet(packet)) {
+    // Never went on the wire
+    return false;
+  }
+  // Timed once the device has it, so anything received while sending is
+  // recorded first and earlier
+  writer.append(CaptureDirection::Sent, vexSystemHighResTimeGet(), packet);
+  return true;
+}
+
+void CaptureDevice::register_receive_callback(
+    std::function<void(const Packet &packet)> new_callback) {
+  callback = std::move(new_callback);
+  device->register_receive_callback([this](const Packet &packet) {
+    writer.append(CaptureDirection::Received, vexSystemHighResTimeGet(),
+                  packet);
+    if (callback) {
+      callback(packet);
+    }
+  });
+}
+
+#ifndef VexV5
+CaptureReader::Cursor::Cursor(const uint8_t *data, size_t pos, size_t end,
+                              uint64_t from_us, bool copies)
+    : data(data), pos(pos), end(end), from_us(from_us), copies(copies) {}
+
+bool CaptureReader::Cursor::next(CaptureFrame &out) {
+  while (pos + CAPTURE_RECORD_HEADER_SIZE <= end) {
+    const uint8_t *rec = data + pos;
+    uint16_t size;
+    uint32_t delta;
+    std::memcpy(&size, rec + 2, sizeof(size));
+    std::memcpy(&delta, rec + 4, sizeof(delta));
+    if (pos + CAPTURE_RECORD_HEADER_SIZE + size > end) {
+      return false; // Cut off
+    }
+    pos += CAPTURE_RECORD_HEADER_SIZE + size;
+    time_us += delta;
+    const bool first_record = !started;
+    started = true;
+    const CaptureKind kind = (CaptureKind)rec[0];
+    out = CaptureFrame{kind, (CaptureDirection)rec[1], time_us,
+                       rec + CAPTURE_RECORD_HEADER_SIZE, size};
+    switch (kind) {
+    case CaptureKind::Sync:
+      if (size < sizeof(uint64_t)) {
+        return false;
+      }
+      std::memcpy(&time_us, out.data, sizeof(time_us));
+      if (!first_record) {
+        copies = false;
+      }
+      break;
+    case CaptureKind::SchemaCopy:
+      if (copies) {
+        return true;
+      }
+      break;
+    case CaptureKind::Schema:
+      copies = false;
+      return true;
+    case CaptureKind::Frame:
+      copies = false;
+      if (time_us >= from_us) {
+        return true;
+      }
+      break;
+    }
+    // Anything else is from a newer version, skip it
+  }
+  return false;
+}
+
+CaptureReader::~CaptureReader() { close(); }
+
+bool CaptureReader::open(const char *path) {
+  close();
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < CAPTURE_HEADER_SIZE) {
+    ::close(fd);
+    return false;
+  }
+  void *mapped =
+      mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid without the descriptor
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  data = (const uint8_t *)mapped;
+  size = (size_t)st.st_size;
+  uint16_t version;
+  std::memcpy(&version, data + sizeof(capture_magic), sizeof(version));
+  if (std::memcmp(data, capture_magic, sizeof(capture_magic)) != 0 ||
+      version > CAPTURE_VERSION) {
+    VDPWarnf("Capture: %s isn't a capture this can read", path);
+    close();
+    return false;
+  }
+  if (read_index()) {
+    // Only the records after the last Sync need walking, for the end time
+    scan(syncs.empty() ? CAPTURE_HEADER_SIZE : syncs.back().offset,
+         syncs.empty() ? 0 : syncs.back().time_us);
+  } else {
+    records_end = size;
+    scan(CAPTURE_HEADER_SIZE, 0);
+  }
+  return true;
+}
+
+void CaptureReader::close() {
+  if (data != nullptr) {
+    munmap((void *)data, size);
+  }
+  data = nullptr;
+  size = 0;
+  records_end = 0;
+  indexed = false;
+  syncs.clear();
+  last_time_us = 0;
+}
+
+CaptureReader::Cursor CaptureReader::begin() const {
+  return Cursor{data, CAPTURE_HEADER_SIZE, records_end, 0, false};
+}
+
+CaptureReader::Cursor CaptureReader::seek(uint64_t time_us) const {
+  // Last Sync at or before time_us
+  auto after = std::upper_bound(
+      syncs.begin(), syncs.end(), time_us,
+      [](uint64_t t, const Sync &sync) { return t < sync.time_us; });
+  if (after == syncs.begin()) {
+    Cursor cursor = begin();
+    cursor.from_us = time_us;
+    return cursor;
+  }
+  --after;
+  return Cursor{data, (size_t)after->offset, records_end, time_us, true};
+}
+
+uint64_t CaptureReader::start_time_us() const {
+  return syncs.empty() ? 0 : syncs.front().time_us;
+}
+
+bool CaptureReader::read_index() {
+  if (size < CAPTURE_HEADER_SIZE + CAPTURE_TRAILER_SIZE) {
+    return false;
+  }
+  const uint8_t *trailer = data + size - CAPTURE_TRAILER_SIZE;
+  uint64_t index_offset;
+  uint32_t entries;
+  std::memcpy(&index_offset, trailer, sizeof(index_offset));
+  std::memcpy(&entries, trailer + 8, sizeof(entries));
+  if (std::memcmp(trailer + 12, index_magic, sizeof(index_magic)) != 0 ||
+      index_offset < CAPTURE_HEADER_SIZE ||
+      index_offset > size - CAPTURE_TRAILER_SIZE ||
+      (size - CAPTURE_TRAILER_SIZE - index_offset) != (uint64_t)entries * 16) {
+    return false;
+  }
+  syncs.resize(entries);
+  for (uint32_t i = 0; i < entries; i++) {
+    const uint8_t *entry = data + index_offset + i * 16;
+    std::memcpy(&syncs[i].time_us, entry, sizeof(uint64_t));
+    std::memcpy(&syncs[i].offset, entry + 8, sizeof(uint64_t));
+    if (syncs[i].offset >= index_offset) {
+      syncs.clear();
+      return false;
+    }
+  }
+  records_end = (size_t)index_offset;
+  indexed = true;
+  return true;
+}
+
+void CaptureReader::scan(size_t from, uint64_t time_us) {
+  size_t pos = from;
+  while (pos + CAPTURE_RECORD_HEADER_SIZE <= records_end) {
+    const uint8_t *rec = data + pos;
+    uint16_t rec_size;
+    uint32_t delta;
+    std::memcpy(&rec_size, rec + 2, sizeof(rec_size));
+    std::memcpy(&delta, rec + 4, sizeof(delta));
+    if (pos + CAPTURE_RECORD_HEADER_SIZE + rec_size > records_end) {
+      break;
+    }
+    time_us += delta;
+    if ((CaptureKind)rec[0] == CaptureKind::Sync &&
+        rec_size >= sizeof(uint64_t)) {
+      std::memcpy(&time_us, rec + CAPTURE_RECORD_HEADER_SIZE,
+                  sizeof(time_us));
+      if (!indexed) {
+        syncs.push_back(Sync{time_us, pos});
+      }
+    }
+    pos += CAPTURE_RECORD_HEADER_SIZE + rec_size;
+  }
+  // A file that wasn't closed may end part way through a record
+  records_end = pos;
+  last_time_us = time_us;
+}
+#endif
+
+} // namespace VDP
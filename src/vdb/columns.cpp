@@ -0,0 +1,235 @@
+#include "vdb/columns.hpp"
+#include "vdb/series.hpp"
+#include "vdb/types.hpp"
+
+#include "vex.h"
+
+namespace VDP {
+
+namespace {
+template <typename NumT, Type schemaType>
+void extract_number(const Part *leaf, uint8_t *out) {
+  const NumT value = ((const Number<NumT, schemaType> *)leaf)->getValue();
+  std::memcpy(out, &value, sizeof(value));
+}
+template <typename Quantized>
+void extract_float(const Part *leaf, uint8_t *out) {
+  const float value = ((const Quantized *)leaf)->getValue();
+  std::memcpy(out, &value, sizeof(value));
+}
+
+// Parts don't know their own type. The type byte of the schema they write
+// does, so encode it once when the columns are set up
+uint8_t schema_type_byte(Part *leaf) {
+  Packet scratch;
+  PacketWriter writer{scratch};
+  // Not owned, the probe only lives for this call
+  writer.write_channel_broadcast(Channel{PartPtr(PartPtr(), leaf)});
+  return scratch[2];
+}
+
+bool column_for(Part *leaf, ChannelColumns::Column &col) {
+  const Type t = (Type)(schema_type_byte(leaf) & ~TYPE_COMPACT_BIT);
+  col.type = t;
+  col.leaf = leaf;
+  switch (t) {
+  case Type::Float:
+    col.extract = extract_number<float, Type::Float>;
+    col.value_size = sizeof(float);
+    return true;
+  case Type::Double:
+    col.extract = extract_number<double, Type::Double>;
+    col.value_size = sizeof(double);
+    return true;
+  case Type::Uint8:
+    col.extract = extract_number<uint8_t, Type::Uint8>;
+    col.value_size = sizeof(uint8_t);
+    return true;
+  case Type::Uint16:
+    col.extract = extract_number<uint16_t, Type::Uint16>;
+    col.value_size = sizeof(uint16_t);
+    return true;
+  case Type::Uint32:
+    col.extract = extract_number<uint32_t, Type::Uint32>;
+    col.value_size = sizeof(uint32_t);
+    return true;
+  case Type::Uint64:
+    col.extract = extract_number<uint64_t, Type::Uint64>;
+    col.value_size = sizeof(uint64_t);
+    return true;
+  case Type::Int8:
+    col.extract = extract_number<int8_t, Type::Int8>;
+    col.value_size = sizeof(int8_t);
+    return true;
+  case Type::Int16:
+    col.extract = extract_number<int16_t, Type::Int16>;
+    col.value_size = sizeof(int16_t);
+    return true;
+  case Type::Int32:
+    col.extract = extract_number<int32_t, Type::Int32>;
+    col.value_size = sizeof(int32_t);
+    return true;
+  case Type::Int64:
+    col.extract = extract_number<int64_t, Type::Int64>;
+    col.value_size = sizeof(int64_t);
+    return true;
+  case Type::Half:
+    col.type = Type::Float;
+    col.extract = extract_float<Half>;
+    col.value_size = sizeof(float);
+    return true;
+  case Type::Fixed16:
+    col.type = Type::Float;
+    col.extract = extract_float<Fixed16>;
+    col.value_size = sizeof(float);
+    return true;
+
+  // Not a single number per message
+  case Type::Record:
+  case Type::String:
+  case Type::Array:
+  case Type::Series:
+    break;
+  }
+  return false;
+}
+
+template <typename T> double as_double(const uint8_t *value) {
+  T v;
+  std::memcpy(&v, value, sizeof(v));
+  return (double)v;
+}
+} // namespace
+
+ChannelColumns::ChannelColumns(PartPtr schema, size_t capacity)
+    : source(std::move(schema)),
+      times_us(new uint64_t[capacity > 0 ? capacity : 1]),
+      max_rows(capacity > 0 ? capacity : 1) {
+  Part *rows_of = source.get();
+  if ((schema_type_byte(rows_of) & ~TYPE_COMPACT_BIT) ==
+      (uint8_t)Type::Series) {
+    series = (Series *)rows_of;
+    rows_of = series->sample().get();
+  }
+  std::vector<Part *> leaves;
+  rows_of->collect_leaves(leaves);
+  for (Part *leaf : leaves) {
+    Column col;
+    if (!column_for(leaf, col)) {
+      continue;
+    }
+    col.name = leaf->name;
+    col.values.reset(new uint8_t[max_rows * col.value_size]);
+    columns.push_back(std::move(col));
+  }
+}
+
+size_t ChannelColumns::find(const std::string &name) const {
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (columns[i].name == name) {
+      return i;
+    }
+  }
+  return columns.size();
+}
+
+double ChannelColumns::value(size_t column, size_t row) const {
+  if (column >= columns.size() || row >= count) {
+    return 0;
+  }
+  const Column &col = columns[column];
+  const uint8_t *v =
+      col.values.get() + ((first_row + row) % max_rows) * col.value_size;
+  switch (col.type) {
+  case Type::Float:
+    return as_double<float>(v);
+  case Type::Double:
+    return as_double<double>(v);
+  case Type::Uint8:
+    return as_double<uint8_t>(v);
+  case Type::Uint16:
+    return as_double<uint16_t>(v);
+  case Type::Uint32:
+    return as_double<uint32_t>(v);
+  case Type::Uint64:
+    return as_double<uint64_t>(v);
+  case Type::Int8:
+    return as_double<int8_t>(v);
+  case Type::Int16:
+    return as_double<int16_t>(v);
+  case Type::Int32:
+    return as_double<int32_t>(v);
+  case Type::Int64:
+    return as_double<int64_t>(v);
+  default:
+    return 0;
+  }
+}
+
+void ChannelColumns::append(uint64_t time_us) {
+  if (series == nullptr) {
+    append_row(time_us);
+    return;
+  }
+  for (size_t i = 0; i < series->size(); i++) {
+    if (series->load(i)) {
+      append_row(series->time_us(i));
+    }
+  }
+}
+
+void ChannelColumns::append_row(uint64_t time_us) {
+  size_t row = first_row + count;
+  if (count == max_rows) {
+    first_row = (first_row + 1) % max_rows;
+    num_overwritten++;
+  } else {
+    count++;
+  }
+  row %= max_rows;
+  times_us[row] = time_us;
+  for (Column &col : columns) {
+    col.extract(col.leaf, col.values.get() + row * col.value_size);
+  }
+}
+
+void ChannelColumns::clear() {
+  first_row = 0;
+  count = 0;
+}
+
+ColumnSink::ColumnSink(size_t capacity) : capacity(capacity) {}
+
+void ColumnSink::append(const Channel &chan) {
+  append(chan, vexSystemHighResTimeGet());
+}
+
+void ColumnSink::append(const Channel &chan, uint64_t time_us) {
+  const ChannelID id = chan.getID();
+  if (chan.data == nullptr) {
+    return;
+  }
+  if (channels.size() <= id) {
+    channels.resize(id + 1);
+  }
+  std::unique_ptr<ChannelColumns> &cols = channels[id];
+  if (cols == nullptr || cols->schema() != chan.data) {
+    // New channel or a new schema for it, the old rows don't fit
+    cols.reset(new ChannelColumns(chan.data, capacity));
+  }
+  cols->append(time_us);
+}
+
+const ChannelColumns *ColumnSink::channel(ChannelID id) const {
+  return id < channels.size() ? channels[id].get() : nullptr;
+}
+
+void ColumnSink::clear() {
+  for (auto &cols : channels) {
+    if (cols != nullptr) {
+      cols->clear();
+    }
+  }
+}
+
+} // namespace VDP
@@ -1,24 +1,127 @@
 #include "vdb/crc32.hpp"
 
-#define FLASH_READ_DWORD(x) (*(const uint32_t *)(x))
+#include <cstddef>
+#include <cstring>
 
-static constexpr uint32_t crc32_table[] = {
-    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
-    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
-    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace {
+// Reflected CRC-32 (IEEE 802.3) polynomial
+constexpr uint32_t crc32_poly = 0xedb88320;
+
+constexpr uint32_t crc_bit(uint32_t c) {
+  return (c & 1) ? ((c >> 1) ^ crc32_poly) : (c >> 1);
+}
+constexpr uint32_t crc_byte(uint32_t c) {
+  return crc_bit(
+      crc_bit(crc_bit(crc_bit(crc_bit(crc_bit(crc_bit(crc_bit(c))))))));
+}
+// Advances a CRC by one zero byte
+constexpr uint32_t crc_zero_byte(uint32_t c) {
+  return (c >> 8) ^ crc_byte(c & 0xff);
+}
+// Entry i of slice k is the CRC of byte i followed by k zero bytes
+constexpr uint32_t slice_entry(size_t k, uint32_t i) {
+  return k == 0 ? crc_byte(i) : crc_zero_byte(slice_entry(k - 1, i));
+}
+
+template <size_t... I> struct index_list {};
+template <size_t N, size_t... I>
+struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+template <size_t... I> struct make_index_list<0, I...> {
+  using type = index_list<I...>;
+};
+
+struct SliceTable {
+  uint32_t entries[256];
+};
+
+template <size_t... I>
+constexpr SliceTable make_slice(size_t k, index_list<I...>) {
+  return SliceTable{{slice_entry(k, (uint32_t)I)...}};
+}
+constexpr SliceTable make_slice(size_t k) {
+  return make_slice(k, make_index_list<256>::type{});
+}
+
+// Slicing-by-8 tables, generated at compile time. One table per slice keeps
+// each constant expression small enough for the V5 toolchain's evaluator.
+constexpr SliceTable slice0 = make_slice(0);
+constexpr SliceTable slice1 = make_slice(1);
+constexpr SliceTable slice2 = make_slice(2);
+constexpr SliceTable slice3 = make_slice(3);
+constexpr SliceTable slice4 = make_slice(4);
+constexpr SliceTable slice5 = make_slice(5);
+constexpr SliceTable slice6 = make_slice(6);
+constexpr SliceTable slice7 = make_slice(7);
+
+static_assert(slice0.entries[1] == 0x77073096, "CRC32 table generation");
+static_assert(slice0.entries[255] == 0x2d02ef8d, "CRC32 table generation");
+
+inline uint32_t update_byte(uint32_t state, uint8_t data) {
+  return (state >> 8) ^ slice0.entries[(state ^ data) & 0xff];
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+// ARMv8 CRC32 instructions use the same polynomial, so they are a drop in
+// replacement for the tables
+uint32_t update_block(uint32_t state, const uint8_t *data, std::size_t size) {
+  while (size >= 4) {
+    uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+    state = __crc32w(state, word);
+    data += 4;
+    size -= 4;
+  }
+  while (size > 0) {
+    state = __crc32b(state, *data);
+    data++;
+    size--;
+  }
+  return state;
+}
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+uint32_t update_block(uint32_t state, const uint8_t *data, std::size_t size) {
+  while (size >= 8) {
+    uint32_t one;
+    uint32_t two;
+    std::memcpy(&one, data, sizeof(one));
+    std::memcpy(&two, data + 4, sizeof(two));
+    one ^= state;
+    state = slice7.entries[one & 0xff] ^ slice6.entries[(one >> 8) & 0xff] ^
+            slice5.entries[(one >> 16) & 0xff] ^ slice4.entries[one >> 24] ^
+            slice3.entries[two & 0xff] ^ slice2.entries[(two >> 8) & 0xff] ^
+            slice1.entries[(two >> 16) & 0xff] ^ slice0.entries[two >> 24];
+    data += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    state = update_byte(state, *data);
+    data++;
+    size--;
+  }
+  return state;
+}
+#else
+uint32_t update_block(uint32_t state, const uint8_t *data, std::size_t size) {
+  for (std::size_t i = 0; i < size; i++) {
+    state = update_byte(state, data[i]);
+  }
+  return state;
+}
+#endif
+} // namespace
 
 CRC32::CRC32() { reset(); }
 
 void CRC32::reset() { _state = ~0L; }
 
-void CRC32::update(const uint8_t &data) {
-  // via http://forum.arduino.cc/index.php?topic=91179.0
-  uint8_t tbl_idx = 0;
+void CRC32::update(const uint8_t &data) { _state = update_byte(_state, data); }
 
-  tbl_idx = _state ^ (data >> (0 * 4));
-  _state = FLASH_READ_DWORD(crc32_table + (tbl_idx & 0x0f)) ^ (_state >> 4);
-  tbl_idx = _state ^ (data >> (1 * 4));
-  _state = FLASH_READ_DWORD(crc32_table + (tbl_idx & 0x0f)) ^ (_state >> 4);
+void CRC32::update(const uint8_t *data, std::size_t size) {
+  _state = update_block(_state, data, size);
 }
 
-uint32_t CRC32::finalize() const { return ~_state; }
\ No newline at end of file
+uint32_t CRC32::finalize() const { return ~_state; }
@@ -0,0 +1,113 @@
+#include "vdb/delta.hpp"
+
+#include <cstring>
+
+namespace VDP {
+
+DeltaEncoder::DeltaEncoder(uint16_t keyframe_interval)
+    : keyframe_interval(keyframe_interval) {}
+
+void DeltaEncoder::force_keyframe() { need_keyframe = true; }
+
+void DeltaEncoder::tree_changed() {
+  leaves_of = nullptr;
+  need_keyframe = true;
+}
+
+void DeltaEncoder::count_sent(size_t bytes) { stat.sent_bytes += bytes; }
+
+const DeltaEncoder::Stats &DeltaEncoder::stats() const { return stat; }
+
+void DeltaEncoder::encode_fields(const Channel &chan) {
+  if (leaves_of != chan.data.get()) {
+    // New schema object, the previous values mean nothing for it
+    leaves.clear();
+    chan.data->collect_leaves(leaves);
+    leaves_of = chan.data.get();
+    need_keyframe = true;
+  }
+
+  current.clear();
+  current_offsets.clear();
+  PacketWriter fields{current};
+  for (const Part *leaf : leaves) {
+    current_offsets.push_back((uint32_t)current.size());
+    leaf->write_message(fields);
+  }
+  current_offsets.push_back((uint32_t)current.size());
+}
+
+DeltaEncoder::Result DeltaEncoder::write_message(PacketWriter &writer,
+                                                 const Channel &chan) {
+  encode_fields(chan);
+
+  // header + channel id + fields + checksum
+  const size_t full_size = 2 + current.size() + 4;
+  stat.full_bytes += full_size;
+
+  since_keyframe++;
+  if (need_keyframe || since_keyframe >= keyframe_interval) {
+    writer.clear();
+    writer.write_data_header(chan, 0);
+    writer.write_bytes(current.data(), current.size());
+    writer.write_number<uint32_t>(CRC32::calculate(
+        writer.get_packet().data(), writer.get_packet().size()));
+
+    need_keyframe = false;
+    since_keyframe = 0;
+    stat.keyframes++;
+    std::swap(previous, current);
+    std::swap(previous_offsets, current_offsets);
+    return Result::Keyframe;
+  }
+
+  bitmap.assign((leaves.size() + 7) / 8, 0);
+  bool any_changed = false;
+  for (size_t i = 0; i < leaves.size(); i++) {
+    const uint32_t len = current_offsets[i + 1] - current_offsets[i];
+    const uint32_t prev_len = previous_offsets[i + 1] - previous_offsets[i];
+    if (len != prev_len ||
+        std::memcmp(&current[current_offsets[i]],
+                    &previous[previous_offsets[i]], len) != 0) {
+      bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+      any_changed = true;
+    }
+  }
+  if (!any_changed) {
+    stat.skipped++;
+    return Result::Unchanged;
+  }
+
+  writer.clear();
+  writer.write_data_header(chan, PacketFlags::Delta);
+  for (size_t i = 0; i < leaves.size(); i++) {
+    if (i % 8 == 0) {
+      writer.write_byte(bitmap[i / 8]);
+    }
+    if (bitmap[i / 8] & (1 << (i % 8))) {
+      writer.write_bytes(&current[current_offsets[i]],
+                         current_offsets[i + 1] - current_offsets[i]);
+    }
+  }
+  writer.write_number<uint32_t>(CRC32::calculate(writer.get_packet().data(),
+                                                 writer.get_packet().size()));
+
+  stat.deltas++;
+  std::swap(previous, current);
+  std::swap(previous_offsets, current_offsets);
+  return Result::Delta;
+}
+
+void apply_delta(PacketReader &reader, const std::vector<Part *> &leaves) {
+  uint8_t bits = 0;
+  for (size_t i = 0; i < leaves.size(); i++) {
+    if (i % 8 == 0) {
+      bits = reader.get_byte();
+    }
+    if (bits & (1 << (i % 8))) {
+      leaves[i]->read_data_from_message(reader);
+    }
+  }
+}
+
+} // namespace VDP
@@ -0,0 +1,105 @@
+#include "vdb/layout.hpp"
+
+#include <cstring>
+
+namespace VDP {
+
+std::atomic<uint32_t> LayoutPlan::shape_epoch{0};
+
+void LayoutPlan::shape_changed() { shape_epoch++; }
+
+LayoutPlan::LayoutPlan(PartPtr root)
+    : root_part(std::move(root)), epoch(shape_epoch.load()) {
+  root_part->plan_layout(*this);
+
+  block.reset(new uint8_t[block_size > 0 ? block_size : 1]);
+  for (const Binding &b : bindings) {
+    std::memcpy(&block[b.offset], b.slot->data, b.size);
+    b.slot->data = &block[b.offset];
+  }
+}
+
+LayoutPlan::~LayoutPlan() {
+  for (const Binding &b : bindings) {
+    std::memcpy(b.slot->home, b.slot->data, b.size);
+    b.slot->data = b.slot->home;
+    b.slot->bound_to = nullptr;
+  }
+}
+
+void LayoutPlan::hold(PartPtr part) { held.push_back(std::move(part)); }
+
+void LayoutPlan::add_fixed(FieldSlot &slot, size_t size) {
+  if (slot.bound_to != nullptr) {
+    steps.push_back(Step{StepKind::Slot, 0, (uint32_t)size, &slot});
+    return;
+  }
+  slot.bound_to = this;
+  bindings.push_back(Binding{&slot, block_size, (uint32_t)size});
+
+  Step *last = steps.empty() ? nullptr : &steps.back();
+  if (last != nullptr && last->kind == StepKind::Block &&
+      last->offset + last->size == block_size) {
+    last->size += size;
+  } else {
+    steps.push_back(Step{StepKind::Block, block_size, (uint32_t)size, nullptr});
+  }
+  block_size += size;
+}
+
+void LayoutPlan::add_string(std::string &value) {
+  fixed = false;
+  steps.push_back(Step{StepKind::String, 0, 0, &value});
+}
+
+void LayoutPlan::add_part(Part &part) {
+  fixed = false;
+  steps.push_back(Step{StepKind::Part, 0, 0, &part});
+}
+
+void LayoutPlan::write(PacketWriter &writer) const {
+  for (const Step &step : steps) {
+    switch (step.kind) {
+    case StepKind::Block:
+      writer.write_bytes(&block[step.offset], step.size);
+      break;
+    case StepKind::Slot:
+      writer.write_bytes(((FieldSlot *)step.target)->data, step.size);
+      break;
+    case StepKind::String:
+      writer.write_string(*(std::string *)step.target);
+      break;
+    case StepKind::Part:
+      ((Part *)step.target)->write_message(writer);
+      break;
+    }
+  }
+}
+
+bool LayoutPlan::read(PacketReader &reader) const {
+  for (const Step &step : steps) {
+    switch (step.kind) {
+    case StepKind::Block:
+      if (!reader.get_bytes(&block[step.offset], step.size)) {
+        return false;
+      }
+      break;
+    case StepKind::Slot:
+      if (!reader.get_bytes(((FieldSlot *)step.target)->data, step.size)) {
+        return false;
+      }
+      break;
+    case StepKind::String:
+      if (!reader.get_string(*(std::string *)step.target)) {
+        return false;
+      }
+      break;
+    case StepKind::Part:
+      ((Part *)step.target)->read_data_from_message(reader);
+      break;
+    }
+  }
+  return reader.ok();
+}
+
+} // namespace VDP
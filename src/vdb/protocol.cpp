@@ -9,6 +9,11 @@
 #include <utility>
 #include <vector>
 
+#include "vdb/arena.hpp"
+#include "vdb/array.hpp"
+#include "vdb/layout.hpp"
+#include "vdb/sequence.hpp"
+#include "vdb/series.hpp"
 #include "vdb/types.hpp"
 
 namespace VDP {
@@ -36,14 +41,43 @@ std::string Part::pretty_print_data() const {
   return ss.str();
 }
 
-PacketReader::PacketReader(Packet pac) : pac(std::move(pac)), read_head(0) {}
-PacketReader::PacketReader(Packet pac, size_t offset)
-    : pac(std::move(pac)), read_head(offset) {}
+PacketReader::PacketReader(const uint8_t *data, size_t size, size_t start)
+    : data(data), size(size), read_head(start), stat(ReadStatus::Ok) {
+  if (start > size) {
+    read_head = size;
+    stat = ReadStatus::PastEnd;
+  }
+}
+PacketReader::PacketReader(const Packet &pac, size_t start)
+    : PacketReader(pac.data(), pac.size(), start) {}
+
+void PacketReader::fail(ReadStatus why) {
+  if (stat == ReadStatus::Ok) {
+    stat = why;
+  }
+}
 
 uint8_t PacketReader::get_byte() {
-  const uint8_t b = pac[read_head];
-  read_head++;
-  return b;
+  if (!take(1)) {
+    return 0;
+  }
+  return data[read_head - 1];
+}
+
+bool PacketReader::get_bytes(uint8_t *out, size_t len) {
+  const uint8_t *from = get_view(len);
+  if (from == nullptr) {
+    return false;
+  }
+  std::memcpy(out, from, len);
+  return true;
+}
+
+const uint8_t *PacketReader::get_view(size_t len) {
+  if (!take(len)) {
+    return nullptr;
+  }
+  return data + read_head - len;
 }
 
 Type PacketReader::get_type() {
@@ -53,20 +87,34 @@ Type PacketReader::get_type() {
 
 std::string PacketReader::get_string() {
   std::string s;
+  get_string(s);
+  return s;
+}
 
-  while (1) {
-    const uint8_t c = get_byte();
-    if (c == 0) {
-      break;
-    }
-    s.push_back((char)c);
+bool PacketReader::get_string(std::string &out) {
+  out.clear();
+  if (stat != ReadStatus::Ok) {
+    return false;
   }
-  return s;
+  const uint8_t *start = data + read_head;
+  const uint8_t *end = (const uint8_t *)std::memchr(start, 0, remaining());
+  if (end == nullptr) {
+    fail(ReadStatus::Unterminated);
+    return false;
+  }
+  out.assign((const char *)start, (size_t)(end - start));
+  read_head += (size_t)(end - start) + 1;
+  return true;
 }
 PacketWriter::PacketWriter(VDP::Packet &scratch) : sofar(scratch) {}
 void PacketWriter::write_byte(uint8_t b) { sofar.push_back(b); }
+void PacketWriter::write_bytes(const uint8_t *data, size_t len) {
+  sofar.insert(sofar.end(), data, data + len);
+}
 
-void PacketWriter::write_type(Type t) { write_byte((uint8_t)t); }
+void PacketWriter::write_type(Type t, bool compact) {
+  write_byte((uint8_t)t | (compact ? TYPE_COMPACT_BIT : 0));
+}
 void PacketWriter::write_string(const std::string &str) {
   sofar.insert(sofar.end(), str.begin(), str.end());
   sofar.push_back(0);
@@ -80,7 +128,7 @@ void PacketWriter::write_channel_acknowledge(const Channel &chan) {
   clear();
 
   const uint8_t header = make_header_byte(
-      PacketHeader{PacketType::Broadcast, PacketFunction::Acknowledge});
+      PacketHeader{PacketType::Broadcast, PacketFunction::Acknowledge, 0});
 
   // Header
   write_number<uint8_t>(header);
@@ -93,7 +141,7 @@ void PacketWriter::write_channel_acknowledge(const Channel &chan) {
 void PacketWriter::write_channel_broadcast(const Channel &chan) {
   clear();
   const uint8_t header = make_header_byte(
-      PacketHeader{PacketType::Broadcast, PacketFunction::Send});
+      PacketHeader{PacketType::Broadcast, PacketFunction::Send, 0});
   // Header
   write_number<uint8_t>(header);
   write_number<ChannelID>(chan.getID());
@@ -106,22 +154,100 @@ void PacketWriter::write_channel_broadcast(const Channel &chan) {
 
   write_number<uint32_t>(crc);
 }
-void PacketWriter::write_data_message(const Channel &chan) {
+void PacketWriter::write_schema_offer(const Channel &chan,
+                                      uint32_t fingerprint) {
   clear();
-  const uint8_t header =
-      make_header_byte(PacketHeader{PacketType::Data, PacketFunction::Send});
+  const uint8_t header = make_header_byte(
+      PacketHeader{PacketType::Offer, PacketFunction::Send, 0});
+  write_number<uint8_t>(header);
+  write_number<ChannelID>(chan.getID());
+  write_number<uint32_t>(fingerprint);
 
-  // Header
+  uint32_t crc = CRC32::calculate(sofar.data(), sofar.size());
+  write_number<uint32_t>(crc);
+}
+void PacketWriter::write_schema_request(const Channel &chan) {
+  clear();
+  const uint8_t header = make_header_byte(
+      PacketHeader{PacketType::Offer, PacketFunction::Acknowledge, 0});
   write_number<uint8_t>(header);
   write_number<ChannelID>(chan.getID());
 
+  uint32_t crc = CRC32::calculate(sofar.data(), sofar.size());
+  write_number<uint32_t>(crc);
+}
+void PacketWriter::write_data_header(const Channel &chan, uint8_t flags) {
+  if (chan.seq_tx != nullptr) {
+    flags |= PacketFlags::Sequenced;
+    if (chan.seq_tx->reliable()) {
+      flags |= PacketFlags::Reliable;
+    }
+  }
+  write_number<uint8_t>(make_header_byte(
+      PacketHeader{PacketType::Data, PacketFunction::Send, flags}));
+  write_number<ChannelID>(chan.getID());
+  if (chan.seq_tx != nullptr) {
+    write_number<uint16_t>(chan.seq_tx->next());
+  }
+}
+
+void PacketWriter::write_nack(const Channel &chan, const uint16_t *seqs,
+                              uint8_t count) {
+  clear();
+  const uint8_t header = make_header_byte(
+      PacketHeader{PacketType::Data, PacketFunction::Acknowledge, 0});
+  write_number<uint8_t>(header);
+  write_number<ChannelID>(chan.getID());
+  write_number<uint8_t>(count);
+  for (uint8_t i = 0; i < count; i++) {
+    write_number<uint16_t>(seqs[i]);
+  }
+
+  uint32_t crc = CRC32::calculate(sofar.data(), sofar.size());
+  write_number<uint32_t>(crc);
+}
+
+void PacketWriter::write_data_message(const Channel &chan) {
+  clear();
+  // Header
+  write_data_header(chan, 0);
+
   // Data
-  chan.data->write_message(*this);
+  if (chan.layout != nullptr && chan.layout->root() == chan.data.get()) {
+    chan.layout->write(*this);
+  } else {
+    chan.data->write_message(*this);
+  }
   // Checksum
   uint32_t crc = CRC32::calculate(sofar.data(), sofar.size());
   write_number<uint32_t>(crc);
 }
 
+void PacketWriter::start_batch() {
+  clear();
+  const uint8_t header = make_header_byte(
+      PacketHeader{PacketType::Batch, PacketFunction::Send, 0});
+  write_number<uint8_t>(header);
+  write_number<uint8_t>(0); // Number of entries
+}
+bool PacketWriter::append_batch_entry(const Packet &message, size_t max_size) {
+  // Entries are the message without its checksum
+  const size_t length = message.size() - sizeof(uint32_t);
+  if (batch_entries() == UINT8_MAX ||
+      sofar.size() + sizeof(uint16_t) + length + sizeof(uint32_t) > max_size) {
+    return false;
+  }
+  write_number<uint16_t>((uint16_t)length);
+  write_bytes(message.data(), length);
+  sofar[1]++;
+  return true;
+}
+uint8_t PacketWriter::batch_entries() const { return sofar[1]; }
+void PacketWriter::finish_batch() {
+  uint32_t crc = CRC32::calculate(sofar.data(), sofar.size());
+  write_number<uint32_t>(crc);
+}
+
 std::string to_string(Type t) {
   switch (t) {
   case Type::Record:
@@ -151,6 +277,15 @@ std::string to_string(Type t) {
     return "int32";
   case Type::Int64:
     return "int64";
+
+  case Type::Half:
+    return "half";
+  case Type::Fixed16:
+    return "fixed16";
+  case Type::Array:
+    return "array";
+  case Type::Series:
+    return "series";
   }
 
   return "<<UNKNOWN TYPE>>";
@@ -161,39 +296,83 @@ void add_indents(std::stringstream &ss, size_t indent) {
   }
 }
 
-PartPtr make_decoder(PacketReader &pac) {
-  const Type t = pac.get_type();
-  const std::string name = pac.get_string();
+template <typename Integer>
+static PartPtr make_integer(std::string name, bool compact,
+                            SchemaArena *arena) {
+  PartPtr part = make_node<Integer>(arena, std::move(name));
+  part->use_compact_integers(compact);
+  return part;
+}
+
+PartPtr make_decoder(PacketReader &pac, SchemaArena *arena) {
+  const uint8_t type_byte = pac.get_byte();
+  const bool compact = (type_byte & TYPE_COMPACT_BIT) != 0;
+  const Type t = (Type)(type_byte & ~TYPE_COMPACT_BIT);
+  std::string name = pac.get_string();
+  if (!pac.ok()) {
+    return nullptr;
+  }
 
   switch (t) {
-  case Type::String:
-    return PartPtr(new String(name));
   case Type::Record:
-    return PartPtr(new Record(name, pac));
-
-  case Type::Float:
-    return PartPtr(new Float(name));
-  case Type::Double:
-    return PartPtr(new Double(name));
+    return make_node<Record>(arena, std::move(name), pac, compact, arena);
 
   case Type::Uint8:
-    return PartPtr(new Uint8(name));
+    return make_integer<Uint8>(std::move(name), compact, arena);
   case Type::Uint16:
-    return PartPtr(new Uint16(name));
+    return make_integer<Uint16>(std::move(name), compact, arena);
   case Type::Uint32:
-    return PartPtr(new Uint32(name));
+    return make_integer<Uint32>(std::move(name), compact, arena);
   case Type::Uint64:
-    return PartPtr(new Uint64(name));
+    return make_integer<Uint64>(std::move(name), compact, arena);
 
   case Type::Int8:
-    return PartPtr(new Int8(name));
+    return make_integer<Int8>(std::move(name), compact, arena);
   case Type::Int16:
-    return PartPtr(new Int16(name));
+    return make_integer<Int16>(std::move(name), compact, arena);
   case Type::Int32:
-    return PartPtr(new Int32(name));
+    return make_integer<Int32>(std::move(name), compact, arena);
   case Type::Int64:
-    return PartPtr(new Int64(name));
+    return make_integer<Int64>(std::move(name), compact, arena);
+
+  // No compact form for these
+  case Type::String:
+    if (!compact) {
+      return make_node<String>(arena, std::move(name));
+    }
+    break;
+  case Type::Float:
+    if (!compact) {
+      return make_node<Float>(arena, std::move(name));
+    }
+    break;
+  case Type::Double:
+    if (!compact) {
+      return make_node<Double>(arena, std::move(name));
+    }
+    break;
+  case Type::Half:
+    if (!compact) {
+      return make_node<Half>(arena, std::move(name));
+    }
+    break;
+  case Type::Fixed16:
+    if (!compact) {
+      return make_node<Fixed16>(arena, std::move(name), pac);
+    }
+    break;
+  case Type::Array:
+    if (!compact) {
+      return make_array_decoder(std::move(name), pac, arena);
+    }
+    break;
+  case Type::Series:
+    if (!compact) {
+      return make_node<Series>(arena, std::move(name), pac, arena);
+    }
+    break;
   }
+  pac.fail(ReadStatus::BadSchema);
   return nullptr;
 }
 std::pair<ChannelID, PartPtr> decode_broadcast(const Packet &packet) {
@@ -202,13 +381,28 @@ std::pair<ChannelID, PartPtr> decode_broadcast(const Packet &packet) {
   // header byte, had to be read to know were a braodcast
   (void)reader.get_byte();
   const ChannelID id = reader.get_number<ChannelID>();
-  const PartPtr schema = make_decoder(reader);
-  return {id, schema};
+  return {id, decode_schema(reader)};
+}
+PartPtr decode_schema(PacketReader &reader) {
+  // A part with a typical name is around 10 bytes of schema and 130 of
+  // memory, so most trees fit in the first chunk or two
+  auto arena = std::make_shared<SchemaArena>(reader.remaining() * 16);
+  const PartPtr root = make_decoder(reader, arena.get());
+  if (!reader.ok() || root == nullptr) {
+    return nullptr;
+  }
+  // Owns the arena and with it the whole tree
+  return PartPtr(arena, root.get());
 }
 Part::Part(std::string name) : name(std::move(name)) {}
 
 ChannelID Channel::getID() const { return id; }
 
 Part::~Part() {}
+void Part::collect_leaves(std::vector<Part *> &out) { out.push_back(this); }
+void Part::plan_layout(LayoutPlan &plan) { plan.add_part(*this); }
+void Part::use_compact_integers(bool) {}
+
+bool Part::supports_delta() const { return true; }
 AbstractDevice::~AbstractDevice() {}
 } // namespace VDP
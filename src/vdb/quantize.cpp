@@ -0,0 +1,32 @@
+#include "vdb/quantize.hpp"
+
+namespace VDP {
+
+void floats_to_halves(const float *in, uint16_t *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = float_to_half(in[i]);
+  }
+}
+
+void halves_to_floats(const uint16_t *in, float *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = half_to_float(in[i]);
+  }
+}
+
+void quantize_fixed16(const float *in, int16_t *out, size_t count, float scale,
+                      float offset) {
+  const float inv_scale = 1.0f / scale;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = quantize_fixed16(in[i], inv_scale, offset);
+  }
+}
+
+void dequantize_fixed16(const int16_t *in, float *out, size_t count,
+                        float scale, float offset) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = dequantize_fixed16(in[i], scale, offset);
+  }
+}
+
+} // namespace VDP
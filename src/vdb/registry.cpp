@@ -1,12 +1,25 @@
 #include "vdb/registry.hpp"
+#include "vdb/delta.hpp"
+#include "vdb/layout.hpp"
+
+#include "metrics.hpp"
+
+#include <algorithm>
 
 namespace VDP {
 Registry::Registry(AbstractDevice *device, Side reg_type)
-    : reg_type(reg_type), device(device) {
-  device->register_receive_callback([&](const Packet &p) {
-    printf("GOT PACKET\n");
-    take_packet(p);
-  });
+    : reg_type(reg_type), device(device),
+      schema_cache(std::make_shared<SchemaCache>()) {
+  device->register_receive_callback([&](const Packet &p) { take_packet(p); });
+}
+
+void Registry::share_schema_cache(std::shared_ptr<SchemaCache> cache) {
+  const TaskMutex::Scope hold{mut};
+  schema_cache = std::move(cache);
+}
+std::shared_ptr<SchemaCache> Registry::get_schema_cache() {
+  const TaskMutex::Scope hold{mut};
+  return schema_cache;
 }
 
 const char *Registry::identifier() {
@@ -14,10 +27,12 @@ const char *Registry::identifier() {
 }
 
 void Registry::install_broadcast_callback(CallbackFn on_broadcastf) {
+  const TaskMutex::Scope hold{mut};
   VDPTracef("%s: Installed broadcast callback for ", identifier());
   this->on_broadcast = std::move(on_broadcastf);
 }
 void Registry::install_data_callback(CallbackFn on_dataf) {
+  const TaskMutex::Scope hold{mut};
   VDPTracef("%s: Installed data callback for ", identifier());
   this->on_data = std::move(on_dataf);
 }
@@ -32,7 +47,11 @@ static VDP::PacketValidity validate_packet(const VDP::Packet &packet) {
     return VDP::PacketValidity::TooSmall;
   }
 
-  uint32_t checksum = CRC32::calculate(packet.data(), packet.size() - 4);
+  uint32_t checksum = 0;
+  {
+    const Metrics::Timer timer{Metrics::Timing::CRC};
+    checksum = CRC32::calculate(packet.data(), packet.size() - 4);
+  }
 
   auto size = packet.size();
   const uint32_t written_checksum =
@@ -40,14 +59,15 @@ static VDP::PacketValidity validate_packet(const VDP::Packet &packet) {
       (uint32_t(packet[size - 3]) << 8) | uint32_t(packet[size - 4]);
 
   if (checksum != written_checksum) {
-    VDPWarnf("Checksums do not match: expected: %08lx, got: %08lx", checksum,
-             written_checksum);
+    VDPWarnf("Checksums do not match: expected: %08lx, got: %08lx",
+             (unsigned long)checksum, (unsigned long)written_checksum);
     return VDP::PacketValidity::BadChecksum;
   }
   return VDP::PacketValidity::Ok;
 }
 
 PartPtr Registry::get_remote_schema(ChannelID id) {
+  const TaskMutex::Scope hold{mut};
   if (id >= remote_channels.size()) {
     return nullptr;
   }
@@ -55,6 +75,7 @@ PartPtr Registry::get_remote_schema(ChannelID id) {
 }
 
 void Registry::take_packet(const Packet &pac) {
+  const TaskMutex::Scope hold{mut};
   VDPTracef("Received packet of size %d", (int)pac.size());
 
   const VDP::PacketValidity status = validate_packet(pac);
@@ -62,9 +83,11 @@ void Registry::take_packet(const Packet &pac) {
   if (status == VDP::PacketValidity::BadChecksum) {
     VDPWarnf("%s: Bad packet checksum. Skipping", identifier());
     num_bad++;
+    Metrics::instance().count_drop(Metrics::Drop::BadChecksum);
     return;
   } else if (status == VDP::PacketValidity::TooSmall) {
     num_small++;
+    Metrics::instance().count_drop(Metrics::Drop::TooSmall);
     VDPWarnf("%s: Packet too small to be valid (%d bytes). Skipping",
              identifier(), (int)pac.size());
     dump_packet(pac);
@@ -82,34 +105,40 @@ void Registry::take_packet(const Packet &pac) {
     if (header.type == VDP::PacketType::Broadcast) {
       VDPTracef("%s: PacketType Broadcast", identifier());
       auto decoded = VDP::decode_broadcast(pac);
-
-      VDP::Channel chan{decoded.second, decoded.first};
-
-      if (remote_channels.size() < chan.id) {
-        VDPWarnf("%s: Out of order broadcast. dropping", identifier());
+      if (decoded.second == nullptr) {
+        VDPWarnf("%s: Could not decode broadcast. dropping", identifier());
         return;
       }
-      remote_channels.push_back(chan);
-      VDPTracef("%s: Got broadcast of channel %d", identifier(), int(chan.id));
-      on_broadcast(chan);
-
-      Packet scratch;
-      PacketWriter writer{scratch};
-      writer.write_channel_acknowledge(chan);
-      device->send_packet(writer.get_packet());
-
-    } else if (header.type == VDP::PacketType::Data) {
-      VDPTracef("%s: PacketType Data", identifier());
-      const ChannelID id = pac[1];
-      const PartPtr part = get_remote_schema(id);
-      if (part == nullptr) {
-        VDPDebugf("VDB-%s: No channel information for id: %d", identifier(),
-                  id);
+      // header + id before the schema, checksum after
+      schema_cache->insert(schema_fingerprint(&pac[2], pac.size() - 6),
+                           &pac[2], pac.size() - 6, decoded.second,
+                           decoded.first, this);
+      VDPTracef("%s: Got broadcast of channel %d", identifier(),
+                int(decoded.first));
+      install_remote_channel(decoded.first, decoded.second);
+    } else if (header.type == VDP::PacketType::Offer) {
+      PacketReader reader{pac, 1};
+      const ChannelID id = reader.get_number<ChannelID>();
+      const uint32_t fingerprint = reader.get_number<uint32_t>();
+      const PartPtr schema = schema_cache->lookup(fingerprint, id, this);
+      if (schema == nullptr) {
+        VDPTracef("%s: Schema for channel %d not cached, asking for it",
+                  identifier(), (int)id);
+        PacketWriter writer{reply_packet};
+        writer.write_schema_request(Channel{nullptr, id});
+        device->send_packet(writer.get_packet());
         return;
       }
-      PacketReader reader{pac, 2};
-      part->read_data_from_message(reader);
-      on_data(Channel{part, id});
+      VDPTracef("%s: Schema for channel %d was cached", identifier(),
+                (int)id);
+      install_remote_channel(id, schema);
+    } else if (header.type == VDP::PacketType::Data) {
+      VDPTracef("%s: PacketType Data", identifier());
+      // Checksum left out
+      receive_data(pac.data(), pac.size() - 4);
+    } else if (header.type == VDP::PacketType::Batch) {
+      VDPTracef("%s: PacketType Batch", identifier());
+      receive_batch(pac);
     }
   } else if (header.func == VDP::PacketFunction::Acknowledge) {
     PacketReader reader(pac);
@@ -119,106 +148,555 @@ void Registry::take_packet(const Packet &pac) {
     if (id >= my_channels.size()) {
       printf("VDB-%s: Recieved ack for unknown channel %d",
              (reg_type == Side::Controller ? "Controller" : "Listener"), id);
+      return;
+    }
+    if (header.type == VDP::PacketType::Data) {
+      receive_nack(pac);
+      return;
+    }
+    if (header.type == VDP::PacketType::Offer) {
+      // The listener didn't have the schema we offered
+      Channel &chan = my_channels[id];
+      if (!chan.acked) {
+        PacketWriter writer{reply_packet};
+        writer.write_channel_broadcast(chan);
+        device->send_packet(writer.get_packet());
+        chan.last_broadcast_ms = VDB::time_ms();
+      }
+      return;
     }
     my_channels[id].acked = true;
   }
 }
 
-bool Registry::negotiate() {
+void Registry::install_remote_channel(ChannelID id, PartPtr schema) {
+  // Broadcasts can arrive in any order and more than once if an ack got
+  // lost, so channels are stored by id with gaps until they show up
+  if (remote_channels.size() <= id) {
+    remote_channels.reserve(id + 1);
+    while (remote_channels.size() <= id) {
+      remote_channels.push_back(
+          Channel{nullptr, (ChannelID)remote_channels.size()});
+    }
+  }
+  // Let go of the old plan first so a reused tree gets bound to the new one
+  remote_channels[id] = Channel{nullptr, id};
+
+  Channel &chan = remote_channels[id];
+  chan.data = std::move(schema);
+  chan.data->collect_leaves(chan.leaves);
+  chan.layout = std::make_shared<LayoutPlan>(chan.data);
+  on_broadcast(chan);
+
+  PacketWriter writer{reply_packet};
+  writer.write_channel_acknowledge(chan);
+  device->send_packet(writer.get_packet());
+}
+
+void Registry::receive_data(const uint8_t *message, size_t len) {
+  const VDP::PacketHeader header = VDP::decode_header_byte(message[0]);
+  const ChannelID id = message[1];
+  Metrics &metrics = Metrics::instance();
+  if (id >= remote_channels.size() || remote_channels[id].data == nullptr) {
+    VDPDebugf("VDB-%s: No channel information for id: %d", identifier(), id);
+    metrics.count_drop(Metrics::Drop::UnknownChannel);
+    return;
+  }
+  metrics.count_channel(Metrics::Direction::Received, id, len);
+  Channel &chan = remote_channels[id];
+  PacketReader reader{message, len, 2};
+  using Verdict = SequenceReceiver::Verdict;
+  const Verdict verdict =
+      (header.flags & PacketFlags::Sequenced)
+          ? check_sequence(chan, header.flags, reader.get_number<uint16_t>())
+          : Verdict::Deliver;
+  if (verdict == Verdict::Drop) {
+    return;
+  }
+  if (verdict == Verdict::Late) {
+    receive_late(chan, header, reader);
+    return;
+  }
+  if (header.flags & PacketFlags::Delta) {
+    if (!chan.have_keyframe) {
+      VDPDebugf("%s: Delta for channel %d before any keyframe. dropping",
+                identifier(), (int)id);
+      metrics.count_drop(Metrics::Drop::NoKeyframe);
+      return;
+    }
+    apply_delta(reader, chan.leaves);
+  } else if (chan.layout != nullptr) {
+    chan.layout->read(reader);
+  } else {
+    chan.data->read_data_from_message(reader);
+  }
+  if (!reader.ok()) {
+    VDPWarnf("%s: Data for channel %d doesn't match its schema (%d)",
+             identifier(), (int)id, (int)reader.status());
+    metrics.count_drop(Metrics::Drop::BadData);
+    // Some fields may have been overwritten, wait for the next full message
+    chan.have_keyframe = false;
+    return;
+  }
+  if (!(header.flags & PacketFlags::Delta)) {
+    chan.have_keyframe = true;
+  }
+  on_data(chan);
+}
+
+void Registry::receive_late(Channel &chan, PacketHeader header,
+                            PacketReader &reader) {
+  if (header.flags & PacketFlags::Delta) {
+    // Its base is long gone. Senders answer NACKs of deltas with a keyframe
+    // instead, so only a link that reorders gets here
+    Metrics::instance().count_drop(Metrics::Drop::NoKeyframe);
+    return;
+  }
+  // Newer values are already in the tree. Keep them to put back once the
+  // callback has seen the old ones
+  PacketWriter snapshot{late_restore};
+  snapshot.clear();
+  chan.layout->write(snapshot);
+  chan.layout->read(reader);
+  if (reader.ok()) {
+    chan.late = true;
+    on_data(chan);
+    chan.late = false;
+  } else {
+    VDPWarnf("%s: Late data for channel %d doesn't match its schema (%d)",
+             identifier(), (int)chan.id, (int)reader.status());
+    Metrics::instance().count_drop(Metrics::Drop::BadData);
+  }
+  PacketReader restore{late_restore, 0};
+  chan.layout->read(restore);
+}
+
+SequenceReceiver::Verdict Registry::check_sequence(Channel &chan,
+                                                   uint8_t flags,
+                                                   uint16_t seq) {
+  if (chan.seq_rx == nullptr) {
+    chan.seq_rx = std::make_shared<SequenceReceiver>();
+  }
+  const bool reliable = (flags & PacketFlags::Reliable) != 0;
+  bool gap = false;
+  const SequenceReceiver::Verdict verdict =
+      chan.seq_rx->accept(seq, reliable, gap);
+  if (gap) {
+    VDPDebugf("%s: Channel %d skipped to sequence %d", identifier(),
+              (int)chan.id, (int)seq);
+    // Deltas after a lost message would be applied to the wrong values
+    chan.have_keyframe = false;
+  }
+  if (reliable) {
+    send_due_nacks(chan);
+  }
+  if (verdict == SequenceReceiver::Verdict::Drop) {
+    Metrics::instance().count_drop(Metrics::Drop::Duplicate);
+  }
+  return verdict;
+}
+
+void Registry::send_due_nacks(Channel &chan) {
+  uint16_t nacks[SequenceReceiver::MAX_MISSING];
+  const size_t count = chan.seq_rx->due_nacks(VDB::time_ms(), nacks,
+                                              SequenceReceiver::MAX_MISSING);
+  if (count > 0) {
+    PacketWriter writer{reply_packet};
+    writer.write_nack(chan, nacks, (uint8_t)count);
+    device->send_packet(writer.get_packet());
+  }
+}
+
+void Registry::receive_nack(const Packet &pac) {
+  PacketReader reader{pac.data(), pac.size() - 4, 1};
+  const ChannelID id = reader.get_number<ChannelID>();
+  const uint8_t count = reader.get_byte();
+  if (!reader.ok() || id >= my_channels.size() ||
+      my_channels[id].seq_tx == nullptr) {
+    return;
+  }
+  Channel &chan = my_channels[id];
+  SequenceSender &tx = *chan.seq_tx;
+  for (uint8_t i = 0; i < count; i++) {
+    const uint16_t seq = reader.get_number<uint16_t>();
+    if (!reader.ok()) {
+      return;
+    }
+    tx.stats().nacked++;
+    if (chan.delta != nullptr) {
+      // An old delta can't be applied after newer ones, the listener needs a
+      // fresh keyframe instead
+      chan.delta->force_keyframe();
+      continue;
+    }
+    const Packet *message = tx.find(seq);
+    if (message == nullptr) {
+      tx.stats().expired++;
+      continue;
+    }
+    if (device->send_packet(*message)) {
+      tx.stats().retransmits++;
+    }
+  }
+}
+
+void Registry::receive_batch(const Packet &pac) {
+  // header byte + entry count, entries, checksum
+  PacketReader reader{pac.data(), pac.size() - 4, 1};
+  const uint8_t count = reader.get_byte();
+  for (uint8_t i = 0; i < count; i++) {
+    const uint16_t length = reader.get_number<uint16_t>();
+    // Every entry is at least a header and channel id
+    const uint8_t *entry = length < 2 ? nullptr : reader.get_view(length);
+    if (entry == nullptr) {
+      VDPWarnf("%s: Bad length for batch entry %d of %d", identifier(), (int)i,
+               (int)count);
+      return;
+    }
+    receive_data(entry, length);
+  }
+}
+
+void Registry::start_negotiation() {
+  const TaskMutex::Scope hold{mut};
   if (reg_type != Side::Controller) {
-    return false;
+    return;
   }
-  printf("Negotiating\n");
-  bool acked_all = true;
-  int failed_acks = 0;
-
-  size_t broadcast_tries_per = 3;
-
-  for (size_t i = 0; i < my_channels.size(); i++) {
-    for (size_t j = 0; j < broadcast_tries_per; j++) {
-      VDPDebugf("%s: Negotiating chan id %d", identifier(), i);
-
-      const Channel &chan = my_channels[i];
-      Packet scratch;
-      PacketWriter writer{scratch};
-      writer.write_channel_broadcast(chan);
-      VDP::Packet pac = writer.get_packet();
-
-      device->send_packet(pac);
-      needs_ack = true;
-
-      auto time = VDB::time_ms();
-      while (!chan.acked) {
-        auto now = VDB::time_ms();
-        if (now - time > ack_ms) {
-          // timed out
-          break;
-        }
-        VDB::delay_ms(5);
-      }
-      if (chan.acked == true) {
-        VDPTracef("%s: Acked channel %d after %d ms on attempt %d",
-                  identifier(), chan.id, (int)(VDB::time_ms() - time),
-                  (int)j + 1);
-        break;
-      } else {
-        VDPWarnf("%s: ack for chan id:%02x expired after %d msec", identifier(),
-                 chan.id, (int)ack_ms);
-        failed_acks++;
-        if (j == broadcast_tries_per - 1) {
-          acked_all = false;
-        }
-      }
+  VDPDebugf("%s: Negotiating %d channels", identifier(),
+            (int)my_channels.size());
+  negotiation = NegotiationState::InProgress;
+  for (Channel &chan : my_channels) {
+    if (!chan.acked) {
+      chan.broadcasts_sent = 0;
+      send_broadcast(chan);
+    }
+  }
+  poll_negotiation();
+}
+
+void Registry::send_broadcast(Channel &chan) {
+  PacketWriter writer{chan.packet_scratch_space};
+  if (negotiation_config.offer_fingerprints && chan.broadcasts_sent == 0) {
+    // Cheap first try. Retries send the whole schema in case the listener
+    // doesn't understand offers
+    writer.write_schema_offer(chan, chan.fingerprint);
+  } else {
+    writer.write_channel_broadcast(chan);
+  }
+  device->send_packet(writer.get_packet());
+  chan.broadcasts_sent++;
+  chan.last_broadcast_ms = VDB::time_ms();
+}
+
+void Registry::poll_negotiation() {
+  if (negotiation != NegotiationState::InProgress) {
+    return;
+  }
+  const uint32_t now = VDB::time_ms();
+  bool waiting = false;
+  bool failed = false;
+  for (Channel &chan : my_channels) {
+    if (chan.acked) {
+      continue;
+    }
+    if (now - chan.last_broadcast_ms < negotiation_config.ack_ms) {
+      waiting = true;
+    } else if (chan.broadcasts_sent < negotiation_config.broadcast_tries) {
+      VDPWarnf("%s: ack for chan id:%02x expired after %d msec, resending",
+               identifier(), chan.id, (int)negotiation_config.ack_ms);
+      send_broadcast(chan);
+      waiting = true;
+    } else {
+      failed = true;
     }
   }
-  if (failed_acks > 0) {
-    VDPWarnf("%s: Failed to ack %d times", identifier(), failed_acks);
+  if (waiting) {
+    return;
   }
-  return acked_all;
+  if (failed) {
+    VDPWarnf("%s: Some channels were never acked after %d tries",
+             identifier(), (int)negotiation_config.broadcast_tries);
+    negotiation = NegotiationState::Failed;
+  } else {
+    VDPTracef("%s: All channels acked", identifier());
+    negotiation = NegotiationState::Done;
+  }
+}
 
-  // if (needs_ack && waiting_on_ack_timer.time(vex::timeUnits::msec) < ack_ms)
-  // { printf("Still waiting on ack"); vexDelay(ack_ms -
-  // waiting_on_ack_timer.time(vex::timeUnits::msec));
-  // }
+Registry::NegotiationState Registry::negotiation_state() const {
+  const TaskMutex::Scope hold{mut};
+  return negotiation;
+}
+
+void Registry::configure_negotiation(NegotiationConfig cfg) {
+  const TaskMutex::Scope hold{mut};
+  negotiation_config = cfg;
+}
 
-  // if (reg_type == Side::Controller) {
-  // PacketWriter writer;
-  // writer.write_channel_broadcast(chan);
-  // VDP::Packet pac = writer.get_packet();
-  //
-  // device->send_packet(pac);
-  // needs_ack = true;
-  // waiting_on_ack_timer.reset();
-  // }
+bool Registry::is_acked(ChannelID id) const {
+  const TaskMutex::Scope hold{mut};
+  return id < my_channels.size() && my_channels[id].acked;
+}
+
+bool Registry::negotiate() {
+  if (reg_type != Side::Controller) {
+    return false;
+  }
+  start_negotiation();
+  // Not held while waiting, so acks can be taken in the meantime
+  while (negotiation_state() == NegotiationState::InProgress) {
+    VDB::delay_ms(5);
+    mut.lock();
+    poll_negotiation();
+    mut.unlock();
+  }
+  return negotiation_state() == NegotiationState::Done;
 }
 ChannelID Registry::open_channel(PartPtr for_data) {
+  const TaskMutex::Scope hold{mut};
   ChannelID id = new_channel_id();
   Channel chan = Channel{for_data, id};
+  chan.layout = std::make_shared<LayoutPlan>(for_data);
+  PacketWriter writer{chan.packet_scratch_space};
+  writer.write_channel_broadcast(chan);
+  // header + id before the schema, checksum after
+  chan.fingerprint = schema_fingerprint(&chan.packet_scratch_space[2],
+                                        chan.packet_scratch_space.size() - 6);
   my_channels.push_back(chan);
-  return chan.id;
+  if (negotiation != NegotiationState::Idle) {
+    // Negotiation already started, this one joins in
+    negotiation = NegotiationState::InProgress;
+    send_broadcast(my_channels.back());
+  }
+  return id;
 }
 
 bool Registry::send_data(ChannelID id, PartPtr data) {
-  if (id > my_channels.size()) {
+  const TaskMutex::Scope hold{mut};
+  if (id >= my_channels.size()) {
     printf("VDB-%s: Channel with ID %d doesn't exist yet\n",
            (reg_type == Side::Controller ? "Controller" : "Listener"), (int)id);
     return false;
   }
   Channel &chan = my_channels[id];
-  chan.data = data;
+  if (chan.data != data || !chan.layout->is_current()) {
+    chan.data = data;
+    // Let go of the old plan first so fields it shares with the new tree get
+    // bound to the new one
+    chan.layout = nullptr;
+    chan.layout = std::make_shared<LayoutPlan>(data);
+    if (chan.delta && !data->supports_delta()) {
+      VDPWarnf("%s: Channel %d can't be delta encoded anymore", identifier(),
+               (int)id);
+      chan.delta = nullptr;
+    } else if (chan.delta) {
+      chan.delta->tree_changed();
+    }
+  }
 
   if (!chan.acked) {
-    printf("VDB-%s: Channel %d has not yet been negotiated. Dropping packet\n",
-           (reg_type == Side::Controller ? "Controller" : "Listener"), (int)id);
+    // Normal while negotiation is still going
+    VDPTracef("%s: Channel %d has not yet been negotiated. Dropping packet",
+              identifier(), (int)id);
+    Metrics::instance().count_drop(Metrics::Drop::NotNegotiated);
     return false;
   }
-  VDP::Packet scratch;
-  PacketWriter writ{scratch};
+  // Built in the channel's own buffer, which keeps its capacity from one
+  // send to the next so nothing is allocated once it has grown to fit
+  PacketWriter writ{chan.packet_scratch_space};
+
+  {
+    const Metrics::Timer timer{Metrics::Timing::Serialize};
+    if (chan.delta != nullptr) {
+      if (chan.delta->write_message(writ, chan) ==
+          DeltaEncoder::Result::Unchanged) {
+        return true;
+      }
+    } else {
+      writ.write_data_message(chan);
+    }
+  }
+  const VDP::Packet &pac = writ.get_packet();
+  if (chan.seq_tx != nullptr) {
+    // Kept even if sending fails, a NACK can still bring it back
+    uint16_t seq = 0;
+    std::memcpy(&seq, &pac[2], sizeof(seq));
+    chan.seq_tx->remember(seq, pac);
+  }
+
+  bool sent = false;
+  if (batch_config.max_bytes > 0) {
+    // Counted by flush once the device has the batch
+    sent = send_batched(pac);
+  } else {
+    sent = device->send_packet(pac);
+    if (sent) {
+      // Without the checksum, like the receiving side which also sees batch
+      // entries that don't have one
+      Metrics::instance().count_channel(Metrics::Direction::Sent, id,
+                                        pac.size() - sizeof(uint32_t));
+    }
+  }
 
-  writ.write_data_message(chan);
-  VDP::Packet pac = writ.get_packet();
+  if (chan.delta != nullptr) {
+    if (sent) {
+      chan.delta->count_sent(pac.size());
+    } else {
+      // The listener never saw this one so the next delta would be wrong
+      chan.delta->force_keyframe();
+    }
+  }
+  return sent;
+}
 
-  return device->send_packet(pac);
+bool Registry::enable_delta(ChannelID id, uint16_t keyframe_interval) {
+  const TaskMutex::Scope hold{mut};
+  if (id >= my_channels.size()) {
+    return false;
+  }
+  if (!my_channels[id].data->supports_delta()) {
+    VDPWarnf("%s: Channel %d can't be delta encoded", identifier(), (int)id);
+    return false;
+  }
+  my_channels[id].delta =
+      std::make_shared<DeltaEncoder>(keyframe_interval);
+  return true;
+}
+
+bool Registry::enable_sequencing(ChannelID id, bool reliable) {
+  const TaskMutex::Scope hold{mut};
+  if (id >= my_channels.size()) {
+    return false;
+  }
+  my_channels[id].seq_tx = std::make_shared<SequenceSender>(reliable);
+  return true;
+}
+
+bool Registry::sequence_stats(ChannelID id,
+                              SequenceSender::Stats &stats) const {
+  const TaskMutex::Scope hold{mut};
+  if (id >= my_channels.size() || my_channels[id].seq_tx == nullptr) {
+    return false;
+  }
+  stats = my_channels[id].seq_tx->stats();
+  return true;
+}
+
+bool Registry::loss_stats(ChannelID id, SequenceReceiver::Stats &stats) const {
+  const TaskMutex::Scope hold{mut};
+  if (id >= remote_channels.size() || remote_channels[id].seq_rx == nullptr) {
+    return false;
+  }
+  stats = remote_channels[id].seq_rx->stats();
+  return true;
+}
+
+bool Registry::delta_stats(ChannelID id, DeltaEncoder::Stats &stats) const {
+  const TaskMutex::Scope hold{mut};
+  if (id >= my_channels.size() || my_channels[id].delta == nullptr) {
+    return false;
+  }
+  stats = my_channels[id].delta->stats();
+  return true;
+}
+
+void Registry::configure_batching(BatchConfig cfg) {
+  const TaskMutex::Scope hold{mut};
+  flush();
+  batch_config = cfg;
+  if (cfg.max_bytes > 0) {
+    // Every channel at most once, so sending never has to grow it
+    batch_deltas.reserve(256);
+  }
+}
+
+bool Registry::send_batched(const Packet &message) {
+  PacketWriter writer{batch_packet};
+  if (batch_packet.empty()) {
+    writer.start_batch();
+    batch_started_ms = VDB::time_ms();
+  }
+  const Channel &chan = my_channels[message[1]];
+  if (!writer.append_batch_entry(message, batch_config.max_bytes)) {
+    // Doesn't fit, send what we have and start the next batch with it. A
+    // message that is too big on its own still goes out alone
+    if (!flush() && chan.delta != nullptr) {
+      // Encoded against fields the listener never got, send_data makes the
+      // next one a keyframe
+      return false;
+    }
+    writer.start_batch();
+    batch_started_ms = VDB::time_ms();
+    if (!writer.append_batch_entry(message, batch_config.max_bytes)) {
+      writer.append_batch_entry(message, SIZE_MAX);
+    }
+  }
+  if (chan.delta != nullptr &&
+      std::find(batch_deltas.begin(), batch_deltas.end(), chan.id) ==
+          batch_deltas.end()) {
+    batch_deltas.push_back(chan.id);
+  }
+  if (batch_packet.size() + sizeof(uint32_t) >= batch_config.max_bytes) {
+    return flush();
+  }
+  return poll_batch();
+}
+
+bool Registry::flush() {
+  const TaskMutex::Scope hold{mut};
+  if (batch_packet.empty()) {
+    return true;
+  }
+  PacketWriter writer{batch_packet};
+  if (writer.batch_entries() == 0) {
+    batch_packet.clear();
+    return true;
+  }
+  writer.finish_batch();
+  const bool sent = device->send_packet(batch_packet);
+  if (sent) {
+    // Every entry's channel, the same way receive_batch reads them
+    PacketReader reader{batch_packet.data(),
+                        batch_packet.size() - sizeof(uint32_t), 1};
+    const uint8_t count = reader.get_byte();
+    for (uint8_t i = 0; i < count; i++) {
+      const uint16_t length = reader.get_number<uint16_t>();
+      const uint8_t *entry = reader.get_view(length);
+      Metrics::instance().count_channel(Metrics::Direction::Sent, entry[1],
+                                        length);
+    }
+  }
+  batch_packet.clear();
+  if (!sent) {
+    // Their deltas counted as sent when they were batched, but the listener
+    // never saw them
+    for (const ChannelID id : batch_deltas) {
+      my_channels[id].delta->force_keyframe();
+    }
+  }
+  batch_deltas.clear();
+  return sent;
+}
+
+void Registry::poll() {
+  const TaskMutex::Scope hold{mut};
+  poll_batch();
+  poll_negotiation();
+  // A loss is only noticed when a later message arrives, but asking again
+  // mustn't wait for one
+  for (Channel &chan : remote_channels) {
+    if (chan.seq_rx != nullptr) {
+      send_due_nacks(chan);
+    }
+  }
+}
+
+bool Registry::poll_batch() {
+  if (!batch_packet.empty() &&
+      VDB::time_ms() - batch_started_ms >= batch_config.max_delay_ms) {
+    return flush();
+  }
+  return true;
 }
 
 } // namespace VDP
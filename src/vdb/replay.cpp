@@ -0,0 +1,132 @@
+#ifndef VexV5
+#include "vdb/replay.hpp"
+#include "metrics.hpp"
+
+#include <chrono>
+#include <thread>
+
+namespace VDP {
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+uint64_t ns_between(Clock::time_point a, Clock::time_point b) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(b - a)
+      .count();
+}
+
+// Drops made by a registry taking packets, not by the serial link
+uint32_t receive_drops() {
+  using Drop = Metrics::Drop;
+  const Metrics &metrics = Metrics::instance();
+  return metrics.dropped(Drop::TooSmall) + metrics.dropped(Drop::BadChecksum) +
+         metrics.dropped(Drop::UnknownChannel) +
+         metrics.dropped(Drop::BadData) + metrics.dropped(Drop::NoKeyframe) +
+         metrics.dropped(Drop::Duplicate);
+}
+} // namespace
+
+double ReplayDevice::Stats::packets_per_second() const {
+  return wall_ns == 0 ? 0 : frames * 1e9 / (double)wall_ns;
+}
+
+double ReplayDevice::Stats::speedup() const {
+  return wall_ns == 0 ? 0 : capture_us * 1e3 / (double)wall_ns;
+}
+
+void ReplayDevice::Stats::print() const {
+  const double per_frame = frames == 0 ? 0 : 1.0 / frames;
+  printf("Replay: %d frames (%d schemas, %d dropped, %d replies), %.0f pkts/s, "
+         "%.1fx real time\n",
+         (int)frames, (int)schemas, (int)dropped, (int)replies,
+         packets_per_second(), speedup());
+  printf("Replay per frame: read %.1f ns, wait %.1f ns, take_packet %.1f ns\n",
+         read_ns * per_frame, wait_ns * per_frame, decode_ns * per_frame);
+}
+
+ReplayDevice::ReplayDevice(const CaptureReader &reader)
+    : ReplayDevice(reader, Config{}) {}
+ReplayDevice::ReplayDevice(const CaptureReader &reader, Config cfg)
+    : reader(reader), config(cfg) {}
+
+bool ReplayDevice::send_packet(const Packet &) {
+  // Nobody on the other end to hear it
+  replies++;
+  return true;
+}
+
+void ReplayDevice::register_receive_callback(
+    std::function<void(const Packet &packet)> new_callback) {
+  callback = std::move(new_callback);
+}
+
+ReplayDevice::Stats ReplayDevice::run() {
+  Stats stats;
+  if (!reader.is_open() || !callback) {
+    return stats;
+  }
+  replies = 0;
+  const uint32_t drops_before = receive_drops();
+  CaptureReader::Cursor cursor = config.from_us > 0
+                                     ? reader.seek(config.from_us)
+                                     : reader.begin();
+  bool have_first = false;
+  uint64_t first_us = 0;
+  uint64_t last_us = 0;
+  const Clock::time_point start = Clock::now();
+  Clock::time_point before = start;
+
+  CaptureFrame frame;
+  while (cursor.next(frame)) {
+    if (frame.time_us > config.to_us) {
+      break;
+    }
+    if (frame.direction != config.direction) {
+      continue;
+    }
+    scratch.assign(frame.data, frame.data + frame.size);
+    if (!have_first) {
+      first_us = frame.time_us;
+      have_first = true;
+    }
+    last_us = frame.time_us;
+    const Clock::time_point read = Clock::now();
+    stats.read_ns += ns_between(before, read);
+
+    Clock::time_point due = read;
+    if (config.speed > 0) {
+      // Where this frame falls after the first, scaled to the speed
+      due = start + std::chrono::nanoseconds((uint64_t)(
+                        (frame.time_us - first_us) * 1e3 / config.speed));
+      Clock::time_point now = read;
+      while (now < due) {
+        if (due - now > std::chrono::microseconds(200)) {
+          std::this_thread::sleep_for(due - now -
+                                      std::chrono::microseconds(100));
+        } else {
+          std::this_thread::yield();
+        }
+        now = Clock::now();
+      }
+      stats.wait_ns += ns_between(read, now);
+      due = now;
+    }
+
+    callback(scratch);
+    before = Clock::now();
+    stats.decode_ns += ns_between(due, before);
+    stats.frames++;
+    stats.bytes += frame.size;
+    if (frame.kind != CaptureKind::Frame) {
+      stats.schemas++;
+    }
+  }
+  stats.wall_ns = ns_between(start, Clock::now());
+  stats.capture_us = last_us - first_us;
+  stats.dropped = receive_drops() - drops_before;
+  stats.replies = replies;
+  return stats;
+}
+
+} // namespace VDP
+#endif
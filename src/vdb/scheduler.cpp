@@ -0,0 +1,183 @@
+#include "vdb/scheduler.hpp"
+
+namespace VDP {
+
+Scheduler::Scheduler(Registry &registry) : registry(registry) {}
+
+Scheduler::~Scheduler() { stop(); }
+
+bool Scheduler::add(ChannelID id, PartPtr data, uint32_t period_ms,
+                    uint8_t priority, uint32_t phase_ms) {
+  return add_job(id, std::move(data), nullptr, period_ms, priority, phase_ms);
+}
+
+bool Scheduler::add_series(ChannelID id, std::shared_ptr<Series> series,
+                           uint32_t sample_period_ms, uint8_t priority,
+                           uint32_t phase_ms) {
+  PartPtr data = series;
+  return add_job(id, std::move(data), std::move(series), sample_period_ms,
+                 priority, phase_ms);
+}
+
+bool Scheduler::add_job(ChannelID id, PartPtr data,
+                        std::shared_ptr<Series> series, uint32_t period_ms,
+                        uint8_t priority, uint32_t phase_ms) {
+  if (period_ms == 0 || data == nullptr) {
+    return false;
+  }
+  jobs_mutex.lock();
+  for (const Job &job : jobs) {
+    if (job.id == id) {
+      jobs_mutex.unlock();
+      return false;
+    }
+  }
+  // Complete before the task can see it, a series job must never run as a
+  // plain one
+  const uint64_t now = vexSystemHighResTimeGet();
+  jobs.push_back(Job{id, std::move(data), (uint64_t)period_ms * 1000,
+                     now + (uint64_t)phase_ms * 1000, priority,
+                     ChannelStats{}, std::move(series)});
+  jobs_mutex.unlock();
+  return true;
+}
+
+bool Scheduler::remove(ChannelID id) {
+  jobs_mutex.lock();
+  for (size_t i = 0; i < jobs.size(); i++) {
+    if (jobs[i].id == id) {
+      jobs.erase(jobs.begin() + i);
+      jobs_mutex.unlock();
+      return true;
+    }
+  }
+  jobs_mutex.unlock();
+  return false;
+}
+
+bool Scheduler::stats(ChannelID id, ChannelStats &out) {
+  jobs_mutex.lock();
+  for (const Job &job : jobs) {
+    if (job.id == id) {
+      out = job.stat;
+      jobs_mutex.unlock();
+      return true;
+    }
+  }
+  jobs_mutex.unlock();
+  return false;
+}
+
+Scheduler::Job *Scheduler::next_job() {
+  Job *best = nullptr;
+  for (Job &job : jobs) {
+    if (best == nullptr || job.deadline_us < best->deadline_us ||
+        (job.deadline_us == best->deadline_us &&
+         job.priority > best->priority)) {
+      best = &job;
+    }
+  }
+  return best;
+}
+
+uint64_t Scheduler::run_due(uint64_t now_us) {
+  jobs_mutex.lock();
+  while (true) {
+    Job *job = next_job();
+    if (job == nullptr) {
+      jobs_mutex.unlock();
+      return (uint64_t)MAX_SLEEP_MS * 1000;
+    }
+    if (job->deadline_us > now_us) {
+      const uint64_t wait = job->deadline_us - now_us;
+      jobs_mutex.unlock();
+      return wait;
+    }
+
+    ChannelStats &stat = job->stat;
+    const uint64_t late = now_us - job->deadline_us;
+    const uint64_t skipped = late / job->period_us;
+    stat.missed += (uint32_t)skipped;
+    job->deadline_us += job->period_us * (skipped + 1);
+
+    const uint32_t jitter = (uint32_t)(late - skipped * job->period_us);
+    stat.last_jitter_us = jitter;
+    if (jitter > stat.max_jitter_us) {
+      stat.max_jitter_us = jitter;
+    }
+    stat.mean_jitter_us = stat.mean_jitter_us - stat.mean_jitter_us / 8 +
+                          jitter / 8;
+    stat.runs++;
+
+    // The user's fetchers and sending run unlocked, so they can use the
+    // scheduler themselves and other tasks aren't kept waiting on a send
+    const ChannelID id = job->id;
+    const PartPtr data = job->data;
+    Series *const series = job->series.get();
+    jobs_mutex.unlock();
+    const bool sent = run_job(id, data, series);
+    jobs_mutex.lock();
+    if (!sent) {
+      // Looked up again, the list may have changed meanwhile
+      for (Job &other : jobs) {
+        if (other.id == id) {
+          other.stat.send_failures++;
+          break;
+        }
+      }
+    }
+  }
+}
+
+bool Scheduler::run_job(ChannelID id, const PartPtr &data, Series *series) {
+  if (series != nullptr) {
+    series->sample(vexSystemHighResTimeGet());
+    if (series->size() < series->capacity()) {
+      return true;
+    }
+    const bool sent = registry.send_data(id, data);
+    series->clear();
+    return sent;
+  }
+  data->fetch();
+  return registry.send_data(id, data);
+}
+
+void Scheduler::start(int32_t priority) {
+  bool was_running = false;
+  if (!running.compare_exchange_strong(was_running, true)) {
+    return;
+  }
+  task_alive = true;
+  task = vex::task(Scheduler::scheduler_thread, (void *)this, priority);
+}
+
+void Scheduler::stop() {
+  running = false;
+  while (task_alive.load()) {
+    vexDelay(1);
+  }
+}
+
+int Scheduler::scheduler_thread(void *vself) {
+  Scheduler &self = *(Scheduler *)vself;
+  while (self.running.load()) {
+    const uint64_t wait_us = self.run_due(vexSystemHighResTimeGet());
+    self.registry.poll();
+
+    uint32_t sleep_ms = (uint32_t)(wait_us / 1000);
+    if (sleep_ms > MAX_SLEEP_MS) {
+      sleep_ms = MAX_SLEEP_MS;
+    }
+    if (sleep_ms == 0) {
+      // Less than a millisecond to go, don't oversleep it
+      vex::this_thread::yield();
+    } else {
+      vexDelay(sleep_ms);
+    }
+  }
+  self.task_alive = false;
+  return 0;
+}
+
+} // namespace VDP
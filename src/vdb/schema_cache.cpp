@@ -0,0 +1,72 @@
+#include "vdb/schema_cache.hpp"
+
+namespace VDP {
+
+uint32_t schema_fingerprint(const uint8_t *schema, size_t len) {
+  return CRC32::calculate(schema, len);
+}
+
+SchemaCache::SchemaCache(size_t capacity) : capacity(capacity) {}
+
+void SchemaCache::insert(uint32_t fingerprint, const uint8_t *schema,
+                         size_t len, PartPtr decoded, ChannelID channel,
+                         const Registry *owner) {
+  mut.lock();
+  for (Entry &e : entries) {
+    if (e.fingerprint == fingerprint) {
+      e.decoded = std::move(decoded);
+      e.channel = channel;
+      e.owner = owner;
+      mut.unlock();
+      return;
+    }
+  }
+  if (capacity > 0) {
+    if (entries.size() >= capacity) {
+      entries.erase(entries.begin());
+    }
+    entries.push_back(Entry{fingerprint, Packet(schema, schema + len),
+                            std::move(decoded), channel, owner});
+  }
+  mut.unlock();
+}
+
+PartPtr SchemaCache::lookup(uint32_t fingerprint, ChannelID channel,
+                            const Registry *owner) {
+  mut.lock();
+  for (Entry &e : entries) {
+    if (e.fingerprint != fingerprint) {
+      continue;
+    }
+    stat.hits++;
+    if (e.channel == channel && e.owner == owner) {
+      const PartPtr decoded = e.decoded;
+      mut.unlock();
+      return decoded;
+    }
+    // Decoded outside the lock, entries may move once it is let go
+    const Packet schema = e.schema;
+    mut.unlock();
+    PacketReader reader{schema};
+    return decode_schema(reader);
+  }
+  stat.misses++;
+  mut.unlock();
+  return nullptr;
+}
+
+size_t SchemaCache::size() const {
+  mut.lock();
+  const size_t n = entries.size();
+  mut.unlock();
+  return n;
+}
+
+SchemaCache::Stats SchemaCache::stats() const {
+  mut.lock();
+  const Stats s = stat;
+  mut.unlock();
+  return s;
+}
+
+} // namespace VDP
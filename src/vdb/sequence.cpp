@@ -0,0 +1,110 @@
+#include "vdb/sequence.hpp"
+
+namespace VDP {
+
+SequenceSender::SequenceSender(bool reliable) : is_reliable(reliable) {
+  for (Slot &slot : slots) {
+    slot.seq = 0;
+    slot.valid = false;
+  }
+}
+
+uint16_t SequenceSender::next() {
+  stat.sent++;
+  return next_seq++;
+}
+
+void SequenceSender::remember(uint16_t seq, const Packet &message) {
+  if (!is_reliable) {
+    return;
+  }
+  Slot &slot = slots[seq % WINDOW];
+  slot.seq = seq;
+  slot.valid = true;
+  // Keeps its capacity, so once every slot has held a message this doesn't
+  // allocate
+  slot.message.assign(message.begin(), message.end());
+}
+
+const Packet *SequenceSender::find(uint16_t seq) const {
+  const Slot &slot = slots[seq % WINDOW];
+  if (!slot.valid || slot.seq != seq) {
+    return nullptr;
+  }
+  return &slot.message;
+}
+
+SequenceReceiver::SequenceReceiver() { missing.reserve(MAX_MISSING); }
+
+void SequenceReceiver::add_missing(uint16_t seq) {
+  if (missing.size() >= MAX_MISSING) {
+    missing.erase(missing.begin());
+  }
+  missing.push_back(Missing{seq, 0, 0});
+}
+
+SequenceReceiver::Verdict SequenceReceiver::accept(uint16_t seq,
+                                                   bool reliable, bool &gap) {
+  gap = false;
+  if (!have_any) {
+    have_any = true;
+    expected = (uint16_t)(seq + 1);
+    stat.received++;
+    return Verdict::Deliver;
+  }
+  // Distance forward from what we expected, wrapping around
+  const int16_t ahead = (int16_t)(uint16_t)(seq - expected);
+  if (ahead >= 0) {
+    if (ahead > 0) {
+      gap = true;
+      stat.missing += (uint32_t)ahead;
+      if (reliable) {
+        // Only the most recent ones could still be in the sender's window
+        const uint16_t first =
+            ahead > (int16_t)MAX_MISSING ? (uint16_t)(seq - MAX_MISSING)
+                                         : expected;
+        for (uint16_t s = first; s != seq; s++) {
+          add_missing(s);
+        }
+      }
+    }
+    expected = (uint16_t)(seq + 1);
+    stat.received++;
+    return Verdict::Deliver;
+  }
+  for (size_t i = 0; i < missing.size(); i++) {
+    if (missing[i].seq == seq) {
+      missing.erase(missing.begin() + i);
+      stat.recovered++;
+      stat.received++;
+      return Verdict::Late;
+    }
+  }
+  stat.duplicates++;
+  return Verdict::Drop;
+}
+
+size_t SequenceReceiver::due_nacks(uint32_t now_ms, uint16_t *out,
+                                   size_t max) {
+  size_t count = 0;
+  for (size_t i = 0; i < missing.size();) {
+    Missing &m = missing[i];
+    const bool due =
+        m.nacks == 0 || now_ms - m.last_nack_ms >= NACK_INTERVAL_MS;
+    if (due && m.nacks >= MAX_NACKS) {
+      // Asked enough times, it isn't coming
+      missing.erase(missing.begin() + i);
+      continue;
+    }
+    if (due && count < max) {
+      out[count++] = m.seq;
+      m.nacks++;
+      m.last_nack_ms = now_ms;
+      stat.nacks_sent++;
+    }
+    i++;
+  }
+  return count;
+}
+
+} // namespace VDP
@@ -0,0 +1,144 @@
+#include "vdb/series.hpp"
+
+#include "vex.h"
+
+namespace VDP {
+
+Series::Series(std::string name, PartPtr sample, uint8_t max_samples)
+    : Part(std::move(name)), part(std::move(sample)),
+      slots(max_samples > 0 ? max_samples : 1) {}
+
+Series::Series(std::string name, PacketReader &reader, SchemaArena *arena)
+    : Part(std::move(name)) {
+  const uint8_t max_samples = reader.get_byte();
+  if (!reader.ok()) {
+    return;
+  }
+  if (max_samples == 0) {
+    reader.fail(ReadStatus::BadSchema);
+    return;
+  }
+  slots.resize(max_samples);
+  part = make_decoder(reader, arena);
+}
+
+void Series::fetch() { sample(vexSystemHighResTimeGet()); }
+
+void Series::sample(uint64_t time_us) {
+  part->fetch();
+  if (count == slots.size()) {
+    first = (first + 1) % slots.size();
+    count--;
+    num_overwritten++;
+  }
+  Slot &slot = slots[(first + count) % slots.size()];
+  slot.time_us = time_us;
+  PacketWriter writer{slot.data};
+  writer.clear();
+  part->write_message(writer);
+  count++;
+}
+
+void Series::clear() {
+  first = 0;
+  count = 0;
+}
+
+uint64_t Series::time_us(size_t i) const {
+  return i < count ? at(i).time_us : 0;
+}
+
+bool Series::load(size_t i) {
+  if (i >= count) {
+    return false;
+  }
+  const Packet &data = at(i).data;
+  PacketReader reader{data};
+  part->read_data_from_message(reader);
+  return reader.ok();
+}
+
+void Series::write_schema(PacketWriter &sofar) const {
+  sofar.write_type(Type::Series);                  // Type
+  sofar.write_string(name);                        // Name
+  sofar.write_number<uint8_t>((uint8_t)capacity()); // Most samples
+  part->write_schema(sofar);                       // What a sample is
+}
+
+void Series::write_message(PacketWriter &sofar) const {
+  sofar.write_number<uint8_t>((uint8_t)count);
+  if (count == 0) {
+    return;
+  }
+  sofar.write_number<uint32_t>((uint32_t)at(0).time_us);
+  for (size_t i = 1; i < count; i++) {
+    sofar.write_varint(at(i).time_us - at(i - 1).time_us);
+  }
+  for (size_t i = 0; i < count; i++) {
+    const Packet &data = at(i).data;
+    sofar.write_bytes(data.data(), data.size());
+  }
+}
+
+void Series::read_data_from_message(PacketReader &reader) {
+  const uint8_t n = reader.get_byte();
+  if (n > slots.size()) {
+    reader.fail(ReadStatus::BadSchema);
+    return;
+  }
+  first = 0;
+  count = 0;
+  if (n == 0 || !reader.ok()) {
+    return;
+  }
+  const uint32_t base = reader.get_number<uint32_t>();
+  if (base < last_base && last_base - base > 0x80000000UL) {
+    epoch += 1ULL << 32;
+  }
+  last_base = base;
+  uint64_t time = epoch | base;
+  slots[0].time_us = time;
+  for (size_t i = 1; i < n; i++) {
+    time += reader.get_varint();
+    slots[i].time_us = time;
+  }
+  // Each sample is decoded to find where it ends, which leaves the newest
+  // in the part
+  for (size_t i = 0; i < n && reader.ok(); i++) {
+    const size_t start = reader.position();
+    part->read_data_from_message(reader);
+    slots[i].data.assign(reader.bytes() + start,
+                         reader.bytes() + reader.position());
+  }
+  if (reader.ok()) {
+    count = n;
+  }
+}
+
+void Series::use_compact_integers(bool compact) {
+  part->use_compact_integers(compact);
+}
+
+void Series::pprint(std::stringstream &ss, size_t indent) const {
+  add_indents(ss, indent);
+  ss << name << ": series[<=" << capacity() << "]{\n";
+  part->pprint(ss, indent + 1);
+  ss << '\n';
+  add_indents(ss, indent);
+  ss << "}\n";
+}
+
+void Series::pprint_data(std::stringstream &ss, size_t indent) const {
+  add_indents(ss, indent);
+  ss << name << ": series[" << count << "]";
+  if (count > 0) {
+    ss << " " << at(0).time_us << "-" << at(count - 1).time_us << "us";
+  }
+  ss << " latest{\n";
+  part->pprint_data(ss, indent + 1);
+  ss << '\n';
+  add_indents(ss, indent);
+  ss << "}\n";
+}
+
+} // namespace VDP
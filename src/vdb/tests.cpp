@@ -1,7 +1,27 @@
 #include "vdb/tests.hpp"
+#include "alloc_counter.hpp"
+#include "byte_ring.hpp"
+#include "cobs_device.hpp"
+#include "metrics.hpp"
+#include "vdb/arena.hpp"
+#include "vdb/array.hpp"
 #include "vdb/builtins.hpp"
+#include "vdb/capture.hpp"
+#include "vdb/columns.hpp"
+#include "vdb/layout.hpp"
 #include "vdb/protocol.hpp"
+#include "vdb/quantize.hpp"
 #include "vdb/registry.hpp"
+#include "vdb/replay.hpp"
+#include "vdb/scheduler.hpp"
+#include "vdb/series.hpp"
+#include "vdb/static_record.hpp"
+#include "vdb/types.hpp"
+#include "wrapper_device.hpp"
+#include <cmath>
+#ifndef VexV5
+#include "host_serial.h"
+#endif
 namespace VDP {
 
 class SilentDevice : public AbstractDevice {
@@ -11,47 +31,1858 @@ public:
   register_receive_callback(std::function<void(const VDP::Packet &)>) override {
   }
 };
+// Hands every packet straight to its partner's receive callback, so two
+// registries can talk to each other synchronously
+class LoopbackDevice : public AbstractDevice {
+public:
+  bool send_packet(const VDP::Packet &packet) override {
+    if (refuse) {
+      return false; // As if its queue were full
+    }
+    sent.push_back(packet);
+    if (should_drop && should_drop(packet)) {
+      return true; // Lost on the way
+    }
+    if (partner != nullptr && partner->callback) {
+      partner->callback(packet);
+    }
+    return true;
+  }
+  void register_receive_callback(
+      std::function<void(const VDP::Packet &)> new_callback) override {
+    callback = std::move(new_callback);
+  }
+
+  LoopbackDevice *partner = nullptr;
+  std::vector<VDP::Packet> sent;
+  std::function<bool(const VDP::Packet &)> should_drop;
+  bool refuse = false;
+
+private:
+  std::function<void(const VDP::Packet &)> callback;
+};
+
+// Two loopback devices wired to each other: what is sent on to_listener
+// reaches whoever registered on to_controller, and the other way around
+struct Link {
+  Link() {
+    to_listener.partner = &to_controller;
+    to_controller.partner = &to_listener;
+  }
+  LoopbackDevice to_listener;
+  LoopbackDevice to_controller;
+};
+
+// A controller and a listener talking over a Link. The listener takes
+// broadcasts and data quietly until a test installs its own callbacks
+struct LinkedPair : Link {
+  LinkedPair() {
+    listener.install_broadcast_callback([](const VDP::Channel &) {});
+    listener.install_data_callback([](const VDP::Channel &) {});
+  }
+  Registry controller{&to_listener, Registry::Side::Controller};
+  Registry listener{&to_controller, Registry::Side::Listener};
+};
+
 namespace RegistryTest {
 
 static bool test_broadcast() {
   VDP::SilentDevice dev;
-  VDP::Registry reg_out{&dev, VDP::Registry::Side::Controller};
   VDP::Registry reg_in{&dev, VDP::Registry::Side::Listener};
 
   vex::motor mot1{vex::PORT21};
-  // const VDP::Channel motor_channel =
-  // reg_out.open_channel((VDP::PartPtr) new VDP::Motor("Motor 1", mot1));
-  //
-  // VDP::PacketWriter writer;
+  const VDP::Channel motor_channel{
+      VDP::PartPtr(new VDP::Motor("Motor 1", mot1))};
+
   bool was_broadcast_correctly = false;
-  // reg_in.install_broadcast_callback([&](VDP::Channel chan) {
-  // if (chan.getID() != motor_channel.getID()) {
-  // was_broadcast_correctly = false;
-  // return;
-  // }
-  // auto schema_out = motor_channel.data->pretty_print();
-  // auto schema_in = chan.data->pretty_print();
-  // if (schema_in != schema_out) {
-  // was_broadcast_correctly = false;
-  // return;
-  // }
-  // was_broadcast_correctly = true;
-  // });
-  // writer.write_channel_broadcast(motor_channel);
-  // VDP::Packet packet = writer.get_packet();
-  // reg_in.take_packet(packet);
+  reg_in.install_broadcast_callback([&](const VDP::Channel &chan) {
+    if (chan.getID() != motor_channel.getID()) {
+      was_broadcast_correctly = false;
+      return;
+    }
+    auto schema_out = motor_channel.data->pretty_print();
+    auto schema_in = chan.data->pretty_print();
+    if (schema_in != schema_out) {
+      was_broadcast_correctly = false;
+      return;
+    }
+    was_broadcast_correctly = true;
+  });
+
+  VDP::Packet scratch;
+  VDP::PacketWriter writer{scratch};
+  writer.write_channel_broadcast(motor_channel);
+  reg_in.take_packet(writer.get_packet());
 
   return was_broadcast_correctly;
 }
+
+static bool test_batching() {
+  VDP::LinkedPair pair;
+
+  auto a = std::make_shared<VDP::Uint32>("a");
+  auto b = std::make_shared<VDP::Float>("b");
+  auto c = std::make_shared<VDP::String>("c");
+  const VDP::ChannelID ids[3] = {pair.controller.open_channel(a),
+                                 pair.controller.open_channel(b),
+                                 pair.controller.open_channel(c)};
+  if (!pair.controller.negotiate()) {
+    return false;
+  }
+
+  std::vector<VDP::ChannelID> received;
+  pair.listener.install_data_callback(
+      [&](const VDP::Channel &chan) { received.push_back(chan.getID()); });
+
+  VDP::Registry::BatchConfig cfg;
+  cfg.max_bytes = 256;
+  cfg.max_delay_ms = 10000;
+  pair.controller.configure_batching(cfg);
+
+  a->setValue(1234567);
+  b->setValue(2.5f);
+  c->setValue("hello");
+  pair.to_listener.sent.clear();
+  pair.controller.send_data(ids[0], a);
+  pair.controller.send_data(ids[1], b);
+  pair.controller.send_data(ids[2], c);
+  if (!received.empty()) {
+    return false; // Nothing should go out before the flush
+  }
+  pair.controller.flush();
+
+  if (pair.to_listener.sent.size() != 1 || received.size() != 3) {
+    return false;
+  }
+  for (size_t i = 0; i < 3; i++) {
+    if (received[i] != ids[i]) {
+      return false;
+    }
+  }
+  if (pair.listener.get_remote_schema(ids[0])->pretty_print_data() !=
+          a->pretty_print_data() ||
+      pair.listener.get_remote_schema(ids[1])->pretty_print_data() !=
+          b->pretty_print_data() ||
+      pair.listener.get_remote_schema(ids[2])->pretty_print_data() !=
+          c->pretty_print_data()) {
+    return false;
+  }
+
+  // Bytes are counted once the batch goes out. A message that starts the
+  // next batch after the last one failed is still on its way
+  Metrics &metrics = Metrics::instance();
+  metrics.reset();
+  pair.controller.send_data(ids[0], a);
+  pair.to_listener.refuse = true;
+  c->setValue(std::string(240, 'x'));
+  if (!pair.controller.send_data(ids[2], c)) {
+    return false;
+  }
+  pair.to_listener.refuse = false;
+  pair.controller.flush();
+  return metrics.channel(Metrics::Direction::Sent, ids[0]).packets == 0 &&
+         metrics.channel(Metrics::Direction::Sent, ids[2]).packets == 1 &&
+         pair.listener.get_remote_schema(ids[2])->pretty_print_data() ==
+             c->pretty_print_data();
+}
+
+static bool test_delta() {
+  VDP::LinkedPair pair;
+
+  auto a = std::make_shared<VDP::Uint32>("a");
+  auto b = std::make_shared<VDP::Float>("b");
+  auto c = std::make_shared<VDP::String>("c");
+  auto rec = std::make_shared<VDP::Record>(
+      "rec", std::vector<VDP::PartPtr>{a, b, c});
+  const VDP::ChannelID id = pair.controller.open_channel(rec);
+  pair.controller.enable_delta(id, 4);
+  if (!pair.controller.negotiate()) {
+    return false;
+  }
+  const VDP::PartPtr remote = pair.listener.get_remote_schema(id);
+
+  a->setValue(10);
+  b->setValue(1.5f);
+  c->setValue("start");
+  pair.to_listener.sent.clear();
+
+  // Keyframe, one changed field, nothing changed
+  pair.controller.send_data(id, rec);
+  b->setValue(-3.0f);
+  pair.controller.send_data(id, rec);
+  pair.controller.send_data(id, rec);
+
+  if (pair.to_listener.sent.size() != 2 ||
+      remote->pretty_print_data() != rec->pretty_print_data()) {
+    return false;
+  }
+  // header + id + bitmap + float + checksum
+  if (pair.to_listener.sent[1].size() != 2 + 1 + 4 + 4) {
+    return false;
+  }
+
+  // Four sends after the last keyframe comes another, changed or not
+  pair.controller.send_data(id, rec);
+  pair.controller.send_data(id, rec);
+  VDP::DeltaEncoder::Stats stats;
+  if (!pair.controller.delta_stats(id, stats)) {
+    return false;
+  }
+  if (pair.to_listener.sent.size() != 3 || stats.keyframes != 2 ||
+      stats.deltas != 1 || stats.skipped != 2 ||
+      stats.sent_bytes >= stats.full_bytes) {
+    return false;
+  }
+
+  // A batched delta counts as sent until its batch fails to go out, then
+  // the next message has to be a keyframe
+  VDP::Registry::BatchConfig batching;
+  batching.max_bytes = 256;
+  batching.max_delay_ms = 10000;
+  pair.controller.configure_batching(batching);
+  a->setValue(11);
+  pair.controller.send_data(id, rec);
+  pair.to_listener.refuse = true;
+  if (pair.controller.flush()) {
+    return false;
+  }
+  pair.to_listener.refuse = false;
+  c->setValue("after");
+  pair.controller.send_data(id, rec);
+  pair.controller.flush();
+  pair.controller.delta_stats(id, stats);
+  if (stats.keyframes != 3 ||
+      remote->pretty_print_data() != rec->pretty_print_data()) {
+    return false;
+  }
+
+  // A delta that doesn't fit the batch behind one that fails to go out was
+  // based on what that batch held, so it isn't kept for the next one
+  batching.max_bytes = 40;
+  pair.controller.configure_batching(batching);
+  a->setValue(12);
+  pair.controller.send_data(id, rec);
+  pair.to_listener.refuse = true;
+  c->setValue(std::string(24, 'x'));
+  if (pair.controller.send_data(id, rec)) {
+    return false;
+  }
+  pair.to_listener.refuse = false;
+  const size_t sent_before = pair.to_listener.sent.size();
+  pair.controller.flush();
+  if (pair.to_listener.sent.size() != sent_before) {
+    return false;
+  }
+  pair.controller.send_data(id, rec);
+  pair.controller.flush();
+  pair.controller.delta_stats(id, stats);
+  return stats.keyframes == 4 &&
+         remote->pretty_print_data() == rec->pretty_print_data();
+}
+
+static bool test_pipelined_negotiation() {
+  VDP::LinkedPair pair;
+
+  auto a = std::make_shared<VDP::Uint32>("a");
+  const VDP::ChannelID ids[3] = {pair.controller.open_channel(a),
+                                 pair.controller.open_channel(a),
+                                 pair.controller.open_channel(a)};
+  VDP::Registry::NegotiationConfig cfg;
+  cfg.ack_ms = 20;
+  cfg.offer_fingerprints = false;
+  pair.controller.configure_negotiation(cfg);
+
+  // Lose the first broadcast of the middle channel
+  const uint8_t broadcast_header = VDP::make_header_byte(
+      VDP::PacketHeader{VDP::PacketType::Broadcast, VDP::PacketFunction::Send,
+                        0});
+  int broadcasts = 0;
+  bool dropped = false;
+  pair.to_listener.should_drop = [&](const VDP::Packet &p) {
+    if (p[0] != broadcast_header) {
+      return false;
+    }
+    broadcasts++;
+    if (p[1] == ids[1] && !dropped) {
+      dropped = true;
+      return true;
+    }
+    return false;
+  };
+
+  pair.controller.start_negotiation();
+  // Everything went out at once and the others don't wait on the lost one
+  if (broadcasts != 3 || !pair.controller.is_acked(ids[0]) ||
+      pair.controller.is_acked(ids[1]) || !pair.controller.is_acked(ids[2]) ||
+      pair.controller.negotiation_state() !=
+          VDP::Registry::NegotiationState::InProgress ||
+      !pair.controller.send_data(ids[2], a) ||
+      pair.controller.send_data(ids[1], a)) {
+    return false;
+  }
+
+  const uint32_t start = VDB::time_ms();
+  while (pair.controller.negotiation_state() ==
+             VDP::Registry::NegotiationState::InProgress &&
+         VDB::time_ms() - start < 1000) {
+    VDB::delay_ms(5);
+    pair.controller.poll();
+  }
+  // Only the lost one was sent again
+  return broadcasts == 4 && pair.controller.is_acked(ids[1]) &&
+         pair.controller.negotiation_state() ==
+             VDP::Registry::NegotiationState::Done &&
+         pair.listener.get_remote_schema(ids[1]) != nullptr;
+}
+
+static bool test_schema_cache() {
+  VDP::Link link;
+  VDP::LoopbackDevice &to_listener = link.to_listener;
+  VDP::Registry listener{&link.to_controller, VDP::Registry::Side::Listener};
+  listener.install_broadcast_callback([](const VDP::Channel &) {});
+  listener.install_data_callback([](const VDP::Channel &) {});
+
+  const uint8_t broadcast_header = VDP::make_header_byte(
+      VDP::PacketHeader{VDP::PacketType::Broadcast, VDP::PacketFunction::Send,
+                        0});
+  // Each run of the controller stands for one boot of the robot
+  auto boot = [&](float value, int &full_broadcasts) {
+    VDP::Registry controller{&to_listener, VDP::Registry::Side::Controller};
+    auto pos = std::make_shared<VDP::Float>("pos");
+    auto vel = std::make_shared<VDP::Float>("vel");
+    auto name = std::make_shared<VDP::String>("name");
+    controller.open_channel(std::make_shared<VDP::Record>(
+        "drive", std::vector<VDP::PartPtr>{pos, vel}));
+    const VDP::ChannelID id = controller.open_channel(name);
+    to_listener.sent.clear();
+    if (!controller.negotiate()) {
+      return false;
+    }
+    full_broadcasts = 0;
+    for (const VDP::Packet &p : to_listener.sent) {
+      full_broadcasts += p[0] == broadcast_header;
+    }
+    name->setValue(std::to_string(value));
+    return controller.send_data(id, name) &&
+           listener.get_remote_schema(id)->pretty_print_data() ==
+               name->pretty_print_data();
+  };
+
+  int full_broadcasts = 0;
+  if (!boot(1.0f, full_broadcasts) || full_broadcasts != 2 ||
+      listener.get_schema_cache()->size() != 2) {
+    return false;
+  }
+  // Second boot only offers fingerprints, and they are all known
+  if (!boot(2.0f, full_broadcasts) || full_broadcasts != 0 ||
+      listener.get_schema_cache()->stats().hits != 2) {
+    return false;
+  }
+
+  // Another listener on the same cache gets the schema but not the first
+  // listener's tree, or their values would mix
+  VDP::LinkedPair other;
+  other.listener.share_schema_cache(listener.get_schema_cache());
+  auto name = std::make_shared<VDP::String>("name");
+  other.controller.open_channel(std::make_shared<VDP::Record>(
+      "drive", std::vector<VDP::PartPtr>{std::make_shared<VDP::Float>("pos"),
+                                         std::make_shared<VDP::Float>("vel")}));
+  const VDP::ChannelID id = other.controller.open_channel(name);
+  name->setValue("other");
+  if (!other.controller.negotiate() || !other.controller.send_data(id, name)) {
+    return false;
+  }
+  return listener.get_schema_cache()->stats().hits == 4 &&
+         other.listener.get_remote_schema(id) !=
+             listener.get_remote_schema(id) &&
+         listener.get_remote_schema(id)->pretty_print_data() !=
+             other.listener.get_remote_schema(id)->pretty_print_data();
+}
+
+static bool test_send_allocations() {
+  if (!AllocCounter::enabled()) {
+    return true; // Nothing to measure with
+  }
+  VDP::SilentDevice dev;
+  VDP::Registry controller{&dev, VDP::Registry::Side::Controller};
+  vex::motor mot{vex::PORT20};
+  const VDP::PartPtr motor = std::make_shared<VDP::Motor>("motor", mot);
+  const VDP::ChannelID id = controller.open_channel(motor);
+
+  VDP::Packet ack;
+  VDP::PacketWriter{ack}.write_channel_acknowledge(VDP::Channel{motor});
+  controller.take_packet(ack);
+
+  VDP::Registry::BatchConfig batching;
+  batching.max_bytes = 128;
+  for (int mode = 0; mode < 3; mode++) {
+    if (mode == 1) {
+      controller.configure_batching(batching);
+    } else if (mode == 2) {
+      controller.enable_delta(id, 4);
+    }
+    // The first frames grow the buffers
+    for (int i = 0; i < 8; i++) {
+      controller.send_data(id, motor);
+    }
+    const AllocCounter::Scope counter;
+    for (int i = 0; i < 64; i++) {
+      mot.readings.position_deg = i;
+      motor->fetch();
+      controller.send_data(id, motor);
+    }
+    if (counter.allocations() != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool test_sequenced_loss() {
+  VDP::LinkedPair pair;
+
+  auto a = std::make_shared<VDP::Uint32>("a");
+  auto b = std::make_shared<VDP::Uint32>("b");
+  const VDP::ChannelID best_effort = pair.controller.open_channel(a);
+  const VDP::ChannelID reliable = pair.controller.open_channel(b);
+  if (!pair.controller.negotiate() ||
+      !pair.controller.enable_sequencing(best_effort, false) ||
+      !pair.controller.enable_sequencing(reliable, true)) {
+    return false;
+  }
+
+  std::vector<uint32_t> got_a;
+  std::vector<uint32_t> got_b;
+  std::vector<uint32_t> got_late;
+  pair.listener.install_data_callback([&](const VDP::Channel &chan) {
+    const VDP::Uint32 &num = (const VDP::Uint32 &)*chan.data;
+    if (chan.is_late()) {
+      got_late.push_back(num.getValue());
+    }
+    (chan.getID() == best_effort ? got_a : got_b).push_back(num.getValue());
+  });
+
+  // Lose the third data message on each channel
+  const uint8_t data_header = VDP::make_header_byte(VDP::PacketHeader{
+      VDP::PacketType::Data, VDP::PacketFunction::Send,
+      VDP::PacketFlags::Sequenced});
+  const uint8_t reliable_header = VDP::make_header_byte(VDP::PacketHeader{
+      VDP::PacketType::Data, VDP::PacketFunction::Send,
+      VDP::PacketFlags::Sequenced | VDP::PacketFlags::Reliable});
+  int seen[2] = {0, 0};
+  pair.to_listener.should_drop = [&](const VDP::Packet &p) {
+    if (p[0] != data_header && p[0] != reliable_header) {
+      return false;
+    }
+    return ++seen[p[1] == reliable] == 3;
+  };
+  for (uint32_t i = 0; i < 5; i++) {
+    a->setValue(i);
+    b->setValue(i);
+    pair.controller.send_data(best_effort, a);
+    pair.controller.send_data(reliable, b);
+  }
+
+  VDP::SequenceReceiver::Stats loss_a;
+  VDP::SequenceReceiver::Stats loss_b;
+  VDP::SequenceSender::Stats sender_b;
+  if (!pair.listener.loss_stats(best_effort, loss_a) ||
+      !pair.listener.loss_stats(reliable, loss_b) ||
+      !pair.controller.sequence_stats(reliable, sender_b)) {
+    return false;
+  }
+  // The best effort channel only counts the loss. The reliable one NACKs it
+  // when the next message shows the gap. The loopback answers the NACK
+  // before that message is handed over, so here it even arrives in order,
+  // though marked late since the newer one was already seen
+  const std::vector<uint32_t> expect_a = {0, 1, 3, 4};
+  const std::vector<uint32_t> expect_b = {0, 1, 2, 3, 4};
+  if (got_a != expect_a || got_b != expect_b ||
+      got_late != std::vector<uint32_t>{2} ||
+      loss_a.missing != 1 || loss_a.recovered != 0 || loss_b.missing != 1 ||
+      loss_b.recovered != 1 || loss_b.nacks_sent != 1 ||
+      sender_b.nacked != 1 || sender_b.retransmits != 1) {
+    return false;
+  }
+
+  // The last of a burst lost along with the retransmit the first NACK got.
+  // No later message comes to bring the loss up again, so poll asks again
+  int lost_tens = 0;
+  pair.to_listener.should_drop = [&](const VDP::Packet &p) {
+    if (p[0] != reliable_header) {
+      return false;
+    }
+    uint32_t value = 0;
+    std::memcpy(&value, &p[4], sizeof(value));
+    return value == 10 && ++lost_tens <= 2;
+  };
+  got_b.clear();
+  got_late.clear();
+  b->setValue(10);
+  pair.controller.send_data(reliable, b);
+  b->setValue(11);
+  pair.controller.send_data(reliable, b);
+  pair.listener.poll();
+  if (got_b != std::vector<uint32_t>{11} || lost_tens != 2) {
+    return false; // Too soon to ask again
+  }
+  VDB::delay_ms(VDP::SequenceReceiver::NACK_INTERVAL_MS + 10);
+  pair.listener.poll();
+  // Handed over late, but the channel is left holding the newest value
+  const VDP::Uint32 &current =
+      (const VDP::Uint32 &)*pair.listener.get_remote_schema(reliable);
+  return got_b == std::vector<uint32_t>({11, 10}) &&
+         got_late == std::vector<uint32_t>{10} && current.getValue() == 11;
+}
+
+static bool test_link_metrics() {
+  VDP::LinkedPair pair;
+
+  Metrics &metrics = Metrics::instance();
+  metrics.reset();
+
+  auto a = std::make_shared<VDP::Uint32>("a");
+  auto link = std::make_shared<VDP::LinkMetrics>("link");
+  const VDP::ChannelID data_id = pair.controller.open_channel(a);
+  const VDP::ChannelID link_id = pair.controller.open_channel(link);
+  // Too early, counted as a drop
+  pair.controller.send_data(data_id, a);
+  if (!pair.controller.negotiate()) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    pair.controller.send_data(data_id, a);
+  }
+  // Data for a channel a pair.listener never heard of
+  VDP::SilentDevice silent;
+  VDP::Registry stranger{&silent, VDP::Registry::Side::Listener};
+  VDP::Packet unknown;
+  VDP::PacketWriter{unknown}.write_data_message(VDP::Channel{a});
+  stranger.take_packet(unknown);
+
+  const Metrics::ChannelCounters sent =
+      metrics.channel(Metrics::Direction::Sent, data_id);
+  const Metrics::ChannelCounters received =
+      metrics.channel(Metrics::Direction::Received, data_id);
+  if (sent.packets != 3 || received.packets != 3 ||
+      sent.bytes != received.bytes ||
+      metrics.dropped(Metrics::Drop::NotNegotiated) != 1 ||
+      metrics.dropped(Metrics::Drop::UnknownChannel) != 1 ||
+      metrics.histogram(Metrics::Timing::CRC).count == 0) {
+    return false;
+  }
+
+  // The schema has to fit in one packet on a real link
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(VDP::Channel{link});
+  if (broadcast.size() > COBSSerialDevice::MAX_PACKET_SIZE) {
+    return false;
+  }
+  link->fetch();
+  return pair.controller.send_data(link_id, link) &&
+         pair.listener.get_remote_schema(link_id)->pretty_print_data() ==
+             link->pretty_print_data();
+}
 } // namespace RegistryTest
+namespace SchedulerTest {
+static bool test_deadline_order() {
+  VDP::SilentDevice dev;
+  VDP::Registry controller{&dev, VDP::Registry::Side::Controller};
+  VDP::Scheduler sched{controller};
+
+  std::vector<int> order;
+  auto part = [&](int tag) {
+    return std::make_shared<VDP::Uint32>("v", [&order, tag]() {
+      order.push_back(tag);
+      return (uint32_t)tag;
+    });
+  };
+  const VDP::PartPtr a = part(0), b = part(1), c = part(2);
+  const VDP::ChannelID ids[3] = {controller.open_channel(a),
+                                 controller.open_channel(b),
+                                 controller.open_channel(c)};
+  sched.add(ids[0], a, 10);
+  sched.add(ids[1], b, 30);
+  sched.add(ids[2], c, 10, 0, 5);
+  const uint64_t t = vexSystemHighResTimeGet();
+
+  // The phase offset holds the third back
+  const uint64_t wait = sched.run_due(t);
+  if (order != std::vector<int>{0, 1} || wait > 5000 || wait < 4000) {
+    return false;
+  }
+  sched.run_due(t + 5000);
+  if (order != std::vector<int>{0, 1, 2}) {
+    return false;
+  }
+
+  // Stall for 45ms: due in deadline order, once each, missed ones counted
+  order.clear();
+  sched.run_due(t + 45000);
+  VDP::Scheduler::ChannelStats fast, slow;
+  sched.stats(ids[0], fast);
+  sched.stats(ids[1], slow);
+  if (order != std::vector<int>{0, 2, 1} || fast.runs != 2 ||
+      fast.missed != 3 || slow.missed != 0 || slow.max_jitter_us < 14000) {
+    return false;
+  }
+  // Nothing was negotiated so nothing could be sent
+  if (fast.send_failures != fast.runs) {
+    return false;
+  }
+
+  // A fetcher can use the scheduler itself
+  bool looked = false;
+  auto nosy = std::make_shared<VDP::Uint32>("nosy", [&]() {
+    VDP::Scheduler::ChannelStats seen;
+    looked = sched.stats(ids[0], seen);
+    return 0u;
+  });
+  const VDP::ChannelID nosy_id = controller.open_channel(nosy);
+  sched.add(nosy_id, nosy, 1000);
+  sched.run_due(vexSystemHighResTimeGet());
+  VDP::Scheduler::ChannelStats nosy_stats;
+  sched.stats(nosy_id, nosy_stats);
+  if (!looked || nosy_stats.runs != 1 || nosy_stats.send_failures != 1) {
+    return false;
+  }
+
+  // And on its own task. The run above left deadlines 50ms ahead
+  const uint32_t runs_before = fast.runs;
+  sched.start();
+  VDB::delay_ms(120);
+  sched.stop();
+  sched.stats(ids[0], fast);
+  return fast.runs > runs_before + 3;
+}
+
+static bool test_series() {
+  VDP::LinkedPair pair;
+
+  uint16_t reading = 0;
+  auto series = std::make_shared<VDP::Series>(
+      "fast",
+      std::make_shared<VDP::Uint16>("reading", [&]() { return reading++; }),
+      10);
+  const VDP::ChannelID id = pair.controller.open_channel(series);
+  if (!pair.controller.negotiate()) {
+    return false;
+  }
+  std::vector<uint64_t> times;
+  std::vector<uint16_t> values;
+  pair.listener.install_data_callback([&](const VDP::Channel &chan) {
+    VDP::Series &got = (VDP::Series &)*chan.data;
+    for (size_t i = 0; i < got.size(); i++) {
+      got.load(i);
+      times.push_back(got.time_us(i));
+      values.push_back(((VDP::Uint16 &)*got.sample()).getValue());
+    }
+  });
+
+  // 12 samples at 1kHz into room for 10: the oldest two are lost. The 32
+  // bit times wrap in the middle
+  const uint64_t start = 0xffffffffULL - 4500;
+  for (uint64_t i = 0; i < 12; i++) {
+    series->sample(start + i * 1000 + (i % 2));
+  }
+  pair.to_listener.sent.clear();
+  if (series->overwritten() != 2 || !pair.controller.send_data(id, series)) {
+    return false;
+  }
+  series->clear();
+  // Header, id, count, base time, 9 2 byte deltas, 10 values, checksum
+  if (pair.to_listener.sent.size() != 1 ||
+      pair.to_listener.sent[0].size() != 2 + 1 + 4 + 18 + 20 + 4 ||
+      values.size() != 10) {
+    return false;
+  }
+  for (uint64_t i = 0; i < 10; i++) {
+    if (values[i] != i + 2 ||
+        times[i] != start + (i + 2) * 1000 + (i % 2)) {
+      return false;
+    }
+  }
+  // Past 32 bits even though the base was sent in 32 bits
+  if (times.back() < 0x100000000ULL) {
+    return false;
+  }
+
+  // The scheduler samples every period and sends once the series is full
+  VDP::Scheduler sched{pair.controller};
+  auto slow = std::make_shared<VDP::Series>(
+      "slow",
+      std::make_shared<VDP::Uint16>("reading", [&]() { return reading++; }),
+      4);
+  const VDP::ChannelID slow_id = pair.controller.open_channel(slow);
+  if (!pair.controller.negotiate() || !sched.add_series(slow_id, slow, 1)) {
+    return false;
+  }
+  values.clear();
+  pair.to_listener.sent.clear();
+  const uint64_t t = vexSystemHighResTimeGet();
+  for (uint64_t ms = 0; ms < 8; ms++) {
+    sched.run_due(t + ms * 1000);
+  }
+  return pair.to_listener.sent.size() == 2 && values.size() == 8 &&
+         slow->size() == 0;
+}
+
+static bool test_column_sink() {
+  VDP::LinkedPair pair;
+
+  VDP::ColumnSink sink{4};
+  uint64_t now = 5000;
+  pair.listener.install_data_callback(
+      [&](const VDP::Channel &chan) { sink.append(chan, now); });
+
+  uint32_t count = 0;
+  auto rec = std::make_shared<VDP::Record>(
+      "rec",
+      std::vector<VDP::PartPtr>{
+          std::make_shared<VDP::Uint32>("count", [&]() { return count; }),
+          std::make_shared<VDP::String>("note"),
+          std::make_shared<VDP::Fixed16>(
+              "volts", 0.01f, 0.0f, [&]() { return count * 0.5f; }),
+          std::make_shared<VDP::Int8>("neg",
+                                      [&]() { return (int8_t)-count; })});
+  uint16_t reading = 0;
+  auto series = std::make_shared<VDP::Series>(
+      "fast",
+      std::make_shared<VDP::Uint16>("reading", [&]() { return reading++; }),
+      3);
+  const VDP::ChannelID rec_id = pair.controller.open_channel(rec);
+  const VDP::ChannelID series_id = pair.controller.open_channel(series);
+  if (!pair.controller.negotiate()) {
+    return false;
+  }
+
+  // 6 messages into 4 rows, the last two wrap around
+  for (count = 1; count <= 6; count++) {
+    now += 1000;
+    rec->fetch();
+    pair.controller.send_data(rec_id, rec);
+  }
+  const VDP::ChannelColumns *cols = sink.channel(rec_id);
+  if (cols == nullptr || cols->num_columns() != 3 || cols->rows() != 4 ||
+      cols->overwritten() != 2 || cols->find("note") != 3) {
+    return false;
+  }
+  const size_t count_col = cols->find("count");
+  const VDP::ColumnSpans<uint32_t> counts = cols->values<uint32_t>(count_col);
+  const VDP::ColumnSpans<uint64_t> times = cols->times();
+  if (counts.size() != 4 || counts.first_size != 2 ||
+      cols->values<float>(count_col).size() != 0 ||
+      cols->values<int32_t>(count_col).size() != 0) {
+    return false;
+  }
+  const VDP::ColumnSpans<float> volts =
+      cols->values<float>(cols->find("volts"));
+  const VDP::ColumnSpans<int8_t> negs =
+      cols->values<int8_t>(cols->find("neg"));
+  for (size_t row = 0; row < 4; row++) {
+    const uint32_t sent = (uint32_t)row + 3;
+    if (counts[row] != sent || times[row] != 5000 + sent * 1000 ||
+        volts[row] != sent * 0.5f || negs[row] != -(int8_t)sent ||
+        cols->value(cols->find("neg"), row) != -(double)sent) {
+      return false;
+    }
+  }
+
+  // Appending doesn't allocate once the columns are set up
+  if (AllocCounter::enabled()) {
+    const AllocCounter::Scope counter;
+    for (int i = 0; i < 10; i++) {
+      sink.append(VDP::Channel{pair.listener.get_remote_schema(rec_id)}, now);
+    }
+    if (counter.allocations() != 0) {
+      return false;
+    }
+  }
+
+  // A series adds a row per sample at its own time
+  for (uint64_t t = 0; t < 3; t++) {
+    series->sample(100 + t * 10);
+  }
+  pair.controller.send_data(series_id, series);
+  const VDP::ChannelColumns *samples = sink.channel(series_id);
+  if (samples == nullptr || samples->num_columns() != 1 ||
+      samples->rows() != 3) {
+    return false;
+  }
+  for (size_t row = 0; row < 3; row++) {
+    if (samples->times()[row] != 100 + row * 10 ||
+        samples->values<uint16_t>(0)[row] != row) {
+      return false;
+    }
+  }
+  sink.clear();
+  return sink.channel(rec_id)->rows() == 0 &&
+         sink.channel(series_id)->rows() == 0;
+}
+} // namespace SchedulerTest
+namespace LayoutTest {
+// Data as written by the parts themselves, without header and checksum
+static VDP::Packet encode_plain(const VDP::PartPtr &part) {
+  VDP::Packet out;
+  VDP::PacketWriter writer{out};
+  writer.write_data_message(VDP::Channel{part});
+  return VDP::Packet(out.begin() + 2, out.end() - 4);
+}
+static VDP::Packet encode_plan(const VDP::LayoutPlan &plan) {
+  VDP::Packet out;
+  VDP::PacketWriter writer{out};
+  plan.write(writer);
+  return out;
+}
+
+static bool test_layout_plan() {
+  auto a = std::make_shared<VDP::Uint32>("a");
+  auto b = std::make_shared<VDP::Float>("b");
+  auto c = std::make_shared<VDP::Uint8>("c");
+  auto fixed = std::make_shared<VDP::Record>(
+      "fixed", std::vector<VDP::PartPtr>{a, b, c});
+  a->setValue(0xdeadbeef);
+  b->setValue(4.25f);
+  c->setValue(7);
+
+  VDP::Packet expected = encode_plain(fixed);
+  {
+    VDP::LayoutPlan plan{fixed};
+    // Numbers only: the whole record is one copy
+    if (!plan.is_fixed() || plan.num_steps() != 1 ||
+        encode_plan(plan) != expected) {
+      return false;
+    }
+    // Values set while bound go through the plan's block
+    b->setValue(-1.0f);
+    expected = encode_plain(fixed);
+    if (encode_plan(plan) != expected) {
+      return false;
+    }
+  }
+  // Values survive the plan going away
+  if (b->getValue() != -1.0f || a->getValue() != 0xdeadbeef) {
+    return false;
+  }
+
+  auto s = std::make_shared<VDP::String>("s");
+  auto d = std::make_shared<VDP::Double>("d");
+  auto mixed = std::make_shared<VDP::Record>(
+      "mixed", std::vector<VDP::PartPtr>{fixed, s, d});
+  s->setValue("between");
+  d->setValue(0.5);
+  VDP::LayoutPlan plan{mixed};
+  if (plan.is_fixed() || plan.num_steps() != 3) {
+    return false;
+  }
+  const VDP::Packet message = encode_plan(plan);
+  if (message != encode_plain(mixed)) {
+    return false;
+  }
+
+  // Decode into a second tree built from the schema
+  VDP::Packet scratch;
+  VDP::PacketWriter writer{scratch};
+  writer.write_channel_broadcast(VDP::Channel{mixed});
+  const VDP::PartPtr decoded = VDP::decode_broadcast(scratch).second;
+  VDP::LayoutPlan decode_plan{decoded};
+  VDP::PacketReader reader{message};
+  if (!decode_plan.read(reader) ||
+      decoded->pretty_print_data() != mixed->pretty_print_data()) {
+    return false;
+  }
+  VDP::PacketReader truncated{message.data(), message.size() - 1};
+  return !decode_plan.read(truncated) &&
+         truncated.status() == VDP::ReadStatus::PastEnd;
+}
+
+static bool test_reader_bounds() {
+  const uint8_t bytes[] = {1, 2, 3, 'h', 'i', 0, 'n', 'o'};
+  VDP::PacketReader reader{bytes, sizeof(bytes)};
+  if (reader.get_number<uint16_t>() != 0x0201 || reader.get_byte() != 3 ||
+      reader.get_string() != "hi" || reader.get_view(1) != &bytes[6]) {
+    return false;
+  }
+  // Only one byte left: the failed read moves nothing and sticks
+  if (reader.get_number<uint16_t>() != 0 ||
+      reader.status() != VDP::ReadStatus::PastEnd || reader.get_byte() != 0 ||
+      reader.position() != 7) {
+    return false;
+  }
+  VDP::PacketReader unterminated{bytes, sizeof(bytes), 6};
+  if (unterminated.get_string() != "" ||
+      unterminated.status() != VDP::ReadStatus::Unterminated) {
+    return false;
+  }
+
+  // Broken broadcasts are rejected rather than half decoded
+  auto rec = std::make_shared<VDP::Record>(
+      "rec", std::vector<VDP::PartPtr>{std::make_shared<VDP::Float>("f")});
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(VDP::Channel{rec});
+  // header, id, record type, "rec", field count
+  const size_t count_at = 2 + 1 + 4;
+  if (VDP::decode_broadcast(broadcast).second == nullptr) {
+    return false;
+  }
+  VDP::Packet bad_count = broadcast;
+  bad_count[count_at + 3] = 0x10;
+  VDP::Packet bad_type = broadcast;
+  bad_type[count_at + 4] = 0xee;
+  const VDP::Packet truncated(broadcast.begin(), broadcast.begin() + count_at);
+  return VDP::decode_broadcast(bad_count).second == nullptr &&
+         VDP::decode_broadcast(bad_type).second == nullptr &&
+         VDP::decode_broadcast(truncated).second == nullptr;
+}
+
+static bool test_compact_integers() {
+  auto count = std::make_shared<VDP::Uint32>("count");
+  auto offset = std::make_shared<VDP::Int16>("offset");
+  auto big = std::make_shared<VDP::Uint64>("big");
+  auto f = std::make_shared<VDP::Float>("f");
+  auto rec = std::make_shared<VDP::Record>(
+      "rec", std::vector<VDP::PartPtr>{count, offset, big, f});
+  const size_t fixed_size = encode_plain(rec).size();
+  rec->use_compact_integers(true);
+  count->setValue(100);
+  offset->setValue(-3);
+  big->setValue(0xffffffffffffffffULL);
+  f->setValue(1.5f);
+
+  // The listener learns the encoding from the schema
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(VDP::Channel{rec});
+  const VDP::PartPtr decoded = VDP::decode_broadcast(broadcast).second;
+  if (decoded == nullptr || decoded->pretty_print() != rec->pretty_print()) {
+    return false;
+  }
+  const VDP::Packet message = encode_plain(rec);
+  VDP::PacketReader reader{message};
+  decoded->read_data_from_message(reader);
+  // 1 + 1 + 10 varint bytes and the float as it was
+  if (!reader.ok() || reader.remaining() != 0 || message.size() != 16 ||
+      fixed_size != 18 ||
+      decoded->pretty_print_data() != rec->pretty_print_data()) {
+    return false;
+  }
+  {
+    // Compiled plans fall back to the parts for compact fields
+    VDP::LayoutPlan plan{rec};
+    if (plan.is_fixed() || encode_plan(plan) != message) {
+      return false;
+    }
+  }
+
+  // 300 doesn't fit a uint8 and a varint can't run past 10 bytes
+  const uint8_t too_big[] = {0xac, 0x02};
+  VDP::PacketReader small{too_big, sizeof(too_big)};
+  uint8_t too_long[11];
+  std::memset(too_long, 0x80, sizeof(too_long));
+  VDP::PacketReader runaway{too_long, sizeof(too_long)};
+  return small.get_compact<uint8_t>() == 0 &&
+         small.status() == VDP::ReadStatus::BadVarint &&
+         runaway.get_varint() == 0 &&
+         runaway.status() == VDP::ReadStatus::BadVarint;
+}
+
+static bool test_quantized_floats() {
+  // Every half survives the trip through a float unchanged
+  for (uint32_t h = 0; h <= 0xffff; h++) {
+    const bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x03ff) != 0;
+    if (!nan && VDP::float_to_half(VDP::half_to_float((uint16_t)h)) != h) {
+      return false;
+    }
+  }
+  // Ties go to even, too big is infinity, tiny is the smallest subnormal
+  if (VDP::float_to_half(2049.0f) != VDP::float_to_half(2048.0f) ||
+      VDP::half_to_float(VDP::float_to_half(2051.0f)) != 2052.0f ||
+      VDP::float_to_half(1e6f) != 0x7c00 ||
+      VDP::float_to_half(-1e6f) != 0xfc00 ||
+      VDP::float_to_half(6e-8f) != 0x0001) {
+    return false;
+  }
+  if (VDP::quantize_fixed16(1.2346f, 1000.0f, 0) != 1235 ||
+      VDP::quantize_fixed16(-1.2346f, 1000.0f, 0) != -1235 ||
+      VDP::quantize_fixed16(100.0f, 1000.0f, 0) != 32767 ||
+      VDP::quantize_fixed16(-100.0f, 1000.0f, 0) != -32768 ||
+      VDP::quantize_fixed16(NAN, 1000.0f, 0) != 0) {
+    return false;
+  }
+
+  auto half = std::make_shared<VDP::Half>("half");
+  auto fixed = std::make_shared<VDP::Fixed16>("fixed", 0.5f, 100.0f);
+  auto rec = std::make_shared<VDP::Record>(
+      "rec", std::vector<VDP::PartPtr>{half, fixed});
+  half->setValue(3.14159f);
+  fixed->setValue(42.3f);
+  if (std::fabs(half->getValue() - 3.14159f) > 0.002f ||
+      fixed->getValue() != 42.5f) {
+    return false;
+  }
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(VDP::Channel{rec});
+  const VDP::PartPtr decoded = VDP::decode_broadcast(broadcast).second;
+  if (decoded == nullptr || decoded->pretty_print() != rec->pretty_print()) {
+    return false;
+  }
+  const VDP::Packet message = encode_plain(rec);
+  VDP::PacketReader reader{message};
+  decoded->read_data_from_message(reader);
+  if (!reader.ok() || message.size() != 4 ||
+      decoded->pretty_print_data() != rec->pretty_print_data()) {
+    return false;
+  }
+  // A scale of 0 can't be decoded
+  auto zero = std::make_shared<VDP::Fixed16>("zero", 0.0f);
+  VDP::Packet bad;
+  VDP::PacketWriter{bad}.write_channel_broadcast(VDP::Channel{zero});
+  return VDP::decode_broadcast(bad).second == nullptr;
+}
+
+static bool test_arrays() {
+  auto id = std::make_shared<VDP::Uint8>("id");
+  auto currents = std::make_shared<VDP::Array<VDP::Float>>("currents", 8);
+  auto samples = std::make_shared<VDP::Array<VDP::Half>>(
+      "samples", 16, VDP::ArrayLength::Bounded);
+  auto volts = std::make_shared<VDP::Array<VDP::Fixed16>>(
+      "volts", 4, VDP::ArrayLength::Fixed,
+      VDP::Array<VDP::Fixed16>::Codec{0.01f});
+  auto rec = std::make_shared<VDP::Record>(
+      "rec", std::vector<VDP::PartPtr>{id, currents, samples, volts});
+
+  const float amps[8] = {0.5f, 1, 1.5f, 2, 2.5f, 3, 3.5f, 4};
+  const float wave[5] = {0, 0.25f, -0.5f, 1000, 1e-3f};
+  const float v[4] = {12.0f, 11.96f, -1.234f, 400.0f};
+  id->setValue(3);
+  currents->setValues(amps, 8);
+  samples->setValues(wave, 5);
+  volts->setValues(v, 4);
+  float out[8] = {0};
+  if (currents->getValues(out, 8) != 8 || std::memcmp(out, amps, 32) != 0 ||
+      samples->size() != 5 || std::fabs(samples->getValue(4) - 1e-3f) > 1e-6f ||
+      std::fabs(volts->getValue(2) + 1.23f) > 1e-4f ||
+      std::fabs(volts->getValue(3) - 327.67f) > 1e-3f) {
+    return false;
+  }
+
+  // id, 8 floats, count and 5 halves, 4 int16s
+  VDP::Packet expected = encode_plain(rec);
+  if (expected.size() != 1 + 32 + 2 + 10 + 8) {
+    return false;
+  }
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(VDP::Channel{rec});
+  const VDP::PartPtr decoded = VDP::decode_broadcast(broadcast).second;
+  if (decoded == nullptr || decoded->pretty_print() != rec->pretty_print()) {
+    return false;
+  }
+  {
+    VDP::PacketReader reader{expected};
+    decoded->read_data_from_message(reader);
+    if (!reader.ok() || reader.remaining() != 0 ||
+        decoded->pretty_print_data() != rec->pretty_print_data()) {
+      return false;
+    }
+  }
+  {
+    // The fixed arrays join the block, the bounded one can't
+    VDP::LayoutPlan plan{rec};
+    if (plan.num_steps() != 3 || encode_plan(plan) != expected) {
+      return false;
+    }
+    // Changes made while the plan holds the elements go through it
+    volts->setValue(0, -5.0f);
+    if (volts->getValue(0) != -5.0f ||
+        encode_plan(plan) != encode_plain(rec)) {
+      return false;
+    }
+  }
+  if (volts->getValue(0) != -5.0f) {
+    return false;
+  }
+
+  // More elements than the schema allows
+  const uint8_t too_many[] = {17, 0};
+  VDP::PacketReader reader{too_many, sizeof(too_many)};
+  samples->read_data_from_message(reader);
+  return reader.status() == VDP::ReadStatus::BadSchema && samples->size() == 5;
+}
+
+// Padding after temp and before count
+struct DriveSample {
+  float left;
+  uint8_t temp;
+  int16_t turn;
+  uint32_t count;
+  double heading;
+};
+using DriveRecord = VDP::StaticRecord<
+    DriveSample, VDP_STATIC_NAME("drive"), VDP_STATIC_FIELD(DriveSample, left),
+    VDP_STATIC_FIELD_NAMED(DriveSample, temp, "Temperature(C)"),
+    VDP_STATIC_FIELD(DriveSample, turn), VDP_STATIC_FIELD(DriveSample, count),
+    VDP_STATIC_FIELD(DriveSample, heading)>;
+
+struct PackedSample {
+  uint16_t a;
+  uint16_t b;
+};
+using PackedRecord = VDP::StaticRecord<PackedSample, VDP_STATIC_NAME("packed"),
+                                       VDP_STATIC_FIELD(PackedSample, b),
+                                       VDP_STATIC_FIELD(PackedSample, a)>;
+
+static bool test_static_records() {
+  static_assert(DriveRecord::wire_size == 4 + 1 + 2 + 4 + 8,
+                "Padding isn't sent");
+  auto drive = std::make_shared<DriveRecord>([](DriveSample &s) { s.count++; });
+  DriveSample sample{1.5f, 41, -300, 70000, -2.25};
+  drive->set(sample);
+  drive->fetch();
+
+  // The same record made of parts
+  auto dynamic = std::make_shared<VDP::Record>(
+      "drive",
+      std::vector<VDP::PartPtr>{
+          std::make_shared<VDP::Float>("left", []() { return 1.5f; }),
+          std::make_shared<VDP::Uint8>("Temperature(C)",
+                                       []() { return (uint8_t)41; }),
+          std::make_shared<VDP::Int16>("turn", []() { return (int16_t)-300; }),
+          std::make_shared<VDP::Uint32>("count", []() { return 70001u; }),
+          std::make_shared<VDP::Double>("heading", []() { return -2.25; })});
+  dynamic->fetch();
+  if (drive->pretty_print() != dynamic->pretty_print() ||
+      drive->pretty_print_data() != dynamic->pretty_print_data()) {
+    return false;
+  }
+
+  // Identical on the wire, so the listener needs nothing new
+  VDP::Packet static_broadcast;
+  VDP::PacketWriter{static_broadcast}.write_channel_broadcast(
+      VDP::Channel{drive});
+  VDP::Packet dynamic_broadcast;
+  VDP::PacketWriter{dynamic_broadcast}.write_channel_broadcast(
+      VDP::Channel{dynamic});
+  const VDP::Packet message = encode_plain(drive);
+  if (static_broadcast != dynamic_broadcast ||
+      message != encode_plain(dynamic)) {
+    return false;
+  }
+  {
+    VDP::LayoutPlan plan{drive};
+    if (plan.num_steps() != 1 || encode_plan(plan) != message) {
+      return false;
+    }
+    sample.turn = 5;
+    drive->set(sample);
+    if (drive->get().turn != 5 || encode_plan(plan) != encode_plain(drive)) {
+      return false;
+    }
+  }
+
+  // Decodes back into the struct
+  auto copy = std::make_shared<DriveRecord>();
+  VDP::PacketReader reader{message};
+  copy->read_data_from_message(reader);
+  const DriveSample got = copy->get();
+  if (!reader.ok() || got.left != 1.5f || got.temp != 41 || got.turn != -300 ||
+      got.count != 70001 || got.heading != -2.25) {
+    return false;
+  }
+
+  // Its single leaf can't be diffed against the listener's fields, so delta
+  // encoding is refused, for it alone or inside another record
+  {
+    VDP::LinkedPair pair;
+    const VDP::ChannelID id = pair.controller.open_channel(drive);
+    const VDP::ChannelID outer = pair.controller.open_channel(
+        std::make_shared<VDP::Record>("outer",
+                                      std::vector<VDP::PartPtr>{copy}));
+    const VDP::ChannelID plain = pair.controller.open_channel(dynamic);
+    if (pair.controller.enable_delta(id) ||
+        pair.controller.enable_delta(outer) ||
+        !pair.controller.enable_delta(plain)) {
+      return false;
+    }
+  }
+
+  // Fields go in the order they are listed, not the struct's
+  auto packed = std::make_shared<PackedRecord>();
+  packed->set(PackedSample{1, 2});
+  const VDP::Packet expected = {2, 0, 1, 0};
+  return encode_plain(packed) == expected && packed->get().a == 1;
+}
+
+// Replacing a record's fields after its channel is open
+static bool test_set_fields() {
+  VDP::LinkedPair pair;
+  auto a = std::make_shared<VDP::Uint32>("a");
+  auto b = std::make_shared<VDP::Float>("b");
+  auto record = std::make_shared<VDP::Record>(
+      "rec", std::vector<VDP::PartPtr>{a, b});
+  const VDP::ChannelID id = pair.controller.open_channel(record);
+  pair.controller.enable_delta(id, 4);
+  if (!pair.controller.negotiate()) {
+    return false;
+  }
+  a->setValue(1);
+  b->setValue(1.5f);
+  pair.controller.send_data(id, record);
+
+  // Same types, so the listener's schema still fits
+  const std::weak_ptr<VDP::Part> old_field = a;
+  auto c = std::make_shared<VDP::Uint32>("a");
+  auto d = std::make_shared<VDP::Float>("b");
+  c->setValue(7);
+  d->setValue(-2.0f);
+  record->setFields({c, d});
+  a.reset();
+  b.reset();
+  // The old plan still has them bound until the channel plans again
+  if (old_field.expired()) {
+    return false;
+  }
+  pair.controller.send_data(id, record);
+  return old_field.expired() &&
+         pair.listener.get_remote_schema(id)->pretty_print_data() ==
+             record->pretty_print_data();
+}
+
+static bool test_schema_arena() {
+  // Objects land aligned, and are destroyed with the arena
+  int destroyed = 0;
+  struct Tracked {
+    explicit Tracked(int *count) : count(count) {}
+    ~Tracked() { (*count)++; }
+    int *count;
+    double value = 1.0;
+  };
+  {
+    VDP::SchemaArena arena{64};
+    for (int i = 0; i < 20; i++) {
+      arena.make<uint8_t>((uint8_t)i);
+      const Tracked *t = arena.make<Tracked>(&destroyed);
+      if ((uintptr_t)t % alignof(Tracked) != 0 || t->value != 1.0) {
+        return false;
+      }
+    }
+    if (arena.stats().objects != 40 || arena.stats().chunks < 2 ||
+        destroyed != 0) {
+      return false;
+    }
+  }
+  if (destroyed != 20) {
+    return false;
+  }
+
+  // A wide schema, a record of records of counters
+  const auto metrics = std::make_shared<VDP::LinkMetrics>("link", 8);
+  metrics->fetch();
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(VDP::Channel{metrics});
+  const VDP::Packet message = encode_plain(metrics);
+
+  uint64_t heap_allocations = 0;
+  VDP::PartPtr heap_tree;
+  {
+    const AllocCounter::Scope counter;
+    VDP::PacketReader reader{broadcast, 2};
+    heap_tree = VDP::make_decoder(reader);
+    heap_allocations = counter.allocations();
+  }
+  uint64_t arena_allocations = 0;
+  VDP::PartPtr arena_tree;
+  {
+    const AllocCounter::Scope counter;
+    arena_tree = VDP::decode_broadcast(broadcast).second;
+    arena_allocations = counter.allocations();
+  }
+  if (arena_tree == nullptr ||
+      (AllocCounter::enabled() && arena_allocations * 4 > heap_allocations)) {
+    return false;
+  }
+  // The root alone owns the tree
+  if (arena_tree.use_count() != 1) {
+    return false;
+  }
+  for (const VDP::PartPtr &tree : {heap_tree, arena_tree}) {
+    VDP::PacketReader reader{message};
+    tree->read_data_from_message(reader);
+    if (!reader.ok() ||
+        tree->pretty_print_data() != metrics->pretty_print_data()) {
+      return false;
+    }
+  }
+  // A channel's plan keeps the tree alive after everything else lets go
+  VDP::Part *const raw = arena_tree.get();
+  auto plan = std::make_shared<VDP::LayoutPlan>(arena_tree);
+  arena_tree = nullptr;
+  VDP::PacketReader reader{message};
+  return raw == plan->root() && plan->read(reader) &&
+         raw->pretty_print_data() == metrics->pretty_print_data();
+}
+} // namespace LayoutTest
+namespace CRC32Test {
+static bool test_bulk_matches_bytewise() {
+  // Standard check value for CRC-32/ISO-HDLC
+  const char *check = "123456789";
+  if (CRC32::calculate((const uint8_t *)check, 9) != 0xcbf43926) {
+    return false;
+  }
+
+  uint8_t data[67];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = (uint8_t)(i * 37 + 11);
+  }
+  // Every length and alignment through the 8 byte blocks and the tail
+  for (size_t start = 0; start < 8; start++) {
+    for (size_t len = 0; start + len <= sizeof(data); len++) {
+      CRC32 bytewise;
+      for (size_t i = start; i < start + len; i++) {
+        bytewise.update(data[i]);
+      }
+      if (CRC32::calculate(data + start, len) != bytewise.finalize()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+} // namespace CRC32Test
+namespace ByteRingTest {
+template <typename Ring> static bool check_wraparound(Ring &ring) {
+  // Odd sized records so that padding and wrapping both get exercised over
+  // many laps of the buffer
+  uint8_t next_write = 0;
+  uint8_t next_read = 0;
+  for (uint32_t i = 0; i < 1000; i++) {
+    const uint32_t len = 1 + (i * 7) % 60;
+    const ByteRing::Reservation res = ring.reserve(len);
+    if (!res.valid()) {
+      return false;
+    }
+    for (uint32_t j = 0; j < len; j++) {
+      res.data[j] = next_write++;
+    }
+    ring.commit(res, len);
+    if (i % 3 == 0) {
+      continue; // let a couple records build up
+    }
+    ByteRing::Record rec;
+    while ((rec = ring.peek()).valid()) {
+      for (uint32_t j = 0; j < rec.len; j++) {
+        if (rec.data[j] != next_read++) {
+          return false;
+        }
+      }
+      ring.release(rec);
+    }
+  }
+  return true;
+}
+static bool test_wraparound() {
+  MPSCByteRing ring{256};
+  // Rounded up rather than left unusable
+  MPSCByteRing odd{200};
+  return check_wraparound(ring) && odd.capacity() == 256 &&
+         check_wraparound(odd);
+}
+
+static constexpr uint32_t records_per_producer = 2000;
+static MPSCByteRing shared_ring{1024};
+
+static int producer(void *arg) {
+  const uint32_t producer_id = (uint32_t)(uintptr_t)arg;
+  for (uint32_t seq = 0; seq < records_per_producer;) {
+    const ByteRing::Reservation res = shared_ring.reserve(8);
+    if (!res.valid()) {
+      VDB::delay_ms(1);
+      continue;
+    }
+    std::memcpy(res.data, &producer_id, 4);
+    std::memcpy(res.data + 4, &seq, 4);
+    shared_ring.commit(res, 8);
+    seq++;
+  }
+  return 0;
+}
+static bool test_multiple_producers() {
+  vex::task a{producer, (void *)0};
+  vex::task b{producer, (void *)1};
+
+  uint32_t expected[2] = {0, 0};
+  const uint32_t start = VDB::time_ms();
+  while (expected[0] + expected[1] < 2 * records_per_producer) {
+    if (VDB::time_ms() - start > 5000) {
+      return false;
+    }
+    const ByteRing::Record rec = shared_ring.peek();
+    if (!rec.valid()) {
+      continue;
+    }
+    uint32_t producer_id = 0;
+    uint32_t seq = 0;
+    std::memcpy(&producer_id, rec.data, 4);
+    std::memcpy(&seq, rec.data + 4, 4);
+    if (rec.len != 8 || producer_id > 1 || seq != expected[producer_id]) {
+      return false;
+    }
+    expected[producer_id]++;
+    shared_ring.release(rec);
+  }
+  return true;
+}
+} // namespace ByteRingTest
+namespace COBSTest {
+static bool test_stream_decoder() {
+  // Zeros at the edges, back to back zeros and runs longer than a COBS block
+  std::vector<VDP::Packet> packets;
+  packets.push_back({1, 2, 3});
+  packets.push_back({0, 0, 5, 0});
+  packets.push_back(VDP::Packet(300, 0x7f));
+  packets.push_back(VDP::Packet(254, 0x11));
+  packets.push_back({0});
+  packets.back().resize(600, 0xaa);
+
+  COBSSerialDevice::WirePacket stream;
+  for (const VDP::Packet &pac : packets) {
+    COBSSerialDevice::WirePacket wire;
+    COBSSerialDevice::cobs_encode(pac, wire);
+    stream.insert(stream.end(), wire.begin(), wire.end());
+  }
+
+  COBSStreamDecoder decoder{COBSSerialDevice::MAX_PACKET_SIZE};
+  size_t next = 0;
+  for (const uint8_t b : stream) {
+    if (decoder.feed(b)) {
+      if (next >= packets.size() || decoder.frame() != packets[next]) {
+        return false;
+      }
+      next++;
+    }
+  }
+  return next == packets.size() && decoder.num_dropped() == 0;
+}
+
+#ifndef VexV5
+// A device nobody services but the test, paced by a clock the test moves
+class SteppedSerialDevice : public COBSSerialDevice {
+public:
+  SteppedSerialDevice(int32_t port, int32_t baud_rate)
+      : COBSSerialDevice(port, baud_rate) {
+    set_clock([]() { return now_us; });
+  }
+  using COBSSerialDevice::send_cobs_packet;
+  using COBSSerialDevice::service;
+  void cobs_packet_callback(const Packet &pac) override {
+    received_headers.push_back(pac[0]);
+  }
+
+  static uint64_t now_us;
+  std::vector<uint8_t> received_headers;
+};
+uint64_t SteppedSerialDevice::now_us = 1000000;
+
+// Needs two ports wired together, which only the host stand-in can do
+static bool test_transmit_priority_and_rate() {
+  hostSerialConnect(vex::PORT5, vex::PORT6);
+  // 11520 bytes per second
+  SteppedSerialDevice tx{vex::PORT5, 115200};
+  SteppedSerialDevice rx{vex::PORT6, 115200 * 100};
+
+  VDP::Packet data(200, 0x55);
+  data[0] = VDP::make_header_byte(
+      VDP::PacketHeader{VDP::PacketType::Data, VDP::PacketFunction::Send, 0});
+  VDP::Packet ack(6, 0x11);
+  ack[0] = VDP::make_header_byte(VDP::PacketHeader{
+      VDP::PacketType::Broadcast, VDP::PacketFunction::Acknowledge, 0});
+
+  // More than the data queue holds, then an ack that has to jump the queue
+  for (int i = 0; i < 100; i++) {
+    tx.send_cobs_packet(data, VDB::Device::priority_of(data));
+  }
+  const bool ack_queued =
+      tx.send_cobs_packet(ack, VDB::Device::priority_of(ack));
+  // 200ms of link time, a millisecond at a time
+  const uint64_t start = SteppedSerialDevice::now_us;
+  tx.service();
+  for (int ms = 0; ms < 200; ms++) {
+    SteppedSerialDevice::now_us += 1000;
+    tx.service();
+    // Polled again before any more tokens come in, which has to wait
+    tx.service();
+    rx.service();
+  }
+  const uint64_t elapsed_us = SteppedSerialDevice::now_us - start;
+  const COBSSerialDevice::TransmitStats stats = tx.transmit_stats();
+
+  // One bucket's burst, then exactly the link rate
+  const uint32_t allowed = COBSSerialDevice::TOKEN_BUCKET_BYTES +
+                           (uint32_t)(tx.link_bytes_per_second() *
+                                      elapsed_us / 1000000);
+  const size_t data_queue = (size_t)COBSSerialDevice::Priority::Data;
+  return ack_queued && !rx.received_headers.empty() &&
+         rx.received_headers[0] == ack[0] &&
+         rx.received_headers.size() > 4 && stats.sent_bytes <= allowed &&
+         stats.sent_bytes + 2 * data.size() >= allowed &&
+         stats.dropped[data_queue] > 0 && stats.deferrals > 0;
+}
+#endif
+} // namespace COBSTest
+#ifndef VexV5
+namespace CaptureTest {
+static bool test_capture_file() {
+  const char *path = "/tmp/vdb_capture_test.vdc";
+  // Small enough that there are plenty of Syncs and buffer flushes
+  VDP::CaptureWriter::Config cfg;
+  cfg.buffer_bytes = 100;
+  cfg.sync_bytes = 256;
+
+  // Everything the listener's device sees goes in the file
+  {
+    VDP::CaptureWriter writer{cfg};
+    if (!writer.open(path)) {
+      return false;
+    }
+    VDP::Link link;
+    VDP::CaptureDevice tap{&link.to_controller, writer};
+    VDP::Registry controller{&link.to_listener,
+                             VDP::Registry::Side::Controller};
+    VDP::Registry listener{&tap, VDP::Registry::Side::Listener};
+    listener.install_broadcast_callback([](const VDP::Channel &) {});
+    uint32_t count = 0;
+    auto counter =
+        std::make_shared<VDP::Uint32>("count", [&]() { return count++; });
+    const VDP::ChannelID id = controller.open_channel(counter);
+    if (!controller.negotiate()) {
+      return false;
+    }
+    for (int i = 0; i < 50; i++) {
+      counter->fetch();
+      controller.send_data(id, counter);
+    }
+    writer.close();
+    if (writer.stats().syncs < 3 || writer.stats().write_errors != 0) {
+      return false;
+    }
+  }
+  VDP::CaptureReader reader;
+  if (!reader.open(path) || !reader.had_index()) {
+    return false;
+  }
+  int schemas = 0;
+  int data = 0;
+  int sent = 0;
+  VDP::CaptureFrame frame;
+  VDP::CaptureReader::Cursor all = reader.begin();
+  uint64_t last_time = 0;
+  while (all.next(frame)) {
+    if (frame.time_us < last_time || frame.kind == VDP::CaptureKind::Sync) {
+      return false;
+    }
+    last_time = frame.time_us;
+    if (frame.direction == VDP::CaptureDirection::Sent) {
+      sent++; // Acks and the schema request
+    } else if (frame.kind == VDP::CaptureKind::Schema) {
+      schemas++;
+    } else if (VDP::decode_header_byte(frame.data[0]).type ==
+               VDP::PacketType::Data) {
+      data++;
+    }
+  }
+  if (schemas != 1 || data != 50 || sent < 2 ||
+      last_time != reader.end_time_us()) {
+    return false;
+  }
+
+  // Made up times to seek through: a schema, then a frame every 100us
+  VDP::Packet broadcast;
+  VDP::PacketWriter{broadcast}.write_channel_broadcast(
+      VDP::Channel{std::make_shared<VDP::Uint8>("x")});
+  VDP::Packet message(12, 0);
+  message[0] = VDP::make_header_byte(
+      VDP::PacketHeader{VDP::PacketType::Data, VDP::PacketFunction::Send, 0});
+  VDP::CaptureWriter writer{cfg};
+  writer.open(path);
+  writer.append(VDP::CaptureDirection::Received, 1000, broadcast);
+  for (uint32_t i = 0; i < 200; i++) {
+    std::memcpy(&message[2], &i, sizeof(i));
+    writer.append(VDP::CaptureDirection::Received, 1000 + i * 100, message);
+  }
+  for (int closed = 0; closed < 2; closed++) {
+    if (closed == 0) {
+      writer.flush(); // No index yet, the reader has to walk the file
+    } else {
+      writer.close();
+    }
+    if (!reader.open(path) || reader.had_index() != (closed == 1) ||
+        reader.num_syncs() < 10 || reader.start_time_us() != 1000 ||
+        reader.end_time_us() != 1000 + 199 * 100) {
+      return false;
+    }
+    // The channel's schema comes first even though it was long before
+    VDP::CaptureReader::Cursor at = reader.seek(10050);
+    const size_t start = at.offset();
+    if (!at.next(frame) || frame.kind != VDP::CaptureKind::SchemaCopy ||
+        frame.size != broadcast.size()) {
+      return false;
+    }
+    uint32_t i = 0;
+    if (!at.next(frame) || frame.kind != VDP::CaptureKind::Frame ||
+        frame.time_us != 10100) {
+      return false;
+    }
+    std::memcpy(&i, frame.data + 2, sizeof(i));
+    // Started from a nearby Sync rather than the beginning
+    if (i != 91 || at.offset() - start > 2 * cfg.sync_bytes) {
+      return false;
+    }
+    int rest = 1;
+    while (at.next(frame)) {
+      rest++;
+    }
+    if (rest != 200 - 91) {
+      return false;
+    }
+  }
+  reader.close();
+  std::remove(path);
+  return true;
+}
+// The first write that fails ends the capture
+static bool test_capture_write_error() {
+  VDP::CaptureWriter::Config cfg;
+  cfg.buffer_bytes = 100;
+  VDP::CaptureWriter writer{cfg};
+  // Every write to it fails for want of space
+  if (!writer.open("/dev/full")) {
+    return false;
+  }
+  VDP::Packet message(12, 0);
+  for (uint32_t i = 0; i < 20; i++) {
+    writer.append(VDP::CaptureDirection::Received, i * 100, message);
+  }
+  writer.flush();
+  const uint32_t frames = writer.stats().frames;
+  writer.append(VDP::CaptureDirection::Received, 2000, message);
+  writer.close();
+  const VDP::CaptureWriter::Stats stats = writer.stats();
+  if (stats.write_errors != 1 || stats.bytes != 0 || stats.frames != frames) {
+    return false;
+  }
+
+  // Opening another file starts over
+  const char *path = "/tmp/vdb_capture_error_test.vdc";
+  writer.open(path);
+  writer.append(VDP::CaptureDirection::Received, 0, message);
+  writer.close();
+  VDP::CaptureReader reader;
+  const bool ok = reader.open(path) && reader.had_index() &&
+                  writer.stats().write_errors == 1;
+  reader.close();
+  std::remove(path);
+  return ok;
+}
+// Times from several tasks don't arrive in order
+static bool test_capture_out_of_order() {
+  const char *path = "/tmp/vdb_capture_order_test.vdc";
+  VDP::CaptureWriter::Config cfg;
+  cfg.sync_bytes = 256;
+  VDP::Packet message(12, 0);
+  message[0] = VDP::make_header_byte(
+      VDP::PacketHeader{VDP::PacketType::Data, VDP::PacketFunction::Send, 0});
+  uint32_t in_order_syncs = 0;
+  for (int shuffled = 0; shuffled < 2; shuffled++) {
+    VDP::CaptureWriter writer{cfg};
+    writer.open(path);
+    for (uint32_t i = 0; i < 200; i++) {
+      std::memcpy(&message[2], &i, sizeof(i));
+      // Every third frame was stamped before the one ahead of it
+      const uint64_t late = shuffled == 1 && i % 3 == 2 ? 150 : 0;
+      writer.append(VDP::CaptureDirection::Received, 1000 + i * 100 - late,
+                    message);
+    }
+    writer.close();
+    if (shuffled == 0) {
+      in_order_syncs = writer.stats().syncs;
+    } else if (writer.stats().syncs != in_order_syncs) {
+      return false; // No extra Syncs for going backwards
+    }
+  }
+
+  VDP::CaptureReader reader;
+  if (!reader.open(path) || !reader.had_index()) {
+    return false;
+  }
+  VDP::CaptureFrame frame;
+  VDP::CaptureReader::Cursor all = reader.begin();
+  uint64_t last_time = 0;
+  while (all.next(frame)) {
+    if (frame.time_us < last_time) {
+      return false;
+    }
+    last_time = frame.time_us;
+  }
+  // Frame 92 was late and recorded at frame 91's time
+  VDP::CaptureReader::Cursor at = reader.seek(10100);
+  uint32_t first = 0;
+  uint32_t second = 0;
+  bool found = false;
+  while (at.next(frame)) {
+    if (frame.kind == VDP::CaptureKind::Frame) {
+      std::memcpy(&first, frame.data + 2, sizeof(first));
+      found = frame.time_us == 10100 && at.next(frame) &&
+              frame.time_us == 10100;
+      std::memcpy(&second, frame.data + 2, sizeof(second));
+      break;
+    }
+  }
+  found = found && first == 91 && second == 92;
+  reader.close();
+  std::remove(path);
+  return found;
+}
+// A session captured on one side, then played into a listener that never
+// saw it
+static bool test_capture_replay() {
+  const char *path = "/tmp/vdb_replay_test.vdc";
+  VDP::CaptureWriter::Config cfg;
+  cfg.sync_bytes = 256;
+  {
+    VDP::CaptureWriter writer{cfg};
+    if (!writer.open(path)) {
+      return false;
+    }
+    VDP::Link link;
+    VDP::CaptureDevice tap{&link.to_controller, writer};
+    VDP::Registry controller{&link.to_listener,
+                             VDP::Registry::Side::Controller};
+    VDP::Registry listener{&tap, VDP::Registry::Side::Listener};
+    listener.install_broadcast_callback([](const VDP::Channel &) {});
+    uint32_t count = 0;
+    auto counter =
+        std::make_shared<VDP::Uint32>("count", [&]() { return count++; });
+    const VDP::ChannelID id = controller.open_channel(counter);
+    if (!controller.negotiate()) {
+      return false;
+    }
+    for (int i = 0; i < 100; i++) {
+      counter->fetch();
+      controller.send_data(id, counter);
+      // Spread out enough that pacing the replay shows
+      const uint64_t until = vexSystemHighResTimeGet() + 200;
+      while (vexSystemHighResTimeGet() < until) {
+      }
+    }
+    writer.close();
+  }
+  VDP::CaptureReader reader;
+  if (!reader.open(path)) {
+    return false;
+  }
+
+  // Every value comes out in order, the schema from the capture
+  struct Played {
+    std::vector<uint32_t> values;
+    VDP::ReplayDevice::Stats stats;
+  };
+  auto play = [&](VDP::ReplayDevice::Config config) {
+    Played played;
+    VDP::ReplayDevice replay{reader, config};
+    VDP::Registry listener{&replay, VDP::Registry::Side::Listener};
+    listener.install_broadcast_callback([](const VDP::Channel &) {});
+    listener.install_data_callback([&](const VDP::Channel &chan) {
+      played.values.push_back(
+          std::static_pointer_cast<VDP::Uint32>(chan.data)->getValue());
+    });
+    played.stats = replay.run();
+    return played;
+  };
+
+  VDP::ReplayDevice::Config fastest;
+  fastest.speed = 0;
+  const Played all = play(fastest);
+  if (all.values.size() != 100 || all.stats.frames < 101 ||
+      all.stats.schemas != 1 || all.stats.dropped != 0 ||
+      all.stats.replies == 0 || all.stats.capture_us < 99 * 200) {
+    return false;
+  }
+  for (uint32_t i = 0; i < all.values.size(); i++) {
+    if (all.values[i] != i) {
+      return false;
+    }
+  }
+
+  // Played at its speed it takes as long as it did, twice as fast half that
+  VDP::ReplayDevice::Config realtime;
+  const Played real = play(realtime);
+  VDP::ReplayDevice::Config doubled;
+  doubled.speed = 2;
+  const Played twice = play(doubled);
+  if (real.values != all.values || twice.values != all.values ||
+      real.stats.wall_ns < real.stats.capture_us * 1000 ||
+      twice.stats.wall_ns < twice.stats.capture_us * 500 ||
+      real.stats.wait_ns == 0) {
+    return false;
+  }
+
+  // Starting part way in, the schema copied at the Sync still gets there
+  VDP::ReplayDevice::Config later;
+  later.speed = 0;
+  later.from_us = reader.start_time_us() + all.stats.capture_us / 2;
+  const Played half = play(later);
+  if (half.values.empty() || half.values.size() >= 100 ||
+      half.values.back() != 99 || half.stats.dropped != 0) {
+    return false;
+  }
+  reader.close();
+  std::remove(path);
+  return true;
+}
+} // namespace CaptureTest
+#endif
+
 bool test_all() {
   using Test = std::pair<const char *, bool (*)()>;
-  std::array<Test, 1> tests = {
+  // Host only tests are left out on the brain, no count to keep in step
+  static const Test tests[] = {
       Test{"Test Broadcast", RegistryTest::test_broadcast},
+      Test{"Test Batching", RegistryTest::test_batching},
+      Test{"Test Delta encoding", RegistryTest::test_delta},
+      Test{"Test pipelined negotiation",
+           RegistryTest::test_pipelined_negotiation},
+      Test{"Test schema cache", RegistryTest::test_schema_cache},
+      Test{"Test send path allocations", RegistryTest::test_send_allocations},
+      Test{"Test sequenced loss and NACK retransmit",
+           RegistryTest::test_sequenced_loss},
+      Test{"Test link metrics channel", RegistryTest::test_link_metrics},
+      Test{"Test Scheduler deadline order", SchedulerTest::test_deadline_order},
+      Test{"Test sample series", SchedulerTest::test_series},
+      Test{"Test column sink", SchedulerTest::test_column_sink},
+      Test{"Test Layout plan", LayoutTest::test_layout_plan},
+      Test{"Test PacketReader bounds", LayoutTest::test_reader_bounds},
+      Test{"Test compact integers", LayoutTest::test_compact_integers},
+      Test{"Test quantized floats", LayoutTest::test_quantized_floats},
+      Test{"Test arrays", LayoutTest::test_arrays},
+      Test{"Test static records", LayoutTest::test_static_records},
+      Test{"Test set fields", LayoutTest::test_set_fields},
+      Test{"Test schema arena", LayoutTest::test_schema_arena},
+      Test{"Test CRC32 bulk update", CRC32Test::test_bulk_matches_bytewise},
+      Test{"Test byte ring wraparound", ByteRingTest::test_wraparound},
+      Test{"Test byte ring multiple producers",
+           ByteRingTest::test_multiple_producers},
+      Test{"Test COBS stream decoder", COBSTest::test_stream_decoder},
+#ifndef VexV5
+      Test{"Test transmit priority and rate",
+           COBSTest::test_transmit_priority_and_rate},
+      Test{"Test capture file", CaptureTest::test_capture_file},
+      Test{"Test capture write error", CaptureTest::test_capture_write_error},
+      Test{"Test capture out of order",
+           CaptureTest::test_capture_out_of_order},
+      Test{"Test capture replay", CaptureTest::test_capture_replay},
+#endif
   };
 
   bool all_passed = true;
-  for (Test test : tests) {
+  for (const Test &test : tests) {
     bool res = test.second();
     if (res == false) {
       printf("Test '%s' failed\n", test.first);
@@ -1,4 +1,7 @@
 #include "vdb/types.hpp"
+#include "vdb/quantize.hpp"
+
+#include <cmath>
 namespace VDP {
 
 Record::Record(std::string name, const std::vector<Part *> &parts)
@@ -9,19 +12,37 @@ Record::Record(std::string name, const std::vector<Part *> &parts)
   }
 }
 Record::Record(std::string name) : Part(std::move(name)), fields({}) {}
-void Record::setFields(std::vector<PartPtr> fs) { fields = std::move(fs); }
+void Record::setFields(std::vector<PartPtr> fs) {
+  const bool had_fields = !fields.empty();
+  fields = std::move(fs);
+  if (had_fields) {
+    // A plan may have the old fields bound
+    LayoutPlan::shape_changed();
+  }
+}
 
 Record::Record(std::string name, std::vector<PartPtr> parts)
     : Part(std::move(name)), fields(std::move(parts)) {}
 
-Record::Record(std::string name, PacketReader &reader)
-    : Part(std::move(name)), fields() {
+Record::Record(std::string name, PacketReader &reader, bool compact,
+               SchemaArena *arena)
+    : Part(std::move(name)), fields(), compact(compact) {
   // Name and type already read, only need to read number of fields before child
   // data shows up
-  const uint32_t size = reader.get_number<SizeT>();
-  fields.reserve(size);
-  for (size_t i = 0; i < size; i++) {
-    fields.push_back(make_decoder(reader));
+  const uint64_t size =
+      compact ? reader.get_varint() : reader.get_number<SizeT>();
+  // Every field takes at least a type and a name terminator, don't trust a
+  // count the packet can't hold
+  if (size > reader.remaining() / 2) {
+    reader.fail(ReadStatus::BadSchema);
+    return;
+  }
+  fields.reserve((size_t)size);
+  for (size_t i = 0; i < size && reader.ok(); i++) {
+    PartPtr field = make_decoder(reader, arena);
+    if (field != nullptr) {
+      fields.push_back(std::move(field));
+    }
   }
 }
 void Record::fetch() {
@@ -30,9 +51,13 @@ void Record::fetch() {
   }
 }
 void Record::write_schema(PacketWriter &sofar) const {
-  sofar.write_type(Type::Record);           // Type
-  sofar.write_string(name);                 // Name
-  sofar.write_number<SizeT>(fields.size()); // Number of fields
+  sofar.write_type(Type::Record, compact); // Type
+  sofar.write_string(name);                // Name
+  if (compact) {                           // Number of fields
+    sofar.write_varint(fields.size());
+  } else {
+    sofar.write_number<SizeT>(fields.size());
+  }
   for (const PartPtr &field : fields) {
     field->write_schema(sofar);
   }
@@ -43,6 +68,35 @@ void Record::write_message(PacketWriter &sofar) const {
   }
 }
 
+void Record::plan_layout(LayoutPlan &plan) {
+  for (auto &f : fields) {
+    plan.hold(f);
+    f->plan_layout(plan);
+  }
+}
+
+void Record::use_compact_integers(bool on) {
+  compact = on;
+  for (auto &f : fields) {
+    f->use_compact_integers(on);
+  }
+}
+
+bool Record::supports_delta() const {
+  for (const auto &f : fields) {
+    if (!f->supports_delta()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Record::collect_leaves(std::vector<Part *> &out) {
+  for (auto &f : fields) {
+    f->collect_leaves(out);
+  }
+}
+
 void Record::read_data_from_message(PacketReader &reader) {
   for (auto &f : fields) {
     f->read_data_from_message(reader);
@@ -97,25 +151,126 @@ void String::write_message(PacketWriter &sofar) const {
   sofar.write_string(value);
 }
 
+void String::plan_layout(LayoutPlan &plan) { plan.add_string(value); }
+
 void String::read_data_from_message(PacketReader &reader) {
-  value = reader.get_string();
+  reader.get_string(value);
 }
+// The low bit of the packet type lives where the whole type used to so that
+// broadcast and data headers are unchanged. Newer types use the extension bits
 static constexpr auto PACKET_TYPE_BIT_LOCATION = 7;
 static constexpr auto PACKET_FUNCTION_BIT_LOCATION = 6;
+static constexpr auto PACKET_TYPE_EXT_BIT_LOCATION = 4;
+static constexpr uint8_t PACKET_TYPE_EXT_MASK = 0x3;
+static constexpr uint8_t PACKET_FLAGS_MASK = 0x0f;
 
 uint8_t make_header_byte(PacketHeader head) {
 
   uint8_t b = 0;
-  b |= ((uint8_t)head.type) << PACKET_TYPE_BIT_LOCATION;
+  b |= (((uint8_t)head.type) & 1) << PACKET_TYPE_BIT_LOCATION;
   b |= ((uint8_t)head.func) << PACKET_FUNCTION_BIT_LOCATION;
+  b |= ((((uint8_t)head.type) >> 1) & PACKET_TYPE_EXT_MASK)
+       << PACKET_TYPE_EXT_BIT_LOCATION;
+  b |= head.flags & PACKET_FLAGS_MASK;
   return b;
 }
 PacketHeader decode_header_byte(uint8_t hb) {
-  const PacketType pt = (PacketType)((hb >> PACKET_TYPE_BIT_LOCATION) & 1);
+  const uint8_t type_low = (hb >> PACKET_TYPE_BIT_LOCATION) & 1;
+  const uint8_t type_ext =
+      (hb >> PACKET_TYPE_EXT_BIT_LOCATION) & PACKET_TYPE_EXT_MASK;
+  const PacketType pt = (PacketType)(type_low | (type_ext << 1));
   const PacketFunction func =
       (PacketFunction)((hb >> PACKET_FUNCTION_BIT_LOCATION) & 1);
 
-  return {pt, func};
+  return {pt, func, (uint8_t)(hb & PACKET_FLAGS_MASK)};
+}
+
+Half::Half(std::string name, FetchFunc fetcher)
+    : Part(std::move(name)), fetcher(std::move(fetcher)) {}
+
+void Half::fetch() { setValue(fetcher()); }
+void Half::setValue(float value) {
+  const uint16_t h = float_to_half(value);
+  std::memcpy(slot.data, &h, sizeof(h));
+}
+float Half::getValue() const {
+  uint16_t h;
+  std::memcpy(&h, slot.data, sizeof(h));
+  return half_to_float(h);
+}
+
+void Half::write_schema(PacketWriter &sofar) const {
+  sofar.write_type(Type::Half); // Type
+  sofar.write_string(name);     // Name
+}
+void Half::write_message(PacketWriter &sofar) const {
+  sofar.write_bytes(slot.data, sizeof(uint16_t));
+}
+void Half::plan_layout(LayoutPlan &plan) {
+  plan.add_fixed(slot, sizeof(uint16_t));
+}
+void Half::read_data_from_message(PacketReader &reader) {
+  reader.get_bytes(slot.data, sizeof(uint16_t));
+}
+
+void Half::pprint(std::stringstream &ss, size_t indent) const {
+  add_indents(ss, indent);
+  ss << name << ":\t" << to_string(Type::Half);
+}
+void Half::pprint_data(std::stringstream &ss, size_t indent) const {
+  add_indents(ss, indent);
+  ss << name << ":\t" << getValue();
+}
+
+Fixed16::Fixed16(std::string name, float scale, float offset,
+                 FetchFunc fetcher)
+    : Part(std::move(name)), fetcher(std::move(fetcher)), scale(scale),
+      inv_scale(1.0f / scale), offset(offset) {}
+
+Fixed16::Fixed16(std::string name, PacketReader &reader)
+    : Part(std::move(name)), fetcher([]() { return 0.0f; }),
+      scale(reader.get_number<float>()), inv_scale(1.0f / scale),
+      offset(reader.get_number<float>()) {
+  if (!std::isfinite(scale) || scale == 0.0f || !std::isfinite(offset)) {
+    reader.fail(ReadStatus::BadSchema);
+  }
+}
+
+void Fixed16::fetch() { setValue(fetcher()); }
+void Fixed16::setValue(float value) {
+  const int16_t q = quantize_fixed16(value, inv_scale, offset);
+  std::memcpy(slot.data, &q, sizeof(q));
+}
+float Fixed16::getValue() const {
+  int16_t q;
+  std::memcpy(&q, slot.data, sizeof(q));
+  return dequantize_fixed16(q, scale, offset);
+}
+
+void Fixed16::write_schema(PacketWriter &sofar) const {
+  sofar.write_type(Type::Fixed16);   // Type
+  sofar.write_string(name);          // Name
+  sofar.write_number<float>(scale);  // Scale
+  sofar.write_number<float>(offset); // Offset
+}
+void Fixed16::write_message(PacketWriter &sofar) const {
+  sofar.write_bytes(slot.data, sizeof(int16_t));
+}
+void Fixed16::plan_layout(LayoutPlan &plan) {
+  plan.add_fixed(slot, sizeof(int16_t));
+}
+void Fixed16::read_data_from_message(PacketReader &reader) {
+  reader.get_bytes(slot.data, sizeof(int16_t));
+}
+
+void Fixed16::pprint(std::stringstream &ss, size_t indent) const {
+  add_indents(ss, indent);
+  ss << name << ":\t" << to_string(Type::Fixed16) << "(x" << scale << "+"
+     << offset << ")";
+}
+void Fixed16::pprint_data(std::stringstream &ss, size_t indent) const {
+  add_indents(ss, indent);
+  ss << name << ":\t" << getValue();
 }
 
 } // namespace VDP
@@ -11,15 +11,42 @@ void delay_ms(uint32_t ms) { vexDelay(ms); }
 uint32_t time_ms() { return vexSystemTimeGet(); }
 
 Device::Device(int32_t port, int32_t baud_rate)
-    : COBSSerialDevice(port, baud_rate) {}
+    : COBSSerialDevice(port, baud_rate) {
+  start_servicing();
+}
+
+Device::~Device() { stop_servicing(); }
 
 bool Device::send_packet(const VDP::Packet &packet) {
-  return COBSSerialDevice::send_cobs_packet(packet);
+  return COBSSerialDevice::send_cobs_packet(packet, priority_of(packet));
+}
+
+COBSSerialDevice::Priority Device::priority_of(const VDP::Packet &packet) {
+  if (packet.empty()) {
+    return Priority::Data;
+  }
+  const VDP::PacketHeader header = VDP::decode_header_byte(packet[0]);
+  if (header.func == VDP::PacketFunction::Acknowledge) {
+    return Priority::Control;
+  }
+  if (header.type == VDP::PacketType::Broadcast ||
+      header.type == VDP::PacketType::Offer) {
+    return Priority::Broadcast;
+  }
+  return Priority::Data;
 }
 void Device::register_receive_callback(
     std::function<void(const VDP::Packet &packet)> new_callback) {
+  callback_mutex.lock();
   callback = std::move(new_callback);
+  callback_mutex.unlock();
+}
+void Device::cobs_packet_callback(const Packet &pac) {
+  callback_mutex.lock();
+  if (callback) {
+    callback(pac);
+  }
+  callback_mutex.unlock();
 }
-void Device::cobs_packet_callback(const Packet &pac) { callback(pac); }
 
 } // namespace VDB